@@ -6,28 +6,90 @@
  */
 
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "file.h"
+#include "file_mapped.h"
+#include "internals/download_priv.h"
+#include "internals/download_ring.h"
 #include "internals/download_session.h"
 #include "internals/download_url.h"
+#include "internals/inflate.h"
 #include "insert_order_map.h"
-#include "str.h"
 
 namespace wl {
 
 // Automates internet download operations.
+// By default the body is stored in data; a sink can be set to stream it elsewhere, chunk by chunk.
+// A byte range can be requested, an interrupted download can be resumed into a file, and a large
+// resource can be fetched in segments through many connections at once. Compressed responses can
+// be decoded on the fly. A request body can be sent from memory, a mapped file or a callback.
 class download final {
 public:
 	using session = _wli::download_session;
 	using url_crack = _wli::download_url;
+	using ring = _wli::download_ring;
 
 private:
+	static const size_t _CHUNK_SIZE = 256 * 1024; // bytes read at once when streaming to a sink
+	static constexpr size_t _BODY_CHUNK = 1024 * 1024; // bytes of request body written at once
+	static constexpr size_t _BODY_HEAD = 10; // room for the size line of a chunk, in chunked transfer encoding
+	static constexpr int    _MAX_RESENDS = 3; // times the body is sent again, if asked for authentication or redirection
+	static constexpr UINT64 _SEG_MIN = 512 * 1024, _SEG_MAX = 64 * 1024 * 1024; // bounds of a segment size
+	static constexpr UINT64 _SEG_MILLISECS = 2000; // time a segment should take, at the measured throughput
+	static constexpr int    _SEG_TRIES = 3; // attempts to fetch a segment when the connection drops
+
+	struct _seg_range final {
+		UINT64 first, end; // [first, end)
+		int    tries;
+	};
+
+	struct _seg_state final { // shared by the workers of start_segmented()
+		file&                   dest;
+		std::mutex              mtx, fileMtx;
+		std::condition_variable cv;
+		bool                    isProbing = false, isProbed = false, isWhole = false, hasNews = false;
+		UINT64                  total = 0, cursor = 0; // resource size, and first byte not yet assigned
+		std::deque<_seg_range>  holes; // segments cut short, to be fetched again
+		std::wstring            validator;
+		DWORD                   status = 0;
+		insert_order_map<std::wstring, std::wstring> headers; // of the probe response
+		size_t                  numActive = 0;
+		std::exception_ptr      error;
+		std::atomic<UINT64>     numGot{0};
+		std::atomic<bool>       isCancelled{false};
+
+		explicit _seg_state(file& dest) : dest{dest} { }
+	};
+
 	const session& _session;
 	HINTERNET      _hConnect = nullptr, _hRequest = nullptr;
-	size_t         _contentLength = 0, _totalGot = 0;
-	std::wstring   _url, _verb, _referrer;
+	UINT64         _contentLength = 0, _totalGot = 0, _totalDecoded = 0;
+	UINT64         _rangeOffset = 0, _rangeCount = 0, _resumeAt = 0;
+	UINT64         _bodyLength = 0, _totalSent = 0;
+	DWORD          _statusCode = 0;
+	bool           _isDecoding = false; // set by decode_content()
+	std::wstring   _url, _verb, _referrer, _ifRange;
 	insert_order_map<std::wstring, std::wstring> _requestHeaders;
 	insert_order_map<std::wstring, std::wstring> _responseHeaders;
 	std::function<void()> _startCallback, _progressCallback;
+	std::function<void(const BYTE*, size_t)> _sink; // if empty, body goes to data
+	ring*             _pRing = nullptr; // closed when the download ends
+	std::vector<BYTE> _chunk; // reused for each read when streaming
+	file*             _pResumeFile = nullptr; // set by resume_to()
+	_seg_state*       _pSegs = nullptr; // set while start_segmented() runs
+	std::unique_ptr<_wli::inflater_stream> _pDecoder; // if response is compressed and decoding is enabled
+	const BYTE*       _pBody = nullptr; // request body in memory
+	file_mapped::view _bodyView; // keeps the mapped file of the body alive
+	std::function<size_t(BYTE*, size_t)> _bodyProducer; // request body from a callback
 
 public:
 	std::vector<BYTE> data;
@@ -40,6 +102,7 @@ public:
 		_session{sess}, _url{url}, _verb{verb} { }
 
 	download& abort() noexcept {
+		if (this->_pSegs) this->_pSegs->isCancelled = true; // workers stop at their next chunk
 		if (this->_hRequest) {
 			WinHttpCloseHandle(this->_hRequest);
 			this->_hRequest = nullptr;
@@ -48,7 +111,8 @@ public:
 			WinHttpCloseHandle(this->_hConnect);
 			this->_hConnect = nullptr;
 		}
-		this->_contentLength = this->_totalGot = 0;
+		this->_contentLength = this->_totalGot = this->_totalDecoded = 0;
+		this->_totalSent = 0;
 		return *this;
 	}
 
@@ -69,47 +133,210 @@ public:
 	}
 
 	// Defines a lambda do be called each time a chunk of bytes is received.
+	// If there's a request body, it's also called each time a chunk of it is sent.
 	download& on_progress(std::function<void()> callback) noexcept {
 		this->_progressCallback = std::move(callback);
 		return *this;
 	}
 
+	// Body will be written to the file, at its current pointer, instead of data.
+	// The file must remain open until the download ends.
+	download& write_to(file& dest) {
+		this->_pRing = nullptr;
+		this->_pResumeFile = nullptr;
+		this->_sink = [&dest](const BYTE* pData, size_t sz) -> void {
+			dest.write(pData, sz);
+		};
+		return *this;
+	}
+
+	// Body will be written to the ring buffer, instead of data, to be read by another thread.
+	// The ring is closed when the download ends; if the reader closes it, the download is aborted.
+	download& write_to(ring& dest) {
+		this->_pRing = &dest;
+		this->_pResumeFile = nullptr;
+		this->_sink = [this, &dest](const BYTE* pData, size_t sz) -> void {
+			if (!dest.write(pData, sz)) this->abort(); // reader gave up
+		};
+		return *this;
+	}
+
+	// Body will be handed to the lambda, chunk by chunk, instead of stored in data.
+	// The pointer is valid only during the call. Pass nullptr to go back to data.
+	download& on_data(std::function<void(const BYTE*, size_t)> callback) noexcept {
+		this->_pRing = nullptr;
+		this->_pResumeFile = nullptr;
+		this->_sink = std::move(callback);
+		return *this;
+	}
+
+	// Request body to be sent, like for POST or PUT; the memory must remain valid until the download ends.
+	// It's written straight from there, in large chunks. Pass nullptr to send no body.
+	download& set_body(const BYTE* pData, size_t sz) noexcept {
+		this->_clear_body();
+		this->_pBody = pData;
+		this->_bodyLength = pData ? sz : 0;
+		return *this;
+	}
+
+	// Request body to be sent, like for POST or PUT; the vector must remain untouched until the download ends.
+	download& set_body(const std::vector<BYTE>& data) noexcept {
+		return this->set_body(data.data(), data.size());
+	}
+
+	// Request body to be sent from a mapped file, with no copy; the view keeps the file mapped.
+	download& set_body(file_mapped::view view) noexcept {
+		this->set_body(view.data(), view.size());
+		this->_bodyView = std::move(view);
+		return *this;
+	}
+
+	// Request body to be produced by the lambda, which fills the buffer with up to the given number of bytes,
+	// returning how many it wrote, or zero at the end. If totalSize isn't known, pass zero, and the body
+	// will be sent with chunked transfer encoding.
+	download& set_body(std::function<size_t(BYTE*, size_t)> producer, UINT64 totalSize = 0) {
+		this->_clear_body();
+		this->_bodyProducer = std::move(producer);
+		this->_bodyLength = totalSize;
+		return *this;
+	}
+
+	// Asks the server for a gzip or deflate compressed response, which is decoded while it arrives, chunk by
+	// chunk, before reaching data or the sink. The content length and the progress still count the bytes
+	// on the wire; get_total_decoded() counts the bytes after decoding. Can't be used with byte ranges.
+	download& decode_content(bool enable = true) noexcept {
+		this->_isDecoding = enable;
+		return *this;
+	}
+
+	// Asks only for count bytes starting at offset; zero count goes up to the end, and zero for both means
+	// the whole resource. If ifRange is a validator from a previous response, see get_validator(), the server
+	// sends the whole resource, with status 200, in case it changed since then.
+	download& set_range(UINT64 offset, UINT64 count = 0, std::wstring ifRange = L"") {
+		this->_rangeOffset = offset;
+		this->_rangeCount = count;
+		this->_ifRange = std::move(ifRange);
+		return *this;
+	}
+
+	// Continues an interrupted download into the file, asking only for the bytes beyond its current size.
+	// If the server ignores the range, or the resource doesn't match ifRange anymore, the file is rewritten
+	// from the start. The file gets the body only with status 200 or 206, otherwise it goes to data; a 416
+	// usually means the file is already complete. The file must remain open until the download ends.
+	download& resume_to(file& dest, std::wstring ifRange = L"") {
+		this->set_range(dest.size(), 0, std::move(ifRange));
+		this->_pRing = nullptr;
+		this->_pResumeFile = &dest;
+		this->_sink = [this, &dest](const BYTE* pData, size_t sz) -> void {
+			dest.write_at(this->_resumeAt, pData, sz);
+			this->_resumeAt += sz;
+		};
+		return *this;
+	}
+
 	// Effectively starts the download, returning only after it completes.
 	download& start() {
-		if (this->_hConnect) {
-			throw std::logic_error("A download is already in progress.");
-		} else if (this->_url.empty()) {
-			throw std::invalid_argument("Blank URL.");
+		this->_check_not_started();
+		if (this->_isDecoding && (this->_rangeOffset || this->_rangeCount)) {
+			throw std::logic_error("Content decoding can't be used with byte ranges.");
 		}
 
-		this->_contentLength = this->_totalGot = 0;
-		this->_init_handles();
-		this->_contact_server();
-		this->_parse_headers();
-		this->data.clear(); // prepare buffer to receive data
-		if (this->_contentLength) { // server informed content length?
-			this->data.reserve(this->_contentLength);
+		try {
+			this->_contentLength = this->_totalGot = this->_totalDecoded = 0;
+			this->_statusCode = 0;
+			this->_init_handles();
+			if (!this->_contact_server()) { // user called abort() while the body was being sent
+				if (this->_pRing) this->_pRing->close(true);
+				return *this;
+			}
+			this->_parse_headers();
+			bool isSunk = this->_sink && (!this->_pResumeFile || this->_prepare_resume()); // else body goes to data
+			this->_prepare_decoder();
+			this->data.clear(); // prepare buffer to receive data
+			if (this->_contentLength && !isSunk) { // server informed content length?
+				this->data.reserve(static_cast<size_t>(this->_contentLength));
+			}
+
+			if (this->_startCallback) this->_startCallback(); // run user callback
+
+			if (this->_hConnect && this->_hRequest) { // user didn't call abort()
+				if (this->_pDecoder) {
+					this->_receive_decoded(isSunk);
+				} else if (isSunk) {
+					this->_receive_to_sink();
+				} else {
+					this->_receive_to_data();
+				}
+			}
+		} catch (...) {
+			this->abort();
+			if (this->_pRing) this->_pRing->close(true);
+			throw;
 		}
 
-		if (this->_startCallback) this->_startCallback(); // run user callback
+		if (this->_pRing) this->_pRing->close(this->_hRequest == nullptr); // aborted by user or reader?
+		return this->abort(); // cleanup
+	}
 
-		if (this->_hConnect && this->_hRequest) { // user didn't call abort()
-			for (;;) {
-				DWORD incomingBytes = this->_get_incoming_byte_count(); // chunk size about to come
-				if (!incomingBytes) break; // no more bytes remaining
-				this->_receive_bytes(incomingBytes); // chunk will be appended into this->data
-				if (this->_progressCallback) this->_progressCallback();
-				if (!this->_hConnect && !this->_hRequest) break; // user called abort()
+	// Downloads the resource into the file through many connections at once, each one fetching a byte range
+	// written at its own offset, into the file preallocated to the full size. Each connection sizes its next
+	// range after the throughput it has measured. If the server doesn't accept ranges, the body comes whole
+	// through a single connection. The verb is always GET. Returns only after it completes; the callbacks
+	// run in the calling thread, and get_total_downloaded() sums all connections.
+	download& start_segmented(file& dest, size_t numConnections = 4) {
+		this->_check_not_started();
+		if (this->_isDecoding) {
+			throw std::logic_error("Content decoding can't be used with byte ranges.");
+		} else if (!numConnections) {
+			throw std::invalid_argument("Number of connections can't be zero.");
+		}
+
+		this->_contentLength = this->_totalGot = 0;
+		this->_statusCode = 0;
+		_seg_state segs{dest};
+		segs.numActive = numConnections;
+		std::vector<std::thread> workers;
+		this->_pSegs = &segs;
+
+		try {
+			for (size_t i = 0; i < numConnections; ++i) {
+				workers.emplace_back(&download::_seg_worker, this, std::ref(segs), numConnections);
 			}
+			this->_seg_wait(segs);
+		} catch (...) { // thread creation or user callback failed
+			{
+				std::lock_guard<std::mutex> lock{segs.mtx};
+				segs.isCancelled = true;
+			}
+			segs.cv.notify_all();
+			for (std::thread& worker : workers) worker.join();
+			this->_pSegs = nullptr;
+			throw;
 		}
 
+		for (std::thread& worker : workers) worker.join();
+		this->_pSegs = nullptr;
+		if (segs.error) std::rethrow_exception(segs.error);
 		return this->abort(); // cleanup
 	}
 
 	const insert_order_map<std::wstring, std::wstring>& get_request_headers() const noexcept  { return this->_requestHeaders; }
 	const insert_order_map<std::wstring, std::wstring>& get_response_headers() const noexcept { return this->_responseHeaders; }
-	size_t get_content_length() const noexcept   { return this->_contentLength; }
-	size_t get_total_downloaded() const noexcept { return this->_totalGot; }
+	UINT64 get_content_length() const noexcept   { return this->_contentLength; }
+	UINT64 get_total_downloaded() const noexcept { return this->_totalGot; }
+	UINT64 get_total_decoded() const noexcept    { return this->_pDecoder ? this->_totalDecoded : this->_totalGot; }
+	UINT64 get_body_length() const noexcept      { return this->_bodyLength; } // zero if unknown
+	UINT64 get_total_uploaded() const noexcept   { return this->_totalSent; }
+	DWORD  get_status_code() const noexcept      { return this->_statusCode; }
+
+	// Returns the strong ETag of the response, or else its Last-Modified date; empty if none.
+	// Pass it later to set_range() or resume_to(), so a changed resource isn't mixed with the old one.
+	std::wstring get_validator() const {
+		const std::wstring* etag = _wli::download_priv::header(this->_responseHeaders, L"ETag");
+		if (etag && etag->compare(0, 2, L"W/")) return *etag; // weak ETags aren't accepted in If-Range
+		const std::wstring* lastMod = _wli::download_priv::header(this->_responseHeaders, L"Last-Modified");
+		return lastMod ? *lastMod : L"";
+	}
 
 	// If server informed content length, returns a value between 0 and 100.
 	float get_percent() const noexcept {
@@ -123,6 +350,14 @@ private:
 		throw std::system_error(err, std::system_category(), msg);
 	}
 
+	void _check_not_started() const {
+		if (this->_hConnect || this->_pSegs) {
+			throw std::logic_error("A download is already in progress.");
+		} else if (this->_url.empty()) {
+			throw std::invalid_argument("Blank URL.");
+		}
+	}
+
 	void _init_handles() {
 		// Crack the URL.
 		url_crack crackedUrl;
@@ -146,7 +381,7 @@ private:
 		}
 	}
 
-	void _contact_server() {
+	bool _contact_server() {
 		// Add the request headers to request handle.
 		std::wstring rhTmp;
 		rhTmp.reserve(20);
@@ -154,60 +389,162 @@ private:
 			rhTmp = rh.key;
 			rhTmp += L": ";
 			rhTmp += rh.value;
+			this->_add_header(rhTmp);
+		}
 
-			if (!WinHttpAddRequestHeaders(this->_hRequest, rhTmp.c_str(), static_cast<ULONG>(-1L), WINHTTP_ADDREQ_FLAG_ADD)) {
-				this->_abort_and_throw(GetLastError(), "WinHttpAddRequestHeaders failed");
-			}
+		if (this->_isDecoding) {
+			this->_add_header(L"Accept-Encoding: gzip, deflate");
 		}
 
-		// Send the request to server.
-		if (!WinHttpSendRequest(this->_hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, 0)) {
-			this->_abort_and_throw(GetLastError(), "WinHttpSendRequest failed");
+		if (this->_rangeOffset || this->_rangeCount) { // partial request
+			rhTmp = L"Range: bytes=";
+			rhTmp += std::to_wstring(this->_rangeOffset);
+			rhTmp += L'-';
+			if (this->_rangeCount) rhTmp += std::to_wstring(this->_rangeOffset + this->_rangeCount - 1);
+			this->_add_header(rhTmp);
+
+			if (!this->_ifRange.empty()) {
+				rhTmp = L"If-Range: ";
+				rhTmp += this->_ifRange;
+				this->_add_header(rhTmp);
+			}
 		}
 
-		// Receive the response from server.
-		if (!WinHttpReceiveResponse(this->_hRequest, nullptr)) {
-			this->_abort_and_throw(GetLastError(), "WinHttpReceiveResponse failed");
+		// Total length of request body, if known; DWORD can't hold it beyond 4 GB.
+		DWORD totalLength = static_cast<DWORD>(this->_bodyLength);
+		if (this->_bodyProducer && !this->_bodyLength) {
+			this->_add_header(L"Transfer-Encoding: chunked");
+			totalLength = WINHTTP_IGNORE_REQUEST_TOTAL_LENGTH;
+		} else if (this->_bodyLength > MAXDWORD) {
+			rhTmp = L"Content-Length: ";
+			rhTmp += std::to_wstring(this->_bodyLength);
+			this->_add_header(rhTmp);
+			totalLength = WINHTTP_IGNORE_REQUEST_TOTAL_LENGTH;
 		}
-	}
 
-	void _parse_headers() {
-		// Retrieve the response header.
-		DWORD rehSize = 0;
-		WinHttpQueryHeaders(this->_hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
-			WINHTTP_HEADER_NAME_BY_INDEX, WINHTTP_NO_OUTPUT_BUFFER, &rehSize, WINHTTP_NO_HEADER_INDEX);
+		for (int numSends = 1; ; ++numSends) {
+			// Send the request to server, then the body, if any.
+			this->_totalSent = 0;
+			if (!WinHttpSendRequest(this->_hRequest, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, totalLength, 0)) {
+				this->_abort_and_throw(GetLastError(), "WinHttpSendRequest failed");
+			}
+			if (!this->_send_body()) return false;
 
-		std::wstring rawReh(rehSize / sizeof(wchar_t), L'\0'); // raw response headers
+			// Receive the response from server.
+			if (WinHttpReceiveResponse(this->_hRequest, nullptr)) break;
 
-		if (!WinHttpQueryHeaders(this->_hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
-			WINHTTP_HEADER_NAME_BY_INDEX, &rawReh[0], &rehSize, WINHTTP_NO_HEADER_INDEX))
-		{
-			this->_abort_and_throw(GetLastError(), "WinHttpQueryHeaders failed");
+			DWORD err = GetLastError();
+			if (err != ERROR_WINHTTP_RESEND_REQUEST || this->_bodyProducer || numSends > _MAX_RESENDS) { // a callback can't be replayed
+				this->_abort_and_throw(err, "WinHttpReceiveResponse failed");
+			}
 		}
+		return true;
+	}
 
-		// Parse the raw response headers into an associative array.
-		this->_responseHeaders.clear();
-		std::vector<std::wstring> lines = str::split_lines(rawReh);
+	void _clear_body() noexcept {
+		this->_pBody = nullptr;
+		this->_bodyView = {};
+		this->_bodyProducer = nullptr;
+		this->_bodyLength = 0;
+	}
 
-		for (const std::wstring& line : lines) {
-			if (line.empty()) {
-				continue;
+	// Writes the request body, if any; returns false if user called abort() meanwhile.
+	bool _send_body() {
+		if (this->_pBody) { // memory or mapped file, written straight from there
+			while (this->_totalSent < this->_bodyLength) {
+				size_t sz = static_cast<size_t>(std::min<UINT64>(this->_bodyLength - this->_totalSent, _BODY_CHUNK));
+				if (!this->_write_body(this->_pBody + this->_totalSent, sz, sz)) return false;
 			}
-			size_t colonIdx = line.find_first_of(L':');
-			if (colonIdx == std::wstring::npos) { // not a key/value pair, probably response line
-				this->_responseHeaders[L""] = line; // empty key
-			} else {
-				std::wstring kk = line.substr(0, colonIdx);
-				std::wstring vv = line.substr(colonIdx + 1, line.length() - (colonIdx + 1));
-				this->_responseHeaders[str::trim(kk)] = str::trim(vv);
+		} else if (this->_bodyProducer) {
+			bool isChunked = !this->_bodyLength;
+			size_t head = isChunked ? _BODY_HEAD : 0;
+			this->_chunk.resize(head + _BODY_CHUNK + 2); // reused for each write
+			for (;;) {
+				size_t sz = this->_bodyProducer(&this->_chunk[head], _BODY_CHUNK);
+				if (sz > _BODY_CHUNK) {
+					throw std::length_error("Body callback wrote more bytes than allowed.");
+				}
+
+				if (isChunked) { // each chunk is its size in hex, CRLF, data, CRLF; a zero size ends it
+					size_t pos = head - 2;
+					memcpy(&this->_chunk[pos], "\r\n", 2);
+					memcpy(&this->_chunk[head + sz], "\r\n", 2);
+					size_t hexSz = sz;
+					do {
+						this->_chunk[--pos] = "0123456789ABCDEF"[hexSz & 0xF];
+						hexSz >>= 4;
+					} while (hexSz);
+					if (!this->_write_body(&this->_chunk[pos], head - pos + sz + 2, sz)) return false;
+					if (!sz) break;
+				} else {
+					if (!sz && this->_totalSent < this->_bodyLength) {
+						throw std::runtime_error("Body callback ended before the informed total size.");
+					} else if (sz > this->_bodyLength - this->_totalSent) {
+						throw std::runtime_error("Body callback went beyond the informed total size.");
+					} else if (!sz) {
+						break;
+					}
+					if (!this->_write_body(&this->_chunk[0], sz, sz)) return false;
+				}
 			}
 		}
+		return true;
+	}
+
+	bool _write_body(const BYTE* pData, size_t sz, size_t bodyBytes) {
+		DWORD written = 0;
+		if (!WinHttpWriteData(this->_hRequest, pData, static_cast<DWORD>(sz), &written)) {
+			this->_abort_and_throw(GetLastError(), "WinHttpWriteData failed");
+		}
+		this->_totalSent += bodyBytes;
+		if (this->_progressCallback) this->_progressCallback();
+		return this->_hConnect && this->_hRequest; // user didn't call abort()
+	}
+
+	void _add_header(const std::wstring& header) {
+		if (!WinHttpAddRequestHeaders(this->_hRequest, header.c_str(), static_cast<ULONG>(-1L), WINHTTP_ADDREQ_FLAG_ADD)) {
+			this->_abort_and_throw(GetLastError(), "WinHttpAddRequestHeaders failed");
+		}
+	}
+
+	void _parse_headers() {
+		this->_statusCode = _wli::download_priv::status_code(this->_hRequest);
+		_wli::download_priv::read_headers(this->_hRequest, this->_responseHeaders);
+		this->_contentLength = _wli::download_priv::content_length(this->_responseHeaders);
+	}
+
+	void _prepare_decoder() {
+		this->_pDecoder.reset();
+		const std::wstring* contEnc = _wli::download_priv::header(this->_responseHeaders, L"Content-Encoding");
+		if (!this->_isDecoding || !contEnc || contEnc->empty() || str::eqi(*contEnc, L"identity")) return;
+		if (str::eqi(this->_verb, L"HEAD") || this->_statusCode == 204 || this->_statusCode == 304) return; // no body, header is informative
+
+		if (str::eqi(*contEnc, L"gzip") || str::eqi(*contEnc, L"x-gzip")) {
+			this->_pDecoder = std::make_unique<_wli::inflater_stream>(_wli::inflater_stream::format::GZIP);
+		} else if (str::eqi(*contEnc, L"deflate")) {
+			this->_pDecoder = std::make_unique<_wli::inflater_stream>(_wli::inflater_stream::format::ZLIB);
+		} else {
+			throw std::runtime_error("Unsupported Content-Encoding: " + str::to_ascii(*contEnc) + ".");
+		}
+	}
 
-		// Retrieve content length, if informed by server.
-		const std::wstring* contLen = this->_responseHeaders.get_if_exists(L"Content-Length");
-		if (contLen && str::is_uint(*contLen)) { // yes, server informed content length
-			this->_contentLength = std::stoul(*contLen);
+	// Decides where the resumed body goes; returns false if it's not meant for the file.
+	bool _prepare_resume() {
+		if (this->_statusCode == 206) { // server honored the range, append
+			UINT64 first = 0, last = 0, total = 0;
+			if (!_wli::download_priv::content_range(this->_responseHeaders, first, last, total)
+				|| first != this->_rangeOffset)
+			{
+				throw std::runtime_error("Server returned a range other than the requested one.");
+			}
+			this->_resumeAt = first;
+			return true;
+		} else if (this->_statusCode == 200) { // whole resource, rewrite the file
+			this->_pResumeFile->set_new_size(0);
+			this->_resumeAt = 0;
+			return true;
 		}
+		return false;
 	}
 
 	DWORD _get_incoming_byte_count() {
@@ -218,18 +555,245 @@ private:
 		return count;
 	}
 
-	void _receive_bytes(UINT nBytesToRead) {
-		DWORD readCount = 0; // not used
-		this->data.resize(this->data.size() + nBytesToRead); // make room
+	DWORD _receive_bytes(BYTE* pDest, size_t maxBytes) {
+		DWORD readCount = 0;
+		if (!WinHttpReadData(this->_hRequest, pDest, static_cast<DWORD>(maxBytes), &readCount)) {
+			this->_abort_and_throw(GetLastError(), "WinHttpReadData failed");
+		}
+		this->_totalGot += readCount; // update total downloaded count
+		return readCount;
+	}
+
+	void _receive_to_data() {
+		for (;;) {
+			DWORD incomingBytes = this->_get_incoming_byte_count(); // chunk size about to come
+			if (!incomingBytes) break; // no more bytes remaining
+
+			size_t prevSz = this->data.size();
+			this->data.resize(prevSz + incomingBytes); // make room, append to buffer
+			this->data.resize(prevSz + this->_receive_bytes(&this->data[prevSz], incomingBytes));
+
+			if (this->_progressCallback) this->_progressCallback();
+			if (!this->_hConnect && !this->_hRequest) break; // user called abort()
+		}
+	}
+
+	void _receive_to_sink() {
+		this->_chunk.resize(_CHUNK_SIZE); // allocated once, kept for the next downloads
+		for (;;) {
+			DWORD readCount = this->_receive_bytes(this->_chunk.data(), this->_chunk.size()); // blocks until some data comes
+			if (!readCount) break; // no more bytes remaining
+
+			this->_sink(this->_chunk.data(), readCount);
+			if (!this->_hConnect && !this->_hRequest) break; // user or ring reader called abort()
+			if (this->_progressCallback) this->_progressCallback();
+			if (!this->_hConnect && !this->_hRequest) break; // user called abort()
+		}
+	}
+
+	void _receive_decoded(bool isSunk) {
+		auto output = [this, isSunk](const BYTE* pData, size_t sz) -> void {
+			this->_totalDecoded += sz;
+			if (isSunk) {
+				this->_sink(pData, sz);
+			} else {
+				this->data.insert(this->data.end(), pData, pData + sz);
+			}
+		};
+
+		this->_chunk.resize(_CHUNK_SIZE); // allocated once, kept for the next downloads
+		for (;;) {
+			DWORD readCount = this->_receive_bytes(this->_chunk.data(), this->_chunk.size()); // blocks until some data comes
+			if (!readCount) { // no more bytes remaining
+				if (!this->_totalGot) break; // empty body, even if a Content-Encoding was sent
+				UINT64 prevDecoded = this->_totalDecoded;
+				this->_pDecoder->finish(output);
+				if (this->_totalDecoded != prevDecoded && this->_progressCallback
+					&& this->_hConnect && this->_hRequest) this->_progressCallback(); // last block was held back
+				break;
+			}
+
+			this->_pDecoder->feed(this->_chunk.data(), readCount, output); // decoded blocks go out right away
+			if (!this->_hConnect && !this->_hRequest) break; // user or ring reader called abort()
+			if (this->_progressCallback) this->_progressCallback();
+			if (!this->_hConnect && !this->_hRequest) break; // user called abort()
+		}
+	}
+
+	// Runs in the calling thread of start_segmented(), relaying the progress of the workers to the callbacks.
+	void _seg_wait(_seg_state& segs) {
+		bool isStarted = false;
+		std::unique_lock<std::mutex> lock{segs.mtx};
+		for (;;) {
+			segs.cv.wait(lock, [&segs]() { return segs.hasNews || !segs.numActive; });
+			segs.hasNews = false;
+			bool isFirst = segs.isProbed && !isStarted, isOver = !segs.numActive;
+			if (isFirst) {
+				isStarted = true;
+				this->_statusCode = segs.status;
+				this->_contentLength = segs.total;
+				this->_responseHeaders = std::move(segs.headers);
+			}
+			lock.unlock();
+
+			if (isStarted && !segs.isCancelled) {
+				this->_totalGot = segs.numGot;
+				if (isFirst) {
+					if (this->_startCallback) this->_startCallback();
+				} else if (this->_progressCallback) {
+					this->_progressCallback();
+				}
+			}
+
+			lock.lock();
+			if (segs.isCancelled) segs.cv.notify_all(); // user called abort(), wake workers waiting for the probe
+			if (isOver) break;
+		}
+	}
+
+	// Each worker of start_segmented() runs a download of its own, fetching one range after another.
+	// The first range probes the server: it tells the resource size and whether ranges are accepted.
+	void _seg_worker(_seg_state& segs, size_t numWorkers) {
+		try {
+			download dl{this->_session, this->_url};
+			dl._referrer = this->_referrer;
+			for (const insert_order_map<std::wstring, std::wstring>::entry& rh : this->_requestHeaders) {
+				dl._requestHeaders[rh.key] = rh.value;
+			}
+
+			UINT64 segSz = _SEG_MIN;
+			for (;;) {
+				_seg_range rng{};
+				bool isProbe = false;
+				{
+					std::unique_lock<std::mutex> lock{segs.mtx};
+					segs.cv.wait(lock, [&segs]() { return segs.isCancelled || !segs.isProbing; });
+					if (segs.isCancelled || segs.isWhole) break;
+
+					if (!segs.isProbed) {
+						segs.isProbing = isProbe = true;
+						rng = {0, segSz, 0};
+					} else if (!segs.holes.empty()) {
+						rng = segs.holes.front();
+						segs.holes.pop_front();
+					} else if (segs.cursor < segs.total) {
+						UINT64 share = (segs.total - segs.cursor) / numWorkers; // near the end, leave work for the others
+						UINT64 sz = std::max(std::min(segSz, share), _SEG_MIN);
+						rng = {segs.cursor, std::min(segs.cursor + sz, segs.total), 0};
+						segs.cursor = rng.end;
+					} else {
+						break; // nothing left to fetch
+					}
+				}
+
+				UINT64 at = rng.first;
+				dl.set_range(rng.first, rng.end - rng.first, isProbe ? L"" : segs.validator);
+				dl.on_start([&]() {
+					if (isProbe) {
+						this->_seg_probed(segs, dl, rng);
+					} else {
+						UINT64 first = 0, last = 0, total = 0;
+						if (dl._statusCode != 206
+							|| !_wli::download_priv::content_range(dl._responseHeaders, first, last, total)
+							|| first != rng.first)
+						{
+							throw std::runtime_error("Server ignored the range request, or the resource changed meanwhile.");
+						}
+					}
+				});
+				dl.on_data([&](const BYTE* pData, size_t sz) {
+					if (segs.isCancelled) {
+						dl.abort();
+						return;
+					}
+					if (!segs.isWhole) sz = static_cast<size_t>(std::min<UINT64>(sz, rng.end - at)); // never beyond the range
+					{
+						std::lock_guard<std::mutex> lock{segs.fileMtx};
+						segs.dest.write_at(at, pData, sz);
+					}
+					at += sz;
+					segs.numGot += sz;
+					{
+						std::lock_guard<std::mutex> lock{segs.mtx};
+						segs.hasNews = true;
+					}
+					segs.cv.notify_all();
+				});
+
+				auto t0 = std::chrono::steady_clock::now();
+				try {
+					dl.start();
+				} catch (const std::system_error&) {
+					if (isProbe || (at == rng.first && rng.tries + 1 >= _SEG_TRIES)) throw;
+				}
+				if (segs.isCancelled || segs.isWhole) break;
+
+				if (at < rng.end) { // connection dropped, the rest will be fetched again
+					rng.tries = (at > rng.first) ? 0 : rng.tries + 1; // give up only if nothing comes
+					if (rng.tries >= _SEG_TRIES) {
+						throw std::runtime_error("Server kept closing the connection of a segment.");
+					}
+					std::lock_guard<std::mutex> lock{segs.mtx};
+					segs.holes.push_back({at, rng.end, rng.tries});
+				}
+
+				UINT64 ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+					std::chrono::steady_clock::now() - t0).count();
+				if (at > rng.first && ms) { // adapt to the measured throughput
+					segSz = std::min(std::max((at - rng.first) * _SEG_MILLISECS / ms, _SEG_MIN), _SEG_MAX);
+				}
+			}
+		} catch (...) {
+			std::lock_guard<std::mutex> lock{segs.mtx};
+			if (!segs.error) segs.error = std::current_exception();
+			segs.isCancelled = true;
+		}
 
-		if (!WinHttpReadData(this->_hRequest,
-			static_cast<void*>(&this->data[this->data.size() - nBytesToRead]), // append to buffer
-			nBytesToRead, &readCount) )
 		{
-			this->_abort_and_throw(GetLastError(), "WinHttpReadData failed");
+			std::lock_guard<std::mutex> lock{segs.mtx};
+			--segs.numActive;
+			segs.hasNews = true;
+		}
+		segs.cv.notify_all();
+	}
+
+	// Called by the worker which made the first request, once its headers arrive.
+	void _seg_probed(_seg_state& segs, download& dl, _seg_range& rng) {
+		UINT64 first = 0, last = 0, total = 0;
+		bool hasRange = _wli::download_priv::content_range(dl._responseHeaders, first, last, total);
+		std::unique_lock<std::mutex> lock{segs.mtx};
+
+		if (dl._statusCode == 206) {
+			if (!hasRange || first || !total) {
+				throw std::runtime_error("Server returned a range other than the requested one.");
+			}
+			rng.end = std::min(rng.end, total);
+			segs.total = total;
+			segs.cursor = rng.end;
+			segs.validator = dl.get_validator();
+			std::lock_guard<std::mutex> fileLock{segs.fileMtx};
+			segs.dest.set_new_size(total); // preallocate, ranges are written in place
+		} else if (dl._statusCode == 200) { // ranges not accepted, body comes whole
+			segs.isWhole = true;
+			segs.total = dl._contentLength;
+			std::lock_guard<std::mutex> fileLock{segs.fileMtx};
+			segs.dest.set_new_size(0);
+		} else if (dl._statusCode == 416 && hasRange && !total) { // empty resource
+			rng.end = 0;
+			std::lock_guard<std::mutex> fileLock{segs.fileMtx};
+			segs.dest.set_new_size(0);
+		} else {
+			throw std::runtime_error("Server refused the download with HTTP status "
+				+ std::to_string(dl._statusCode) + ".");
 		}
 
-		this->_totalGot += nBytesToRead; // update total downloaded count
+		segs.status = dl._statusCode;
+		segs.headers = std::move(dl._responseHeaders);
+		segs.isProbed = true;
+		segs.isProbing = false;
+		segs.hasNews = true;
+		lock.unlock();
+		segs.cv.notify_all();
 	}
 };
 
@@ -0,0 +1,431 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "internals/download_priv.h"
+#include "internals/download_session.h"
+#include "internals/download_url.h"
+#include "insert_order_map.h"
+
+namespace wl {
+
+// Runs many downloads at once, on an asynchronous WinHTTP session.
+// Requests to the same host share a connection handle, so their keep-alive connections are reused.
+// Requests beyond the concurrency limit wait in a queue, and start in the order they were added.
+class download_pool final {
+public:
+	struct request final {
+		std::wstring url;
+		std::wstring verb = L"GET";
+		insert_order_map<std::wstring, std::wstring> headers;
+	};
+
+	struct response final {
+		std::wstring      url;
+		DWORD             status = 0; // HTTP status code, like 200
+		DWORD             error = 0; // zero if the request succeeded, else a WinHTTP error code
+		insert_order_map<std::wstring, std::wstring> headers;
+		std::vector<BYTE> data;
+	};
+
+private:
+	struct _job final {
+		download_pool*                 pPool;
+		request                        req;
+		response                       res;
+		std::function<void(response&)> onDone; // if empty, the promise is used
+		std::promise<response>         promise;
+		HINTERNET                      hRequest = nullptr;
+		size_t                         readOffset = 0; // where the pending read goes into res.data
+		bool                           isComplete = false; // whole body was read
+		bool                           isCancelled = false;
+	};
+
+	_wli::download_session    _session;
+	size_t                    _maxRunning;
+	std::function<void(std::function<void()>)> _dispatcher;
+	mutable std::mutex        _mtx;
+	std::condition_variable   _cvIdle;
+	std::unordered_map<std::wstring, HINTERNET> _connections; // one per scheme, host and port
+	std::deque<_job*>         _queue;
+	std::unordered_set<_job*> _running;
+	size_t                    _numFinishing = 0; // out of _running, but still delivering their results
+	bool                      _isClosing = false; // being destroyed, no more callbacks
+
+public:
+	~download_pool() {
+		{
+			std::lock_guard<std::mutex> lock{this->_mtx};
+			this->_isClosing = true;
+		}
+		this->cancel_all();
+		{
+			std::unique_lock<std::mutex> lock{this->_mtx};
+			this->_cvIdle.wait(lock, [this]() { // wait all handles to close
+				return this->_running.empty() && !this->_numFinishing;
+			});
+		}
+		for (std::pair<const std::wstring, HINTERNET>& conn : this->_connections) {
+			WinHttpCloseHandle(conn.second);
+		}
+		WinHttpSetStatusCallback(this->_session.hsession(), nullptr, WINHTTP_CALLBACK_FLAG_ALL_NOTIFICATIONS, 0);
+		this->_session.close();
+	}
+
+	// Opens a new asynchronous session, running up to maxRunning requests at once.
+	explicit download_pool(size_t maxRunning = 6, const wchar_t* userAgent = L"WinLamb/1.0") :
+		_maxRunning{maxRunning}
+	{
+		if (!maxRunning) {
+			throw std::invalid_argument("Concurrent downloads can't be zero.");
+		}
+
+		this->_session.open(userAgent, WINHTTP_FLAG_ASYNC);
+		if (WinHttpSetStatusCallback(this->_session.hsession(), _status_callback,
+			WINHTTP_CALLBACK_FLAG_ALL_COMPLETIONS | WINHTTP_CALLBACK_FLAG_HANDLES, 0) == WINHTTP_INVALID_STATUS_CALLBACK)
+		{
+			throw std::system_error(GetLastError(), std::system_category(),
+				"WinHttpSetStatusCallback failed");
+		}
+
+		DWORD maxConns = static_cast<DWORD>(maxRunning); // don't open more sockets to a host than requests can use
+		WinHttpSetOption(this->_session.hsession(), WINHTTP_OPTION_MAX_CONNS_PER_SERVER, &maxConns, sizeof(maxConns));
+	}
+
+	download_pool(const download_pool&) = delete;
+	download_pool& operator=(const download_pool&) = delete;
+
+	// Number of requests waiting, running, or having their results delivered.
+	size_t pending() const {
+		std::lock_guard<std::mutex> lock{this->_mtx};
+		return this->_queue.size() + this->_running.size() + this->_numFinishing;
+	}
+
+	// Completion lambdas will be called through the dispatcher, instead of in a WinHTTP thread.
+	// Within a window, pass a lambda calling run_thread_ui(), so the completions run in the UI thread.
+	// The pool doesn't wait for dispatched completions when destroyed, so one may still run afterwards.
+	download_pool& deliver_with(std::function<void(std::function<void()>)> dispatcher) {
+		std::lock_guard<std::mutex> lock{this->_mtx};
+		this->_dispatcher = std::move(dispatcher);
+		return *this;
+	}
+
+	// Adds a request; the future throws std::system_error if it fails.
+	std::future<response> add(request req) {
+		_job* pJob = new _job{this, std::move(req)};
+		std::future<response> fut = pJob->promise.get_future();
+		this->_enqueue(pJob);
+		return fut;
+	}
+
+	// Adds a GET request; the future throws std::system_error if it fails.
+	std::future<response> add(std::wstring url) {
+		return this->add(request{std::move(url)});
+	}
+
+	// Adds a request, calling the lambda when it ends; check response::error for failures.
+	// Without a dispatcher, the lambda runs in a WinHTTP thread, and must not throw.
+	download_pool& add(request req, std::function<void(response&)> onDone) {
+		this->_enqueue(new _job{this, std::move(req), {}, std::move(onDone)});
+		return *this;
+	}
+
+	// Drops the waiting requests and aborts the running ones; all of them fail with ERROR_WINHTTP_OPERATION_CANCELLED.
+	download_pool& cancel_all() {
+		std::deque<_job*> dropped;
+		std::vector<HINTERNET> toClose;
+		{
+			std::lock_guard<std::mutex> lock{this->_mtx};
+			dropped.swap(this->_queue);
+			for (_job* pJob : this->_running) {
+				pJob->isCancelled = true;
+				if (pJob->hRequest) toClose.emplace_back(std::exchange(pJob->hRequest, nullptr));
+			}
+		}
+		for (HINTERNET hReq : toClose) {
+			WinHttpCloseHandle(hReq); // each one will be finished when its handle closes
+		}
+		for (_job* pJob : dropped) {
+			if (std::function<void()> dispatch = this->_deliver(pJob)) dispatch();
+		}
+		return *this;
+	}
+
+private:
+	void _enqueue(_job* pJob) {
+		{
+			std::lock_guard<std::mutex> lock{this->_mtx};
+			if (this->_isClosing) {
+				delete pJob;
+				throw std::logic_error("Download pool is being destroyed.");
+			} else if (this->_running.size() >= this->_maxRunning) {
+				this->_queue.emplace_back(pJob);
+				return;
+			}
+			this->_running.emplace(pJob);
+		}
+		if (!this->_start(pJob)) this->_finish(pJob);
+	}
+
+	// Creates the request and sends it; from now on, progress is driven by _status_callback.
+	// Returns false if it failed right away, and the caller must finish the job; no notification will come.
+	bool _start(_job* pJob) noexcept {
+		HINTERNET hReq = nullptr;
+		bool isStored = false;
+		try {
+			pJob->res.url = pJob->req.url;
+			_wli::download_url crackedUrl;
+			crackedUrl.crack(pJob->req.url);
+
+			hReq = WinHttpOpenRequest(this->_connection(crackedUrl), pJob->req.verb.c_str(),
+				crackedUrl.path_and_extra().c_str(), nullptr, WINHTTP_NO_REFERER,
+				WINHTTP_DEFAULT_ACCEPT_TYPES,
+				crackedUrl.is_https() ? WINHTTP_FLAG_SECURE : 0);
+			if (!hReq) {
+				throw std::system_error(GetLastError(), std::system_category(),
+					"WinHttpOpenRequest failed");
+			}
+
+			DWORD_PTR context = reinterpret_cast<DWORD_PTR>(pJob); // all notifications will carry the job
+			WinHttpSetOption(hReq, WINHTTP_OPTION_CONTEXT_VALUE, &context, sizeof(context));
+			{
+				std::lock_guard<std::mutex> lock{this->_mtx};
+				pJob->hRequest = hReq;
+				isStored = true;
+				if (this->_isClosing || pJob->isCancelled) { // cancel_all() already went through the running requests
+					throw std::system_error(ERROR_WINHTTP_OPERATION_CANCELLED, std::system_category(),
+						"Download cancelled");
+				}
+			}
+
+			std::wstring rhTmp;
+			for (const insert_order_map<std::wstring, std::wstring>::entry& rh : pJob->req.headers) {
+				rhTmp = rh.key;
+				rhTmp.append(L": ").append(rh.value);
+				if (!WinHttpAddRequestHeaders(hReq, rhTmp.c_str(), static_cast<ULONG>(-1L), WINHTTP_ADDREQ_FLAG_ADD)) {
+					throw std::system_error(GetLastError(), std::system_category(),
+						"WinHttpAddRequestHeaders failed");
+				}
+			}
+
+			if (!WinHttpSendRequest(hReq, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0, 0, context)) {
+				throw std::system_error(GetLastError(), std::system_category(),
+					"WinHttpSendRequest failed");
+			}
+		} catch (...) {
+			pJob->res.error = _error_code(std::current_exception());
+			if (hReq) {
+				{
+					std::lock_guard<std::mutex> lock{this->_mtx};
+					if (isStored && !pJob->hRequest) return true; // cancel_all() closed it, job is finished when the handle closes
+					pJob->hRequest = nullptr;
+				}
+				DWORD_PTR noContext = 0; // the closing notification must not finish the job, the caller does
+				WinHttpSetOption(hReq, WINHTTP_OPTION_CONTEXT_VALUE, &noContext, sizeof(noContext));
+				WinHttpCloseHandle(hReq);
+			}
+			return false;
+		}
+		return true;
+	}
+
+	// Returns the connection handle to the host, creating it if needed.
+	HINTERNET _connection(const _wli::download_url& crackedUrl) {
+		std::wstring key = crackedUrl.scheme();
+		key.append(L"://").append(crackedUrl.host()).append(L":").append(std::to_wstring(crackedUrl.port()));
+
+		std::lock_guard<std::mutex> lock{this->_mtx};
+		HINTERNET& hConnect = this->_connections[key];
+		if (!hConnect) { // no network activity here, just a handle
+			hConnect = WinHttpConnect(this->_session.hsession(), crackedUrl.host(),
+				static_cast<INTERNET_PORT>(crackedUrl.port()), 0);
+			if (!hConnect) {
+				this->_connections.erase(key);
+				throw std::system_error(GetLastError(), std::system_category(),
+					"WinHttpConnect failed");
+			}
+		}
+		return hConnect;
+	}
+
+	static void CALLBACK _status_callback(HINTERNET hInternet, DWORD_PTR context,
+		DWORD status, void* pInfo, DWORD infoLen) noexcept
+	{
+		_job* pJob = reinterpret_cast<_job*>(context);
+		if (pJob) { // connection handles have no context
+			pJob->pPool->_process_status(pJob, hInternet, status, pInfo, infoLen);
+		}
+	}
+
+	// Each notification triggers the next step: receive headers, query available bytes, read them.
+	void _process_status(_job* pJob, HINTERNET hReq, DWORD status, void* pInfo, DWORD infoLen) noexcept {
+		try {
+			switch (status) {
+			case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE:
+				if (!WinHttpReceiveResponse(hReq, nullptr)) {
+					throw std::system_error(GetLastError(), std::system_category(),
+						"WinHttpReceiveResponse failed");
+				}
+				break;
+
+			case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE:
+				pJob->res.status = _wli::download_priv::status_code(hReq);
+				_wli::download_priv::read_headers(hReq, pJob->res.headers);
+				pJob->res.data.reserve(static_cast<size_t>(_wli::download_priv::content_length(pJob->res.headers)));
+				this->_query_data(hReq);
+				break;
+
+			case WINHTTP_CALLBACK_STATUS_DATA_AVAILABLE:
+				if (DWORD incomingBytes = *reinterpret_cast<DWORD*>(pInfo)) {
+					pJob->readOffset = pJob->res.data.size();
+					pJob->res.data.resize(pJob->readOffset + incomingBytes); // make room, buffer must live until read completes
+					if (!WinHttpReadData(hReq, &pJob->res.data[pJob->readOffset], incomingBytes, nullptr)) {
+						throw std::system_error(GetLastError(), std::system_category(),
+							"WinHttpReadData failed");
+					}
+				} else { // no more bytes remaining
+					pJob->isComplete = true;
+					this->_close_request(pJob);
+				}
+				break;
+
+			case WINHTTP_CALLBACK_STATUS_READ_COMPLETE:
+				pJob->res.data.resize(pJob->readOffset + infoLen);
+				this->_query_data(hReq);
+				break;
+
+			case WINHTTP_CALLBACK_STATUS_REQUEST_ERROR:
+				if (!pJob->res.error) {
+					pJob->res.error = reinterpret_cast<WINHTTP_ASYNC_RESULT*>(pInfo)->dwError;
+				}
+				this->_close_request(pJob);
+				break;
+
+			case WINHTTP_CALLBACK_STATUS_HANDLE_CLOSING: // last notification of the request
+				this->_finish(pJob);
+			}
+		} catch (...) {
+			pJob->res.error = _error_code(std::current_exception());
+			this->_close_request(pJob);
+		}
+	}
+
+	void _query_data(HINTERNET hReq) {
+		if (!WinHttpQueryDataAvailable(hReq, nullptr)) {
+			throw std::system_error(GetLastError(), std::system_category(),
+				"WinHttpQueryDataAvailable failed");
+		}
+	}
+
+	// Closes the request handle, if not closed yet.
+	void _close_request(_job* pJob) noexcept {
+		HINTERNET hReq = nullptr;
+		{
+			std::lock_guard<std::mutex> lock{this->_mtx};
+			hReq = std::exchange(pJob->hRequest, nullptr);
+		}
+		if (hReq) WinHttpCloseHandle(hReq);
+	}
+
+	// The request is gone: delivers its result and starts the next ones in the queue.
+	// Queued jobs which fail right away are finished in this same loop, with no recursion.
+	void _finish(_job* pJob) noexcept {
+		std::vector<_job*> toFinish{pJob};
+		while (!toFinish.empty()) {
+			_job* pCur = toFinish.back();
+			toFinish.pop_back();
+
+			std::vector<_job*> toStart;
+			{
+				std::lock_guard<std::mutex> lock{this->_mtx};
+				this->_running.erase(pCur);
+				++this->_numFinishing;
+				if (pCur->isCancelled && !pCur->isComplete) {
+					pCur->res.error = ERROR_WINHTTP_OPERATION_CANCELLED; // rather than whatever failed after the handle was closed
+				}
+				while (!this->_isClosing && !this->_queue.empty() && this->_running.size() < this->_maxRunning) {
+					toStart.emplace_back(this->_queue.front());
+					this->_queue.pop_front();
+					this->_running.emplace(toStart.back());
+				}
+			}
+
+			for (_job* pNext : toStart) {
+				if (!this->_start(pNext)) toFinish.emplace_back(pNext); // still in _running, so the destructor waits for it
+			}
+			std::function<void()> dispatch = this->_deliver(pCur);
+
+			{
+				std::lock_guard<std::mutex> lock{this->_mtx};
+				--this->_numFinishing;
+				this->_cvIdle.notify_all(); // destructor may be waiting; if nothing is left, "this" must not be touched after this point
+			}
+			if (dispatch) dispatch(); // a synchronous dispatcher may block on the thread running the destructor
+		}
+	}
+
+	// Fulfills the promise or calls the completion lambda; if there's a dispatcher, returns the call to it,
+	// which must be made only after the pool is no longer being used.
+	std::function<void()> _deliver(_job* pJob) noexcept {
+		if (!pJob->isComplete && !pJob->res.error) {
+			pJob->res.error = ERROR_WINHTTP_OPERATION_CANCELLED;
+		}
+
+		if (!pJob->onDone) {
+			if (pJob->res.error) {
+				pJob->promise.set_exception(std::make_exception_ptr(
+					std::system_error(pJob->res.error, std::system_category(), "Download failed")));
+			} else {
+				pJob->promise.set_value(std::move(pJob->res));
+			}
+			delete pJob;
+			return nullptr;
+		}
+
+		std::function<void(std::function<void()>)> dispatcher;
+		{
+			std::lock_guard<std::mutex> lock{this->_mtx};
+			if (this->_isClosing) { // being destroyed, completions are not called anymore
+				delete pJob;
+				return nullptr;
+			}
+			dispatcher = this->_dispatcher;
+		}
+
+		std::function<void()> complete = [pJob]() -> void {
+			std::unique_ptr<_job> job{pJob}; // deleted even if the user lambda throws
+			job->onDone(job->res);
+		};
+		if (dispatcher) {
+			return [dispatcher = std::move(dispatcher), complete = std::move(complete)]() mutable -> void {
+				dispatcher(std::move(complete));
+			};
+		}
+		complete();
+		return nullptr;
+	}
+
+	static DWORD _error_code(std::exception_ptr pEx) noexcept {
+		try {
+			std::rethrow_exception(pEx);
+		} catch (const std::system_error& e) {
+			return static_cast<DWORD>(e.code().value());
+		} catch (...) {
+			return ERROR_NOT_ENOUGH_MEMORY; // anything else can only be a failed allocation
+		}
+	}
+};
+
+}//namespace wl
@@ -20,6 +20,9 @@ public:
 	// File access type.
 	enum class access { READONLY, READWRITE };
 
+	// Expected access pattern, given to the system cache when opening the file.
+	enum class hint { NORMAL, SEQUENTIAL, RANDOM };
+
 	// Date information of a file.
 	struct dates final {
 		datetime creation;
@@ -28,9 +31,12 @@ public:
 	};
 
 private:
+	static const UINT64 _NO_SIZE = static_cast<UINT64>(-1);
+	static const DWORD  _MAX_IO_BYTES = 0x40000000; // ReadFile/WriteFile are limited to DWORD sizes
+
 	HANDLE _hFile = nullptr;
 	access _access = access::READONLY;
-	size_t _sz = -1;
+	UINT64 _sz = _NO_SIZE;
 
 public:
 	~file() {
@@ -64,22 +70,27 @@ public:
 			CloseHandle(this->_hFile);
 			this->_hFile = nullptr;
 			this->_access = access::READONLY;
-			this->_sz = -1; // http://stackoverflow.com/a/19483690
+			this->_sz = _NO_SIZE;
 		}
 		return *this;
 	}
 
-	// Retrieve the file size in bytes.
-	size_t size() noexcept {
-		if (this->_sz == -1) {
-			this->_sz = GetFileSize(this->_hFile, nullptr); // cache
+	// Retrieve the file size in bytes, wrapper to GetFileSizeEx.
+	UINT64 size() noexcept {
+		if (this->_sz == _NO_SIZE) {
+			LARGE_INTEGER li{};
+			if (GetFileSizeEx(this->_hFile, &li)) {
+				this->_sz = static_cast<UINT64>(li.QuadPart); // cache
+			} else {
+				return 0;
+			}
 		}
 		return this->_sz;
 	}
 
 private:
 	file& _raw_open(const std::wstring& filePath, DWORD desiredAccess,
-		DWORD shareMode, DWORD creationDisposition)
+		DWORD shareMode, DWORD creationDisposition, hint accessHint = hint::NORMAL)
 	{
 		if (filePath.empty()) {
 			throw std::invalid_argument("No file path specified.");
@@ -88,8 +99,12 @@ private:
 		this->close();
 		bool isReadWrite = (desiredAccess & GENERIC_WRITE) != 0;
 
+		DWORD flags = accessHint == hint::SEQUENTIAL ? FILE_FLAG_SEQUENTIAL_SCAN
+			: accessHint == hint::RANDOM ? FILE_FLAG_RANDOM_ACCESS
+			: 0;
+
 		this->_hFile = CreateFileW(filePath.c_str(), desiredAccess, shareMode,
-			nullptr, creationDisposition, 0, nullptr);
+			nullptr, creationDisposition, flags, nullptr);
 		if (this->_hFile == INVALID_HANDLE_VALUE) {
 			this->_hFile = nullptr;
 			throw std::system_error(GetLastError(), std::system_category(),
@@ -105,19 +120,19 @@ private:
 
 public:
 	// Opens a file, throwing an exception if it doesn't exist.
-	file& open_existing(const wchar_t* filePath, access accessType) {
+	file& open_existing(const wchar_t* filePath, access accessType, hint accessHint = hint::NORMAL) {
 		if (!util::exists(filePath)) {
 			throw std::invalid_argument("File doesn't exist.");
 		}
 		return this->_raw_open(filePath,
 			GENERIC_READ | (accessType == access::READWRITE ? GENERIC_WRITE : 0),
 			(accessType == access::READWRITE) ? 0 : FILE_SHARE_READ,
-			OPEN_EXISTING); // fails if file doesn't exist
+			OPEN_EXISTING, accessHint); // fails if file doesn't exist
 	}
 
 	// Opens a file, throwing an exception if it doesn't exist.
-	file& open_existing(const std::wstring& filePath, access accessType) {
-		return this->open_existing(filePath.c_str(), accessType);
+	file& open_existing(const std::wstring& filePath, access accessType, hint accessHint = hint::NORMAL) {
+		return this->open_existing(filePath.c_str(), accessType, accessHint);
 	}
 
 	// Opens a file as read/write, creates if it doesn't exist.
@@ -145,7 +160,7 @@ private:
 
 public:
 	// Truncates or expands the file, according to the new size; zero will empty the file.
-	file& set_new_size(size_t numBytes) {
+	file& set_new_size(UINT64 numBytes) {
 		this->_check_file_opened();
 		this->_check_file_read_only();
 		if (this->size() == numBytes) return *this; // nothing to do
@@ -155,43 +170,102 @@ public:
 			throw std::system_error(err, std::system_category(), msg);
 		};
 
-		DWORD r = SetFilePointer(this->_hFile, static_cast<LONG>(numBytes), nullptr, FILE_BEGIN);
-		if (r == INVALID_SET_FILE_POINTER) {
-			tooBad(GetLastError(), "SetFilePointer failed when setting new file size");
+		LARGE_INTEGER li{};
+		li.QuadPart = static_cast<LONGLONG>(numBytes);
+		if (!SetFilePointerEx(this->_hFile, li, nullptr, FILE_BEGIN)) {
+			tooBad(GetLastError(), "SetFilePointerEx failed when setting new file size");
 		}
 
 		if (!SetEndOfFile(this->_hFile)) {
 			tooBad(GetLastError(), "SetEndOfFile failed when setting new file size");
 		}
 
-		r = SetFilePointer(this->_hFile, 0, nullptr, FILE_BEGIN); // rewind
-		if (r == INVALID_SET_FILE_POINTER) {
-			tooBad(GetLastError(), "SetFilePointer failed to rewind the file pointer when setting new file size");
+		li.QuadPart = 0; // rewind
+		if (!SetFilePointerEx(this->_hFile, li, nullptr, FILE_BEGIN)) {
+			tooBad(GetLastError(), "SetFilePointerEx failed to rewind the file pointer when setting new file size");
 		}
 
 		this->_sz = numBytes; // update
 		return *this;
 	}
 
-	// Calls SetFilePointer to set internal pointer to begin of the file.
+	// Calls SetFilePointerEx to set internal pointer to begin of the file.
 	file& rewind() {
 		this->_check_file_opened();
-		if (SetFilePointer(this->_hFile, 0, nullptr, FILE_BEGIN) == INVALID_SET_FILE_POINTER) {
+		LARGE_INTEGER li{};
+		if (!SetFilePointerEx(this->_hFile, li, nullptr, FILE_BEGIN)) {
 			throw std::system_error(GetLastError(), std::system_category(),
-				"SetFilePointer failed to rewind the file");
+				"SetFilePointerEx failed to rewind the file");
 		}
 		return *this;
 	}
 
-	// Reads all file content at once into a buffer.
+	// Reads all file content at once into a buffer, from the current file pointer.
 	file& read_to_buffer(std::vector<BYTE>& buf) {
 		this->_check_file_opened();
-		buf.resize(this->size());
-		DWORD bytesRead = 0;
-		if (!ReadFile(this->_hFile, &buf[0], static_cast<DWORD>(buf.size()), &bytesRead, nullptr)) {
-			throw std::system_error(GetLastError(), std::system_category(),
-				"ReadFile failed");
+		if (this->size() > SIZE_MAX) {
+			throw std::length_error("File is too large to be loaded into memory.");
+		}
+		buf.resize(static_cast<size_t>(this->size()));
+
+		size_t totRead = 0;
+		while (totRead < buf.size()) { // large files are read in many calls
+			DWORD bytesRead = 0;
+			if (!ReadFile(this->_hFile, &buf[totRead], _io_chunk(buf.size() - totRead), &bytesRead, nullptr)) {
+				throw std::system_error(GetLastError(), std::system_category(),
+					"ReadFile failed");
+			}
+			if (!bytesRead) break; // file shrank meanwhile
+			totRead += bytesRead;
 		}
+		buf.resize(totRead);
+		return *this;
+	}
+
+	// Reads up to numBytes at the given offset, returns the number of bytes read, which is zero past the end.
+	// The internal file pointer is moved to the end of the read block.
+	size_t read_at(UINT64 offset, BYTE* pDest, size_t numBytes) {
+		this->_check_file_opened();
+
+		size_t totRead = 0;
+		while (totRead < numBytes) {
+			OVERLAPPED ov = _offset_overlapped(offset + totRead);
+			DWORD bytesRead = 0;
+			if (!ReadFile(this->_hFile, pDest + totRead, _io_chunk(numBytes - totRead), &bytesRead, &ov)) {
+				DWORD err = GetLastError();
+				if (err == ERROR_HANDLE_EOF) break;
+				throw std::system_error(err, std::system_category(),
+					"ReadFile failed to read at offset");
+			}
+			if (!bytesRead) break;
+			totRead += bytesRead;
+		}
+		return totRead;
+	}
+
+	// Reads up to buf.size() bytes at the given offset, the buffer is shrunk to the number of bytes read.
+	file& read_at(UINT64 offset, std::vector<BYTE>& buf) {
+		buf.resize(this->read_at(offset, buf.data(), buf.size()));
+		return *this;
+	}
+
+	// Writes content at the given offset, expanding the file if needed.
+	// The internal file pointer is moved to the end of the written block.
+	file& write_at(UINT64 offset, const BYTE* pData, size_t sz) {
+		this->_check_file_opened();
+		this->_check_file_read_only();
+
+		size_t totWritten = 0;
+		while (totWritten < sz) {
+			OVERLAPPED ov = _offset_overlapped(offset + totWritten);
+			DWORD dwWritten = 0;
+			if (!WriteFile(this->_hFile, pData + totWritten, _io_chunk(sz - totWritten), &dwWritten, &ov)) {
+				throw std::system_error(GetLastError(), std::system_category(),
+					"WriteFile failed to write at offset");
+			}
+			totWritten += dwWritten;
+		}
+		this->_sz = _NO_SIZE; // file may have grown
 		return *this;
 	}
 
@@ -209,11 +283,16 @@ public:
 
 		// File boundary will be expanded if needed.
 		// Internal file pointer will move forward.
-		DWORD dwWritten = 0;
-		if (!WriteFile(this->_hFile, pData, static_cast<DWORD>(sz), &dwWritten, nullptr)) {
-			throw std::system_error(GetLastError(), std::system_category(),
-				"WriteFile failed");
+		size_t totWritten = 0;
+		while (totWritten < sz) { // large blocks are written in many calls
+			DWORD dwWritten = 0;
+			if (!WriteFile(this->_hFile, pData + totWritten, _io_chunk(sz - totWritten), &dwWritten, nullptr)) {
+				throw std::system_error(GetLastError(), std::system_category(),
+					"WriteFile failed");
+			}
+			totWritten += dwWritten;
 		}
+		this->_sz = _NO_SIZE; // file may have grown
 		return *this;
 	}
 
@@ -233,6 +312,18 @@ public:
 		return {ftCreation, ftLastAccess, ftLastWrite};
 	}
 
+private:
+	static DWORD _io_chunk(size_t remaining) noexcept {
+		return remaining > _MAX_IO_BYTES ? _MAX_IO_BYTES : static_cast<DWORD>(remaining);
+	}
+
+	static OVERLAPPED _offset_overlapped(UINT64 offset) noexcept {
+		OVERLAPPED ov{}; // on a synchronous handle, just carries the offset
+		ov.Offset = static_cast<DWORD>(offset & 0xFFFFFFFF);
+		ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+		return ov;
+	}
+
 public:
 	// File utilities.
 	class util final {
@@ -288,14 +379,14 @@ public:
 		}
 
 		// Retrieves the file size in bytes.
-		static size_t get_size(const wchar_t* filePath) {
+		static UINT64 get_size(const wchar_t* filePath) {
 			file ff;
 			ff.open_existing(filePath, file::access::READONLY);
 			return ff.size();
 		}
 
 		// Retrieves the file size in bytes.
-		static size_t get_size(const std::wstring& filePath) {
+		static UINT64 get_size(const std::wstring& filePath) {
 			return get_size(filePath.c_str());
 		}
 
@@ -0,0 +1,158 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <string>
+#include <system_error>
+#include <vector>
+#include <Windows.h>
+
+namespace wl {
+
+// Reads a file sequentially in fixed-size chunks, with no size limit.
+// While a chunk is being processed, the next one is already being read with overlapped I/O.
+class file_chunked final {
+private:
+	HANDLE            _hFile = nullptr;
+	OVERLAPPED        _ov{}; // address must not change while a read is pending, so the class is not movable
+	std::vector<BYTE> _bufs[2];
+	UINT64            _sz = 0;
+	UINT64            _nextOffset = 0; // where the pending read starts
+	UINT64            _curOffset = 0;
+	size_t            _curLen = 0;
+	int               _curBuf = 0;
+	bool              _pending = false;
+
+public:
+	~file_chunked() {
+		this->close();
+	}
+
+	file_chunked() = default;
+	file_chunked(const file_chunked&) = delete;
+	file_chunked& operator=(const file_chunked&) = delete;
+
+	UINT64      size() const noexcept   { return this->_sz; }
+	const BYTE* data() const noexcept   { return this->_bufs[this->_curBuf].data(); } // current chunk
+	size_t      length() const noexcept { return this->_curLen; } // length of current chunk
+	UINT64      offset() const noexcept { return this->_curOffset; } // file offset of current chunk
+
+	// Cancels any pending read and closes the file.
+	file_chunked& close() noexcept {
+		if (this->_pending) {
+			CancelIoEx(this->_hFile, &this->_ov);
+			DWORD dummy = 0;
+			GetOverlappedResult(this->_hFile, &this->_ov, &dummy, TRUE); // buffer can't be touched after we return
+			this->_pending = false;
+		}
+		if (this->_ov.hEvent) {
+			CloseHandle(this->_ov.hEvent);
+			this->_ov.hEvent = nullptr;
+		}
+		if (this->_hFile) {
+			CloseHandle(this->_hFile);
+			this->_hFile = nullptr;
+		}
+		this->_sz = this->_nextOffset = this->_curOffset = 0;
+		this->_curLen = 0;
+		return *this;
+	}
+
+	// Opens the file and starts reading the first chunk.
+	file_chunked& open(const wchar_t* filePath, size_t chunkSize = 1024 * 1024) {
+		if (!chunkSize || chunkSize > 0x40000000) {
+			throw std::invalid_argument("Invalid chunk size.");
+		}
+		this->close();
+
+		auto tooBad = [this](DWORD err, const char* msg) -> void {
+			this->close();
+			throw std::system_error(err, std::system_category(), msg);
+		};
+
+		this->_hFile = CreateFileW(filePath, GENERIC_READ, FILE_SHARE_READ, nullptr,
+			OPEN_EXISTING, FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (this->_hFile == INVALID_HANDLE_VALUE) {
+			this->_hFile = nullptr;
+			throw std::system_error(GetLastError(), std::system_category(),
+				"CreateFile failed to open file for chunked reading");
+		}
+
+		LARGE_INTEGER li{};
+		if (!GetFileSizeEx(this->_hFile, &li)) {
+			tooBad(GetLastError(), "GetFileSizeEx failed");
+		}
+		this->_sz = static_cast<UINT64>(li.QuadPart);
+
+		this->_ov.hEvent = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+		if (!this->_ov.hEvent) {
+			tooBad(GetLastError(), "CreateEvent failed");
+		}
+
+		for (std::vector<BYTE>& buf : this->_bufs) {
+			buf.resize(chunkSize);
+		}
+		this->_curBuf = 1; // so the first read goes into buffer 0
+		this->_start_read();
+		return *this;
+	}
+
+	// Opens the file and starts reading the first chunk.
+	file_chunked& open(const std::wstring& filePath, size_t chunkSize = 1024 * 1024) {
+		return this->open(filePath.c_str(), chunkSize);
+	}
+
+	// Waits for the next chunk and starts reading the following one; returns false at end of file.
+	// The memory of the previous chunk is reused.
+	bool next() {
+		if (!this->_pending) return false;
+
+		DWORD bytesRead = 0;
+		BOOL ok = GetOverlappedResult(this->_hFile, &this->_ov, &bytesRead, TRUE);
+		this->_pending = false;
+		if (!ok) {
+			DWORD err = GetLastError();
+			if (err == ERROR_HANDLE_EOF) return false; // file shrank meanwhile
+			throw std::system_error(err, std::system_category(),
+				"GetOverlappedResult failed when reading file chunk");
+		}
+		if (!bytesRead) return false;
+
+		this->_curBuf ^= 1; // the buffer which was just filled
+		this->_curOffset = this->_nextOffset;
+		this->_curLen = bytesRead;
+		this->_nextOffset += bytesRead;
+		this->_start_read(); // read ahead into the other buffer
+		return true;
+	}
+
+private:
+	void _start_read() {
+		if (this->_nextOffset >= this->_sz) return; // nothing left
+
+		UINT64 remaining = this->_sz - this->_nextOffset;
+		std::vector<BYTE>& buf = this->_bufs[this->_curBuf ^ 1];
+		DWORD toRead = remaining < buf.size() ?
+			static_cast<DWORD>(remaining) : static_cast<DWORD>(buf.size());
+
+		this->_ov.Offset = static_cast<DWORD>(this->_nextOffset & 0xFFFFFFFF);
+		this->_ov.OffsetHigh = static_cast<DWORD>(this->_nextOffset >> 32);
+		ResetEvent(this->_ov.hEvent);
+
+		if (!ReadFile(this->_hFile, buf.data(), toRead, nullptr, &this->_ov)) {
+			DWORD err = GetLastError();
+			if (err == ERROR_HANDLE_EOF) return;
+			if (err != ERROR_IO_PENDING) {
+				throw std::system_error(err, std::system_category(),
+					"ReadFile failed to start reading file chunk");
+			}
+		}
+		this->_pending = true; // also when completed synchronously, result is collected the same way
+	}
+};
+
+}//namespace wl
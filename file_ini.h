@@ -6,6 +6,7 @@
  */
 
 #pragma once
+#include <algorithm>
 #include "file_mapped.h"
 #include "insert_order_map.h"
 #include "str.h"
@@ -13,10 +14,52 @@
 namespace wl {
 
 // Wrapper to INI file.
+// Saving to the file which was loaded rewrites only what changed, keeping comments and blank lines.
 class file_ini final {
 public:
 	insert_order_map<std::wstring, insert_order_map<std::wstring, std::wstring>> sections;
 
+private:
+	using _sectionsT = insert_order_map<std::wstring, insert_order_map<std::wstring, std::wstring>>;
+
+	struct _span final {
+		size_t offset = 0;
+		size_t len = 0;
+		size_t past() const noexcept { return this->offset + this->len; }
+	};
+
+	struct _key_layout final {
+		std::vector<_span> lines; // whole line, including its line break; a key may appear more than once
+		_span              value; // of the last line, which is the one loaded
+	};
+
+	struct _section_layout final {
+		std::vector<_span> headers; // a section may appear more than once
+		size_t insertAt = 0; // new keys go right after the last line of the section
+		insert_order_map<std::wstring, _key_layout> keys;
+	};
+
+	// Where each section and key was found in the file, in bytes.
+	struct _layout final {
+		std::wstring filePath; // empty if file can't be saved incrementally
+		UINT64       fileSize = 0;
+		LONGLONG     lastWrite = 0;
+		UINT         codePage = 0; // zero for ASCII, 1200 for UTF-16LE
+		std::wstring lineBreak;
+		insert_order_map<std::wstring, _section_layout> sections;
+	};
+
+	struct _edit final {
+		_span             span; // bytes to be replaced
+		std::vector<BYTE> data;
+	};
+
+	static const UINT _CP_UTF16LE = 1200;
+
+	mutable _layout _saved; // cache of the file as last loaded or saved
+
+public:
+
 	const insert_order_map<std::wstring, std::wstring>& operator[](const std::wstring& sectionName) const {
 		return this->sections.operator[](sectionName);
 	}
@@ -25,37 +68,24 @@ public:
 		return this->sections.operator[](sectionName);
 	}
 
+	// Parses the file in a single pass straight over the mapped memory; only keys and values are converted.
 	file_ini& load_from_file(const wchar_t* filePath) {
-		std::wstring content = str::to_wstring(file_mapped::util::read(filePath));
-		std::vector<std::wstring> lines = str::split_lines(content);
-		insert_order_map<std::wstring, std::wstring>* curSection = nullptr; // section-less keys will be ignored
-		std::wstring tmpName, tmpValue; // temporary buffers
-
-		for (std::wstring& line : lines) {
-			if (str::trim(line).empty()) { // skip blank lines
-				continue;
-			} else if (line[0] == L'[' && line.back() == L']') { // begin of section found
-				tmpName.clear();
-				tmpName.insert(0, &line[1], line.length() - 2); // extract section name
-				curSection = &this->sections[str::trim(tmpName)]; // if inexistent, will be inserted
-			} else if (curSection && line[0] != L';' && line[0] != L'#') { // lines starting with ; or # will be ignored
-				size_t idxEq = line.find_first_of(L'=');
-				if (idxEq != std::wstring::npos) {
-					tmpName.clear();
-					tmpName.insert(0, &line[0], idxEq); // extract key name
-					tmpValue.clear();
-					tmpValue.insert(0, &line[idxEq + 1], line.length() - (idxEq + 1)); // extract value
-					(*curSection)[tmpName] = tmpValue;
-				}
-			}
-		}
-
+		file_mapped::view content = file_mapped::util::read_view(filePath);
+		this->_saved = _parse_file(content.data(), content.size(), &this->sections);
+		this->_track(filePath, content.size());
 		return *this;
 	}
 
+	// If saving to the file which was loaded, and it wasn't changed meanwhile, only the changed keys are written:
+	// values with the same size are patched in place, otherwise the file is rebuilt around the changes.
+	// Any other case writes the whole INI as UTF-8. Whole writes go to a temporary file, which then replaces the original.
 	void save_to_file(const wchar_t* filePath) const {
-		file::util::write(filePath,
-			str::to_utf8_blob(this->serialize(), str::write_bom::YES));
+		if (!this->_save_changes(filePath)) {
+			std::vector<BYTE> blob = str::to_utf8_blob(this->serialize(), str::write_bom::YES);
+			_replace_file(filePath, blob);
+			this->_saved = _parse_file(blob.data(), blob.size(), nullptr);
+			this->_track(filePath, blob.size());
+		}
 	}
 
 	file_ini& load_from_file(const std::wstring& filePath)     { return this->load_from_file(filePath.c_str()); }
@@ -99,6 +129,328 @@ public:
 	}
 
 private:
+	struct _byte_decoder final {
+		UINT codePage;
+		void operator()(std::wstring& dest, std::string_view src) const {
+			_wli::str_priv::decode_into(dest, reinterpret_cast<const BYTE*>(src.data()), src.length(), this->codePage);
+		}
+	};
+
+	struct _wide_decoder final {
+		void operator()(std::wstring& dest, std::wstring_view src) const {
+			dest.assign(src);
+		}
+	};
+
+	static bool _is_space(char ch) noexcept    { return ch == ' ' || (ch >= '\t' && ch <= '\r'); } // same of iswspace for ASCII
+	static bool _is_space(wchar_t ch) noexcept { return std::iswspace(ch) != 0; }
+
+	template<typename charT>
+	static std::basic_string_view<charT> _trim(std::basic_string_view<charT> s) noexcept {
+		size_t iFirst = 0, iPast = s.length();
+		while (iFirst < iPast && _is_space(s[iFirst])) ++iFirst;
+		while (iPast > iFirst && _is_space(s[iPast - 1])) --iPast;
+		return s.substr(iFirst, iPast - iFirst);
+	}
+
+	// Parses the raw file content into the sections, if given, and returns the layout of the file.
+	static _layout _parse_file(const BYTE* pData, size_t sz, _sectionsT* pSections) {
+		_layout layout;
+		str::encoding_info enc = str::get_encoding(pData, sz);
+		const BYTE* pText = pData + enc.bomSize;
+		size_t textSz = sz - enc.bomSize;
+
+		const BYTE* pNull = textSz ? static_cast<const BYTE*>(memchr(pText, 0, textSz)) : nullptr;
+		if (pNull) textSz = pNull - pText; // stop at terminating null
+		std::string_view bytes{reinterpret_cast<const char*>(pText), textSz};
+
+		switch (enc.encType) {
+		case str::encoding::UNKNOWN:
+		case str::encoding::ASCII:
+			layout.codePage = 0;
+			_parse(bytes, _byte_decoder{0}, pData, pSections, &layout);
+			break;
+		case str::encoding::WIN1252:
+			layout.codePage = 1252;
+			_parse(bytes, _byte_decoder{1252}, pData, pSections, &layout);
+			break;
+		case str::encoding::UTF8:
+			layout.codePage = CP_UTF8;
+			_parse(bytes, _byte_decoder{CP_UTF8}, pData, pSections, &layout);
+			break;
+		case str::encoding::UTF16LE:
+			layout.codePage = _CP_UTF16LE;
+			_parse(str::to_wstring_view(pData, sz), _wide_decoder{}, pData, pSections, &layout); // no copy at all
+			break;
+		default: // converted text has no byte positions, so the layout is not kept
+			_parse(std::wstring_view{str::to_wstring(pData, sz)}, _wide_decoder{}, pData, pSections, nullptr);
+		}
+		return layout;
+	}
+
+	// Structural chars are all ASCII, so the same parsing works over UTF-8, ANSI and UTF-16 text.
+	template<typename charT, typename decoderT>
+	static void _parse(std::basic_string_view<charT> content, decoderT decode,
+		const BYTE* pData, _sectionsT* pSections, _layout* pLayout)
+	{
+		using viewT = std::basic_string_view<charT>;
+		auto spanOf = [pData](const charT* pBegin, const charT* pPast) -> _span {
+			const BYTE* pB = reinterpret_cast<const BYTE*>(pBegin);
+			return {static_cast<size_t>(pB - pData), static_cast<size_t>(reinterpret_cast<const BYTE*>(pPast) - pB)};
+		};
+
+		insert_order_map<std::wstring, std::wstring>* curSection = nullptr;
+		_section_layout* curSectionLayout = nullptr;
+		bool hasSection = false; // section-less keys will be ignored
+		std::wstring name; // reused for all section and key names
+
+		for (size_t pos = 0; pos < content.length(); ) {
+			size_t idxBreak = _wli::str_split::find_any_of(content, pos, charT('\r'), charT('\n'));
+			viewT line = _trim(content.substr(pos, idxBreak - pos));
+			size_t idxNext = idxBreak + ((idxBreak + 1 < content.length()
+				&& content[idxBreak] == charT('\r') && content[idxBreak + 1] == charT('\n')) ? 2 : 1);
+			if (idxNext > content.length()) idxNext = content.length(); // last line has no line break
+			_span lineSpan = spanOf(content.data() + pos, content.data() + idxNext);
+
+			if (pLayout && pLayout->lineBreak.empty() && idxBreak < content.length()) { // keep the style of the file
+				pLayout->lineBreak = (idxNext - idxBreak == 2) ? L"\r\n"
+					: (content[idxBreak] == charT('\r')) ? L"\r" : L"\n";
+			}
+			pos = idxNext;
+
+			if (line.empty()) { // skip blank lines
+				continue;
+			} else if (line[0] == charT('[') && line.back() == charT(']')) { // begin of section found
+				decode(name, _trim(line.substr(1, line.length() - 2)));
+				hasSection = true;
+				if (pSections) curSection = &(*pSections)[name]; // if inexistent, will be inserted
+				if (pLayout) {
+					curSectionLayout = &pLayout->sections[name];
+					curSectionLayout->headers.emplace_back(lineSpan);
+					curSectionLayout->insertAt = lineSpan.past();
+				}
+			} else if (hasSection && line[0] != charT(';') && line[0] != charT('#')) { // lines starting with ; or # will be ignored
+				size_t idxEq = line.find(charT('='));
+				if (idxEq != viewT::npos) {
+					viewT value = line.substr(idxEq + 1);
+					decode(name, line.substr(0, idxEq));
+					if (pSections) decode((*curSection)[name], value); // value is decoded in place
+					if (pLayout) {
+						_key_layout& keyLayout = curSectionLayout->keys[name];
+						keyLayout.lines.emplace_back(lineSpan);
+						keyLayout.value = spanOf(value.data(), value.data() + value.length());
+						curSectionLayout->insertAt = lineSpan.past();
+					}
+				}
+			}
+		}
+		if (pLayout && pLayout->lineBreak.empty()) pLayout->lineBreak = L"\r\n";
+	}
+
+	// Binds the layout to the file on disk, so later changes by others can be noticed.
+	void _track(const wchar_t* filePath, size_t fileSize) const {
+		this->_saved.fileSize = fileSize;
+		this->_saved.lastWrite = file::util::get_dates(filePath).lastWrite.timestamp();
+		if (!this->_saved.lineBreak.empty()) { // layout was kept
+			this->_saved.filePath = filePath;
+		}
+	}
+
+	// Writes only what changed since last load or save; returns false if the whole INI must be written.
+	bool _save_changes(const wchar_t* filePath) const {
+		const _layout& lay = this->_saved;
+		if (lay.filePath.empty() || lstrcmpiW(lay.filePath.c_str(), filePath)
+			|| !file::util::exists(filePath) || file::util::get_size(filePath) != lay.fileSize
+			|| file::util::get_dates(filePath).lastWrite.timestamp() != lay.lastWrite)
+		{
+			return false; // not the file we know
+		}
+
+		file fio;
+		fio.open_existing(filePath, file::access::READWRITE);
+		std::vector<BYTE> orig(static_cast<size_t>(lay.fileSize));
+		fio.read_at(0, orig);
+		if (orig.size() != lay.fileSize) return false;
+
+		std::vector<_edit> edits;
+		std::vector<BYTE> tail; // new sections, appended to the end of file
+		if (!this->_collect_edits(orig, edits, tail)) return false; // a value can't be written in file encoding
+		if (edits.empty() && tail.empty()) return true; // nothing changed
+
+		bool sameSizes = tail.empty() && std::all_of(edits.begin(), edits.end(),
+			[](const _edit& e) -> bool { return e.data.size() == e.span.len; });
+		if (sameSizes) {
+			for (const _edit& e : edits) {
+				fio.write_at(e.span.offset, e.data.data(), e.data.size()); // layout doesn't move
+			}
+			fio.close();
+			this->_saved.lastWrite = file::util::get_dates(filePath).lastWrite.timestamp();
+			return true;
+		}
+		fio.close();
+
+		std::vector<BYTE> out;
+		out.reserve(orig.size() + tail.size());
+		size_t pos = 0;
+		for (const _edit& e : edits) { // sorted and not overlapping
+			out.insert(out.end(), orig.begin() + pos, orig.begin() + e.span.offset);
+			out.insert(out.end(), e.data.begin(), e.data.end());
+			pos = e.span.past();
+		}
+		out.insert(out.end(), orig.begin() + pos, orig.end());
+
+		if (!tail.empty()) {
+			std::vector<BYTE> lineBreak;
+			this->_encode(lay.lineBreak, lineBreak);
+			size_t skip = 0;
+			if (this->_at_line_begin(out, out.size())) {
+				if (out.size() <= str::get_encoding(out.data(), out.size(), 0).bomSize) {
+					skip = lineBreak.size(); // file is empty, no blank line at the beginning
+				}
+			} else {
+				out.insert(out.end(), lineBreak.begin(), lineBreak.end()); // last line had no line break
+			}
+			out.insert(out.end(), tail.begin() + skip, tail.end());
+		}
+
+		_replace_file(filePath, out);
+		this->_saved = _parse_file(out.data(), out.size(), nullptr);
+		this->_track(filePath, out.size());
+		return true;
+	}
+
+	// Compares the sections against the layout and the original file bytes.
+	bool _collect_edits(const std::vector<BYTE>& orig, std::vector<_edit>& edits, std::vector<BYTE>& tail) const {
+		using sectionT = _sectionsT::entry;
+		using entryT = insert_order_map<std::wstring, std::wstring>::entry;
+		const _layout& lay = this->_saved;
+
+		for (const sectionT& sectionEntry : this->sections) {
+			const _section_layout* pSecLay = lay.sections.get_if_exists(sectionEntry.key);
+			if (!pSecLay) { // new section
+				if (!this->_encode(lay.lineBreak, tail)) return false; // blank line before each section
+				std::wstring header = L"[" + sectionEntry.key + L"]" + lay.lineBreak;
+				if (!this->_encode(header, tail)) return false;
+				for (const entryT& keyEntry : sectionEntry.value) {
+					if (!this->_encode_line(keyEntry, tail)) return false;
+				}
+				continue;
+			}
+
+			_edit insertion{{pSecLay->insertAt, 0}, {}};
+			for (const entryT& keyEntry : sectionEntry.value) {
+				const _key_layout* pKeyLay = pSecLay->keys.get_if_exists(keyEntry.key);
+				if (!pKeyLay) { // new key
+					if (insertion.data.empty() && !this->_at_line_begin(orig, pSecLay->insertAt)) {
+						if (!this->_encode(lay.lineBreak, insertion.data)) return false;
+					}
+					if (!this->_encode_line(keyEntry, insertion.data)) return false;
+					continue;
+				}
+
+				_edit change{pKeyLay->value, {}};
+				if (!this->_encode(keyEntry.value, change.data)) return false;
+				if (change.data.size() != change.span.len
+					|| memcmp(change.data.data(), orig.data() + change.span.offset, change.span.len))
+				{
+					edits.emplace_back(std::move(change));
+				}
+			}
+			if (!insertion.data.empty()) edits.emplace_back(std::move(insertion));
+
+			for (const insert_order_map<std::wstring, _key_layout>::entry& keyLayEntry : pSecLay->keys) {
+				if (!sectionEntry.value.has(keyLayEntry.key)) {
+					for (const _span& line : keyLayEntry.value.lines) {
+						edits.push_back({line, {}}); // removed key, all of its lines
+					}
+				}
+			}
+		}
+
+		for (const insert_order_map<std::wstring, _section_layout>::entry& secLayEntry : lay.sections) {
+			if (this->sections.has(secLayEntry.key)) continue;
+			for (const _span& header : secLayEntry.value.headers) {
+				edits.push_back({header, {}}); // removed section; comments within it are kept
+			}
+			for (const insert_order_map<std::wstring, _key_layout>::entry& keyLayEntry : secLayEntry.value.keys) {
+				for (const _span& line : keyLayEntry.value.lines) {
+					edits.push_back({line, {}});
+				}
+			}
+		}
+
+		std::stable_sort(edits.begin(), edits.end(), // an insertion may be at the same offset where a removal ends
+			[](const _edit& a, const _edit& b) -> bool { return a.span.offset < b.span.offset; });
+		return true;
+	}
+
+	bool _encode_line(const insert_order_map<std::wstring, std::wstring>::entry& keyEntry, std::vector<BYTE>& dest) const {
+		return this->_encode(keyEntry.key, dest)
+			&& this->_encode(L"=", dest)
+			&& this->_encode(keyEntry.value, dest)
+			&& this->_encode(this->_saved.lineBreak, dest);
+	}
+
+	// Appends the text in the encoding of the file; returns false if some char can't be represented.
+	bool _encode(std::wstring_view s, std::vector<BYTE>& dest) const {
+		switch (this->_saved.codePage) {
+		case 0: // plain ASCII; other bytes could make the file be detected as UTF-8 when read again
+			for (wchar_t ch : s) {
+				if (ch >= 0x80) return false;
+				dest.emplace_back(static_cast<BYTE>(ch));
+			}
+			return true;
+		case CP_UTF8:
+			_wli::str_priv::append_utf8(dest, s.data(), s.length());
+			return true;
+		case _CP_UTF16LE:
+			for (wchar_t ch : s) {
+				dest.emplace_back(static_cast<BYTE>(ch & 0xFF));
+				dest.emplace_back(static_cast<BYTE>(ch >> 8));
+			}
+			return true;
+		default:
+			if (s.empty()) return true;
+			BOOL usedDefault = FALSE;
+			size_t prevSz = dest.size();
+			dest.resize(prevSz + s.length() * 2); // DBCS may take 2 bytes per char
+			int numBytes = WideCharToMultiByte(this->_saved.codePage, 0, s.data(), static_cast<int>(s.length()),
+				reinterpret_cast<char*>(dest.data() + prevSz), static_cast<int>(s.length() * 2), nullptr, &usedDefault);
+			dest.resize(prevSz + numBytes);
+			return numBytes && !usedDefault;
+		}
+	}
+
+	// Tells if the given offset is at the beginning of a line.
+	bool _at_line_begin(const std::vector<BYTE>& orig, size_t offset) const noexcept {
+		size_t charSz = (this->_saved.codePage == _CP_UTF16LE) ? 2 : 1;
+		if (offset <= str::get_encoding(orig.data(), orig.size(), 0).bomSize) return true; // beginning of file
+		BYTE lastCh = orig[offset - charSz];
+		return (lastCh == '\n' || lastCh == '\r') && (charSz == 1 || orig[offset - 1] == 0);
+	}
+
+	// Writes the content to a temporary file, which then atomically replaces the destination.
+	static void _replace_file(const wchar_t* filePath, const std::vector<BYTE>& data) {
+		std::wstring tmpPath = filePath;
+		tmpPath.append(L".tmp");
+		{
+			file fout;
+			fout.open_or_create(tmpPath);
+			fout.set_new_size(data.size());
+			if (!data.empty()) fout.write(data.data(), data.size());
+			if (!FlushFileBuffers(fout.hfile())) {
+				throw std::system_error(GetLastError(), std::system_category(),
+					"FlushFileBuffers failed");
+			}
+		}
+		if (!MoveFileExW(tmpPath.c_str(), filePath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+			DWORD err = GetLastError();
+			DeleteFileW(tmpPath.c_str());
+			throw std::system_error(err, std::system_category(),
+				"MoveFileEx failed to replace INI file");
+		}
+	}
+
 	insert_order_map<std::wstring, std::vector<std::wstring>> _parse_structure(const std::wstring& structure) const {
 		using strvecT = std::vector<std::wstring>;
 		insert_order_map<std::wstring, strvecT> parsed;
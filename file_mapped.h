@@ -6,16 +6,23 @@
  */
 
 #pragma once
+#include <memory>
 #include "file.h"
+#include "internals/file_mapped_view.h"
 
 namespace wl {
 
 // Wrapper to a memory-mapped file.
 class file_mapped final {
+public:
+	using view = _wli::file_mapped_view;
+
 private:
 	file   _file;
 	HANDLE _hMap = nullptr;
 	void*  _pMem = nullptr;
+	size_t _sz = 0; // may be smaller than the mapped capacity
+	size_t _capacity = 0;
 
 public:
 	~file_mapped() {
@@ -30,14 +37,18 @@ public:
 		std::swap(this->_file, other._file);
 		std::swap(this->_hMap, other._hMap);
 		std::swap(this->_pMem, other._pMem);
+		std::swap(this->_sz, other._sz);
+		std::swap(this->_capacity, other._capacity);
 		return *this;
 	}
 
 	file::access access_type() const noexcept { return this->_file.access_type(); }
-	size_t       size() noexcept              { return this->_file.size(); }
+	size_t       size() const noexcept        { return this->_sz; }
+	size_t       capacity() const noexcept    { return this->_capacity; }
 	BYTE*        p_mem() const noexcept       { return reinterpret_cast<BYTE*>(this->_pMem); }
-	BYTE*        p_past_mem() noexcept        { return p_mem() + this->size(); }
+	BYTE*        p_past_mem() const noexcept  { return p_mem() + this->size(); }
 
+	// Unmaps and closes the file; if room was reserved, the file is truncated back to its size.
 	file_mapped& close() noexcept {
 		if (this->_pMem) {
 			UnmapViewOfFile(this->_pMem);
@@ -47,15 +58,42 @@ public:
 			CloseHandle(this->_hMap);
 			this->_hMap = nullptr;
 		}
+		if (this->_capacity != this->_sz && this->_file.access_type() == file::access::READWRITE) {
+			try {
+				this->_file.set_new_size(this->_sz);
+			} catch (...) { } // file just keeps the extra bytes
+		}
+		this->_sz = this->_capacity = 0;
 		this->_file.close();
 		return *this;
 	}
 
-	file_mapped& open(const std::wstring& filePath, file::access accessType) {
+	file_mapped& open(const std::wstring& filePath, file::access accessType,
+		file::hint accessHint = file::hint::NORMAL)
+	{
 		this->close();
 
 		// Open file.
-		this->_file.open_existing(filePath, accessType);
+		this->_file.open_existing(filePath, accessType, accessHint);
+		if (this->_file.size() > SIZE_MAX) {
+			this->close();
+			throw std::length_error("File is too large to be mapped at once, use file_mapped_window.");
+		}
+		this->_sz = this->_capacity = static_cast<size_t>(this->_file.size());
+
+		if (this->_sz) this->_map(); // empty files can't be mapped
+		return *this;
+	}
+
+private:
+	void _check_file_mapped() const {
+		if (!this->_file.hfile() || (this->_capacity && (!this->_hMap || !this->_pMem))) {
+			throw std::logic_error("File has not been mapped.");
+		}
+	}
+
+	void _map() {
+		bool isReadWrite = this->_file.access_type() == file::access::READWRITE;
 
 		auto tooBad = [this](DWORD err, const char* msg) -> void {
 			this->close();
@@ -64,75 +102,81 @@ public:
 
 		// Mapping into memory.
 		this->_hMap = CreateFileMappingW(this->_file.hfile(), nullptr,
-			(accessType == file::access::READWRITE) ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+			isReadWrite ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
 		if (!this->_hMap) {
-			tooBad(GetLastError(), accessType == file::access::READWRITE ?
+			tooBad(GetLastError(), isReadWrite ?
 				"CreateFileMapping failed to map file as read-write" :
 				"CreateFileMapping failed to map file as read-only");
 		}
 
 		// Get pointer to data block.
 		this->_pMem = MapViewOfFile(this->_hMap,
-			(accessType == file::access::READWRITE) ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
+			isReadWrite ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0);
 		if (!this->_pMem) {
-			tooBad(GetLastError(), accessType == file::access::READWRITE ?
-				"CreateFileMapping failed to map file as read-write" :
-				"CreateFileMapping failed to map file as read-only");
+			tooBad(GetLastError(), isReadWrite ?
+				"MapViewOfFile failed to map file as read-write" :
+				"MapViewOfFile failed to map file as read-only");
 		}
-
-		return *this;
 	}
 
-private:
-	void _check_file_mapped() const {
-		if (!this->_hMap || !this->_pMem || !this->_file.hfile()) {
-			throw std::logic_error("File has not been mapped.");
+	void _remap(size_t newCapacity) {
+		// Unmap file, but keep it open.
+		if (this->_pMem) {
+			UnmapViewOfFile(this->_pMem);
+			this->_pMem = nullptr;
+		}
+		if (this->_hMap) {
+			CloseHandle(this->_hMap);
+			this->_hMap = nullptr;
 		}
+
+		// Truncate/expand file, fail if file was opened as read-only.
+		this->_file.set_new_size(newCapacity);
+		this->_capacity = newCapacity;
+
+		// Get new pointer to data block, old one just became invalid.
+		this->_map();
 	}
 
 public:
+	// Expands the file so it can grow up to the given size without being remapped, so pointers stay valid.
+	// The file is truncated back to its size when closed.
+	file_mapped& reserve(size_t numBytes) {
+		this->_check_file_mapped();
+		if (numBytes > this->_capacity) {
+			this->_remap(numBytes);
+		}
+		return *this;
+	}
+
 	// This method will truncate or expand the file, according to the new size.
+	// Within the reserved capacity, nothing is remapped; the file is truncated only when closed.
 	file_mapped& set_new_size(size_t newSize) {
 		this->_check_file_mapped();
-
-		// Unmap file, but keep it open.
-		UnmapViewOfFile(this->_pMem);
-		CloseHandle(this->_hMap);
-
-		// Truncate/expand file, probably fail if file was opened as read-only.
-		this->_file.set_new_size(newSize);
-
-		auto tooBad = [this](DWORD err, const char* msg) -> void {
-			this->close();
-			throw std::system_error(err, std::system_category(), msg);
-		};
-
-		// Remap into memory.
-		this->_hMap = CreateFileMappingW(this->_file.hfile(), 0, PAGE_READWRITE, 0, 0, nullptr);
-		if (!this->_hMap) {
-			tooBad(GetLastError(), "CreateFileMapping failed to recreate mapping");
+		if (this->access_type() == file::access::READONLY) {
+			throw std::logic_error("File was opened for read-only access.");
 		}
 
-		// Get new pointer to data block, old one just became invalid.
-		this->_pMem = MapViewOfFile(this->_hMap, FILE_MAP_WRITE, 0, 0, 0);
-		if (!this->_pMem) {
-			tooBad(GetLastError(), "MapViewOfFile failed to recreate mapping");
+		if (newSize > this->_capacity) {
+			this->_remap(newSize);
 		}
-
+		this->_sz = newSize;
 		return *this;
 	}
 
 	// Reads file content, by default all at once.
 	file_mapped& read_to_buffer(std::vector<BYTE>& buf, size_t offset = 0, size_t numBytes = -1) {
 		this->_check_file_mapped();
-		if (offset >= this->size()) {
+		if (offset > this->size()) {
 			throw std::invalid_argument("Offset is beyond end of file.");
-		} else if (numBytes == -1 || offset + numBytes > this->size()) {
+		} else if (numBytes > this->size() - offset) {
 			numBytes = this->size() - offset; // avoid reading beyond EOF
 		}
 
 		buf.resize(numBytes);
-		memcpy(&buf[0], this->p_mem() + offset, numBytes * sizeof(BYTE));
+		if (numBytes) {
+			memcpy(buf.data(), this->p_mem() + offset, numBytes * sizeof(BYTE));
+		}
 		return *this;
 	}
 
@@ -143,6 +187,17 @@ public:
 		return buf;
 	}
 
+	// Returns a view to the content of a shared mapped file, by default all of it, with no copy.
+	// The view keeps the file mapped, even after the shared_ptr is gone.
+	static view make_view(std::shared_ptr<const file_mapped> mapped, size_t offset = 0, size_t numBytes = -1) {
+		if (!mapped) {
+			throw std::invalid_argument("No mapped file given.");
+		}
+		const BYTE* pData = mapped->p_mem();
+		size_t sz = mapped->size();
+		return view{std::move(mapped), pData, sz}.sub(offset, numBytes);
+	}
+
 public:
 	class util final {
 	private:
@@ -163,6 +218,16 @@ public:
 
 		static void              read_to_buffer(const std::wstring& filePath, std::vector<BYTE>& buf) { read_to_buffer(filePath.c_str(), buf); }
 		static std::vector<BYTE> read(const std::wstring& filePath)                                   { return read(filePath.c_str()); }
+
+		// Maps the file as read-only and returns a view to all its content, with no copy.
+		// The file stays mapped while any view to it exists.
+		static view read_view(const wchar_t* filePath) {
+			std::shared_ptr<file_mapped> fin = std::make_shared<file_mapped>();
+			fin->open(filePath, file::access::READONLY);
+			return make_view(std::move(fin));
+		}
+
+		static view read_view(const std::wstring& filePath) { return read_view(filePath.c_str()); }
 	};
 };
 
@@ -0,0 +1,217 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include "file.h"
+
+namespace wl {
+
+// Memory-mapped file which maps only a window at a time, so files of any size can be accessed.
+// With the sequential hint, the window after the current one is mapped and prefetched ahead.
+class file_mapped_window final {
+public:
+	static const size_t DEFAULT_WINDOW_SIZE = 64 * 1024 * 1024;
+
+private:
+	struct _view final {
+		BYTE*  pMem = nullptr;
+		UINT64 offset = 0;
+		size_t len = 0;
+	};
+
+	file       _file;
+	HANDLE     _hMap = nullptr;
+	UINT64     _sz = 0;
+	size_t     _windowSz = 0; // multiple of the allocation granularity
+	file::hint _hint = file::hint::NORMAL;
+	_view      _cur;
+	_view      _ahead; // next window, only with sequential hint
+
+public:
+	~file_mapped_window() {
+		this->close();
+	}
+
+	file_mapped_window() = default;
+	file_mapped_window(file_mapped_window&& other) noexcept { this->operator=(std::move(other)); }
+
+	file_mapped_window& operator=(file_mapped_window&& other) noexcept {
+		this->close();
+		std::swap(this->_file, other._file);
+		std::swap(this->_hMap, other._hMap);
+		std::swap(this->_sz, other._sz);
+		std::swap(this->_windowSz, other._windowSz);
+		std::swap(this->_hint, other._hint);
+		std::swap(this->_cur, other._cur);
+		std::swap(this->_ahead, other._ahead);
+		return *this;
+	}
+
+	file::access access_type() const noexcept { return this->_file.access_type(); }
+	UINT64       size() const noexcept        { return this->_sz; } // whole file
+	BYTE*        p_mem() const noexcept       { return this->_cur.pMem; } // begin of current window
+	UINT64       offset() const noexcept      { return this->_cur.offset; } // file offset of current window
+	size_t       length() const noexcept      { return this->_cur.len; } // bytes in current window
+
+	file_mapped_window& close() noexcept {
+		_unmap(this->_cur);
+		_unmap(this->_ahead);
+		if (this->_hMap) {
+			CloseHandle(this->_hMap);
+			this->_hMap = nullptr;
+		}
+		this->_file.close();
+		this->_sz = 0;
+		return *this;
+	}
+
+	// Opens the file and maps the first window; window size is rounded up to the allocation granularity.
+	file_mapped_window& open(const std::wstring& filePath, file::access accessType,
+		size_t windowSize = DEFAULT_WINDOW_SIZE, file::hint accessHint = file::hint::NORMAL)
+	{
+		this->close();
+		size_t gran = _granularity();
+		this->_windowSz = windowSize < gran ? gran : (windowSize + gran - 1) / gran * gran;
+		this->_hint = accessHint;
+
+		this->_file.open_existing(filePath, accessType, accessHint);
+		this->_sz = this->_file.size();
+		if (!this->_sz) return *this; // empty files can't be mapped, window stays empty
+
+		this->_hMap = CreateFileMappingW(this->_file.hfile(), nullptr,
+			(accessType == file::access::READWRITE) ? PAGE_READWRITE : PAGE_READONLY, 0, 0, nullptr);
+		if (!this->_hMap) {
+			DWORD err = GetLastError();
+			this->close();
+			throw std::system_error(err, std::system_category(),
+				"CreateFileMapping failed to map file");
+		}
+
+		return this->map_at(0);
+	}
+
+	// Maps the window which contains the given offset; the window begins at a granularity boundary.
+	// At least numBytes after offset are mapped, if within the file.
+	file_mapped_window& map_at(UINT64 offset, size_t numBytes = 0) {
+		if (!this->_hMap) {
+			throw std::logic_error("File has not been mapped.");
+		} else if (offset >= this->_sz) {
+			throw std::invalid_argument("Offset is beyond end of file.");
+		}
+
+		UINT64 endOffset = (numBytes < this->_sz - offset) ? offset + (numBytes ? numBytes : 1) : this->_sz;
+		if (this->_cur.pMem && offset >= this->_cur.offset && endOffset <= this->_cur.offset + this->_cur.len) {
+			return *this; // current window already has it all
+		}
+
+		size_t gran = _granularity();
+		UINT64 winOffset = offset - offset % gran;
+		size_t len = this->_windowSz;
+		if (offset - winOffset + numBytes > len) { // bigger than a window, map all that was asked
+			len = (static_cast<size_t>(offset - winOffset) + numBytes + gran - 1) / gran * gran;
+		}
+		if (len > this->_sz - winOffset) {
+			len = static_cast<size_t>(this->_sz - winOffset);
+		}
+
+		if (this->_ahead.pMem && this->_ahead.offset == winOffset && this->_ahead.len >= len) {
+			_unmap(this->_cur);
+			std::swap(this->_cur, this->_ahead); // window was already mapped ahead
+		} else if (!this->_cur.pMem || this->_cur.offset != winOffset || this->_cur.len < len) {
+			_unmap(this->_cur);
+			this->_cur = this->_map_view(winOffset, len);
+		}
+
+		if (this->_hint == file::hint::SEQUENTIAL) {
+			this->_map_ahead();
+		}
+		return *this;
+	}
+
+	// Maps the window right after the current one, returns false if the current one is the last.
+	bool slide_forward() {
+		UINT64 nextOffset = this->_cur.offset + this->_cur.len;
+		if (!this->_cur.pMem || nextOffset >= this->_sz) return false;
+		this->map_at(nextOffset);
+		return true;
+	}
+
+	// Maps the window right before the current one, returns false if the current one is the first.
+	bool slide_backward() {
+		if (!this->_cur.pMem || this->_cur.offset == 0) return false;
+		this->map_at(this->_cur.offset > this->_windowSz ? this->_cur.offset - this->_windowSz : 0);
+		return true;
+	}
+
+	// Asks the system to bring the current window into memory, in background.
+	// Requires Windows 8; does nothing on older targets.
+	file_mapped_window& prefetch() noexcept {
+		_prefetch(this->_cur);
+		return *this;
+	}
+
+private:
+	static size_t _granularity() noexcept {
+		static const size_t gran = []() -> size_t {
+			SYSTEM_INFO si{};
+			GetSystemInfo(&si);
+			return si.dwAllocationGranularity;
+		}();
+		return gran;
+	}
+
+	_view _map_view(UINT64 winOffset, size_t len) {
+		_view v;
+		v.pMem = reinterpret_cast<BYTE*>(MapViewOfFile(this->_hMap,
+			(this->access_type() == file::access::READWRITE) ? FILE_MAP_WRITE : FILE_MAP_READ,
+			static_cast<DWORD>(winOffset >> 32), static_cast<DWORD>(winOffset & 0xFFFFFFFF), len));
+		if (!v.pMem) {
+			throw std::system_error(GetLastError(), std::system_category(),
+				"MapViewOfFile failed to map file window");
+		}
+		v.offset = winOffset;
+		v.len = len;
+		return v;
+	}
+
+	void _map_ahead() {
+		UINT64 nextOffset = this->_cur.offset + this->_cur.len;
+		if (nextOffset >= this->_sz) {
+			_unmap(this->_ahead); // current window is the last one
+			return;
+		}
+		if (this->_ahead.pMem && this->_ahead.offset == nextOffset) return; // already there
+
+		_unmap(this->_ahead);
+		UINT64 remaining = this->_sz - nextOffset;
+		this->_ahead = this->_map_view(nextOffset,
+			remaining < this->_windowSz ? static_cast<size_t>(remaining) : this->_windowSz);
+		_prefetch(this->_ahead);
+	}
+
+	static void _unmap(_view& v) noexcept {
+		if (v.pMem) {
+			UnmapViewOfFile(v.pMem);
+			v = _view{};
+		}
+	}
+
+	static void _prefetch(const _view& v) noexcept {
+#if _WIN32_WINNT >= 0x0602
+		if (v.pMem) {
+			WIN32_MEMORY_RANGE_ENTRY range{};
+			range.VirtualAddress = v.pMem;
+			range.NumberOfBytes = v.len;
+			PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+		}
+#else
+		UNREFERENCED_PARAMETER(v);
+#endif
+	}
+};
+
+}//namespace wl
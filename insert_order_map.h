@@ -6,12 +6,19 @@
  */
 
 #pragma once
+#include <iterator>
+#include <stdexcept>
+#include <utility>
 #include <vector>
+#include "internals/insert_order_hash.h"
 
 namespace wl {
 
 // Vector-based associative container which keeps the insertion order.
-template<typename keyT, typename valueT>
+// Above a few entries, a Robin Hood hash index is built alongside the vector, so lookups are O(1).
+// Keys can be looked up with any type comparable to them, like std::wstring_view and const wchar_t*.
+// Keys must not be modified through iterators.
+template<typename keyT, typename valueT, typename hashT = _wli::insert_order_hash<keyT>>
 class insert_order_map final {
 public:
 	struct entry final {
@@ -19,173 +26,368 @@ public:
 		valueT value;
 
 		entry() = default;
-		explicit entry(const keyT& key) : key{key} { }
-		entry(const keyT& key, const valueT& value) : key{key}, value{value} { }
+		explicit entry(keyT key) : key{std::move(key)}, value() { }
+		entry(keyT key, valueT value) : key{std::move(key)}, value{std::move(value)} { }
+
+		template<typename kT, typename... argsT>
+		entry(std::piecewise_construct_t, kT&& key, argsT&&... args) :
+			key(std::forward<kT>(key)), value(std::forward<argsT>(args)...) { }
 	};
 
 private:
-	std::vector<entry> _entries;
+	static const size_t _NO_POS = static_cast<size_t>(-1);
+	static const size_t _INDEX_THRESHOLD = 16; // below this, a linear search is faster than hashing
+
+	struct _item final {
+		entry e;
+		bool  dead = false; // removed, but not compacted yet
+
+		explicit _item(const entry& e) : e{e} { }
+
+		template<typename kT, typename... argsT>
+		_item(std::piecewise_construct_t pc, kT&& key, argsT&&... args) :
+			e(pc, std::forward<kT>(key), std::forward<argsT>(args)...) { }
+	};
+
+	struct _slot final {
+		size_t hash = 0;
+		size_t pos = _NO_POS; // index into _items, _NO_POS if slot is free
+	};
+
+	std::vector<_item> _items;
+	std::vector<_slot> _index; // power-of-2 sized, empty while below the threshold
+	size_t             _numDead = 0; // removed items still in the vector, only when indexed
+	hashT              _hasher;
+
+	// Walks the items vector skipping the dead ones.
+	template<typename itemT, typename entryT>
+	class _iterator final {
+	private:
+		itemT* _p = nullptr;
+		itemT* _end = nullptr;
+	public:
+		using iterator_category = std::bidirectional_iterator_tag;
+		using value_type        = entry;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = entryT*;
+		using reference         = entryT&;
+
+		_iterator() = default;
+		_iterator(itemT* p, itemT* end) noexcept : _p{p}, _end{end} { this->_skip_dead(); }
+
+		entryT&    operator*() const noexcept  { return this->_p->e; }
+		entryT*    operator->() const noexcept { return &this->_p->e; }
+		_iterator  operator+(std::ptrdiff_t off) const { _iterator tmp = *this; return tmp += off; }
+		_iterator  operator-(std::ptrdiff_t off) const { _iterator tmp = *this; return tmp -= off; }
+		_iterator& operator+=(std::ptrdiff_t off) {
+			for (; off > 0; --off) this->operator++();
+			for (; off < 0; ++off) this->operator--();
+			return *this;
+		}
+		_iterator& operator-=(std::ptrdiff_t off) { return this->operator+=(-off); }
+		_iterator& operator++()    { ++this->_p; this->_skip_dead(); return *this; }
+		_iterator  operator++(int) { _iterator tmp = *this; this->operator++(); return tmp; }
+		_iterator& operator--()    { do --this->_p; while (this->_p->dead); return *this; }
+		_iterator  operator--(int) { _iterator tmp = *this; this->operator--(); return tmp; }
+		bool       operator==(const _iterator& other) const noexcept { return this->_p == other._p; }
+		bool       operator!=(const _iterator& other) const noexcept { return !this->operator==(other); }
+		bool       operator>(const _iterator& other) const noexcept  { return this->_p > other._p; }
+		bool       operator<(const _iterator& other) const noexcept  { return this->_p < other._p; }
+
+	private:
+		void _skip_dead() noexcept {
+			while (this->_p != this->_end && this->_p->dead) ++this->_p;
+		}
+	};
 
 public:
+	using const_iterator         = _iterator<const _item, const entry>;
+	using iterator               = _iterator<_item, entry>;
+	using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+	using reverse_iterator       = std::reverse_iterator<iterator>;
+
 	insert_order_map() = default;
-	insert_order_map(insert_order_map&& other) noexcept : _entries{std::move(other._entries)} { }
-	insert_order_map(std::initializer_list<entry> entries) : _entries{entries} { }
 
-	size_t            size() const noexcept      { return this->_entries.size(); }
-	bool              empty() const noexcept     { return this->_entries.empty(); }
-	insert_order_map& clear() noexcept           { this->_entries.clear(); return *this; }
-	insert_order_map& reserve(size_t numEntries) { this->_entries.reserve(numEntries); return *this; }
+	insert_order_map(insert_order_map&& other) noexcept :
+		_items{std::move(other._items)}, _index{std::move(other._index)}, _numDead{other._numDead}
+	{
+		other._numDead = 0;
+	}
+
+	insert_order_map(std::initializer_list<entry> entries) {
+		this->_items.reserve(entries.size());
+		for (const entry& e : entries) {
+			this->_items.emplace_back(e);
+		}
+		this->_rebuild_index(this->_items.size());
+	}
+
+	size_t            size() const noexcept  { return this->_items.size() - this->_numDead; }
+	bool              empty() const noexcept { return this->size() == 0; }
+	insert_order_map& clear() noexcept       { this->_items.clear(); this->_index.clear(); this->_numDead = 0; return *this; }
+
+	insert_order_map& reserve(size_t numEntries) {
+		this->_items.reserve(numEntries);
+		if (numEntries >= _INDEX_THRESHOLD && _index_capacity_for(numEntries) > this->_index.size()) {
+			this->_rebuild_index(numEntries);
+		}
+		return *this;
+	}
 
 	insert_order_map& operator=(insert_order_map&& other) noexcept {
-		this->empty();
-		this->_entries.swap(other._entries);
+		this->clear();
+		this->_items.swap(other._items);
+		this->_index.swap(other._index);
+		std::swap(this->_numDead, other._numDead);
 		return *this;
 	}
 
-	const valueT& operator[](const keyT& key) const {
-		typename std::vector<entry>::const_iterator ite = this->_find(key);
-		if (ite == this->_entries.cend()) {
+	template<typename lookupT = keyT>
+	const valueT& operator[](const lookupT& key) const {
+		size_t pos = this->_find_pos(key, this->_hash(key));
+		if (pos == _NO_POS) {
 			throw std::out_of_range("Key doesn't exist.");
 		}
-		return ite->value;
+		return this->_items[pos].e.value;
+	}
+
+	template<typename lookupT = keyT>
+	valueT& operator[](const lookupT& key) {
+		return this->_items[this->_try_emplace(key).first].e.value; // if inexistent, add
+	}
+
+	valueT& operator[](keyT&& key) {
+		return this->_items[this->_try_emplace(std::move(key)).first].e.value;
 	}
 
-	valueT& operator[](const keyT& key) noexcept {
-		typename std::vector<entry>::iterator ite = this->_find(key);
-		if (ite == this->_entries.end()) {
-			this->_entries.emplace_back(key); // inexistent, so add
-			return this->_entries.back().value;
+	// Adds a new entry with the value constructed in place, if the key doesn't exist yet.
+	// Returns the entry and whether it was added.
+	template<typename... argsT>
+	std::pair<iterator, bool> try_emplace(const keyT& key, argsT&&... args) {
+		std::pair<size_t, bool> res = this->_try_emplace(key, std::forward<argsT>(args)...);
+		return {this->_iterator_at(res.first), res.second};
+	}
+
+	// Adds a new entry with the value constructed in place, if the key doesn't exist yet.
+	// Returns the entry and whether it was added.
+	template<typename... argsT>
+	std::pair<iterator, bool> try_emplace(keyT&& key, argsT&&... args) {
+		std::pair<size_t, bool> res = this->_try_emplace(std::move(key), std::forward<argsT>(args)...);
+		return {this->_iterator_at(res.first), res.second};
+	}
+
+	// Adds a new entry or replaces the value of an existing one, with the value constructed in place.
+	// Returns the entry and whether it was added.
+	template<typename... argsT>
+	std::pair<iterator, bool> emplace(keyT key, argsT&&... args) {
+		size_t hash = this->_hash(key);
+		size_t pos = this->_find_pos(key, hash);
+		if (pos != _NO_POS) {
+			this->_items[pos].e.value = valueT(std::forward<argsT>(args)...);
+			return {this->_iterator_at(pos), false};
 		}
-		return ite->value;
+		pos = this->_append(hash, std::move(key), std::forward<argsT>(args)...);
+		return {this->_iterator_at(pos), true};
 	}
 
 	// Returns pointer to value, if key doesn't exist returns nullptr.
-	const valueT* get_if_exists(const keyT& key) const noexcept {
+	template<typename lookupT = keyT>
+	const valueT* get_if_exists(const lookupT& key) const noexcept {
 		// Saves time, instead of calling has() and operator[]().
-		typename std::vector<entry>::const_iterator ite = this->_find(key);
-		return (ite == this->_entries.cend()) ?
-			nullptr : &ite->value;
+		size_t pos = this->_find_pos(key, this->_hash(key));
+		return (pos == _NO_POS) ?
+			nullptr : &this->_items[pos].e.value;
 	}
 
 	// Returns pointer to value, if key doesn't exist returns nullptr.
-	valueT* get_if_exists(const keyT& key) noexcept {
-		typename std::vector<entry>::iterator ite = this->_find(key);
-		return (ite == this->_entries.end()) ?
-			nullptr : &ite->value;
+	template<typename lookupT = keyT>
+	valueT* get_if_exists(const lookupT& key) noexcept {
+		size_t pos = this->_find_pos(key, this->_hash(key));
+		return (pos == _NO_POS) ?
+			nullptr : &this->_items[pos].e.value;
 	}
 
 	// Does the key exist?
-	bool has(const keyT& key) const noexcept {
-		return this->_find(key) != this->_entries.cend();
+	template<typename lookupT = keyT>
+	bool has(const lookupT& key) const noexcept {
+		return this->_find_pos(key, this->_hash(key)) != _NO_POS;
 	}
 
-	insert_order_map& remove(const keyT& key) {
-		typename std::vector<entry>::iterator ite = this->_find(key);
-		if (ite != this->_entries.end()) { // won't fail if inexistent
-			this->_entries.erase(ite);
+	// Removed entries of large maps are only marked as dead, and the vector is compacted when they pile up.
+	template<typename lookupT = keyT>
+	insert_order_map& remove(const lookupT& key) {
+		size_t hash = this->_hash(key);
+		size_t pos = this->_find_pos(key, hash);
+		if (pos == _NO_POS) return *this; // won't fail if inexistent
+
+		if (this->_index.empty()) {
+			this->_items.erase(this->_items.begin() + pos); // small map, just shift
+		} else {
+			this->_index_erase(hash, pos);
+			this->_items[pos].dead = true;
+			if (++this->_numDead > this->_items.size() / 2) {
+				this->_compact();
+			}
 		}
 		return *this;
 	}
 
 private:
-	typename std::vector<entry>::const_iterator _find(const keyT& key) const noexcept {
-		for (typename std::vector<entry>::const_iterator ite = this->_entries.cbegin();
-			ite != this->_entries.cend(); ++ite)
-		{
-			if (ite->key == key) return ite;
+	template<typename kT, typename... argsT>
+	std::pair<size_t, bool> _try_emplace(kT&& key, argsT&&... args) {
+		size_t hash = this->_hash(key);
+		size_t pos = this->_find_pos(key, hash);
+		if (pos != _NO_POS) return {pos, false};
+		return {this->_append(hash, std::forward<kT>(key), std::forward<argsT>(args)...), true};
+	}
+
+	template<typename kT, typename... argsT>
+	size_t _append(size_t hash, kT&& key, argsT&&... args) {
+		this->_items.emplace_back(std::piecewise_construct, std::forward<kT>(key), std::forward<argsT>(args)...);
+		this->_index_added(hash);
+		return this->_items.size() - 1;
+	}
+
+	template<typename lookupT>
+	size_t _hash(const lookupT& key) const noexcept {
+		if (this->_index.empty()) return 0; // not needed for linear search
+		size_t h = 0;
+		if constexpr (std::is_same_v<lookupT, keyT> || _wli::is_transparent_hash<hashT>::value) {
+			h = this->_hasher(key);
+		} else {
+			h = this->_hasher(keyT(key));
 		}
-		return this->_entries.cend();
+		return h ^ (h >> 16) ^ (h >> 7); // spread high bits, since the slot is picked from the low ones
 	}
 
-	typename std::vector<entry>::iterator _find(const keyT& key) noexcept {
-		for (typename std::vector<entry>::iterator ite = this->_entries.begin();
-			ite != this->_entries.end(); ++ite)
-		{
-			if (ite->key == key) return ite;
+	template<typename lookupT>
+	size_t _find_pos(const lookupT& key, size_t hash) const noexcept {
+		if (this->_index.empty()) {
+			for (size_t i = 0; i < this->_items.size(); ++i) {
+				if (!this->_items[i].dead && this->_items[i].e.key == key) return i;
+			}
+			return _NO_POS;
+		}
+
+		size_t mask = this->_index.size() - 1;
+		for (size_t i = hash & mask, dist = 0; ; i = (i + 1) & mask, ++dist) {
+			const _slot& slot = this->_index[i];
+			if (slot.pos == _NO_POS || this->_probe_dist(i, slot.hash) < dist) {
+				return _NO_POS; // a richer key would have been placed here
+			}
+			if (slot.hash == hash && this->_items[slot.pos].e.key == key) return slot.pos;
 		}
-		return this->_entries.end();
 	}
 
-private:
-	template<typename wrapped_itT>
-	class _base_iterator {
-	protected:
-		typename wrapped_itT _it;
-	public:
-		_base_iterator() = default;
-		_base_iterator(const _base_iterator& other) noexcept { this->operator=(other); }
-		_base_iterator(const wrapped_itT& it) noexcept : _it(it) { }
-		_base_iterator& operator=(const _base_iterator& other) noexcept { this->_it = other._it; return *this; }
-		_base_iterator  operator+(std::ptrdiff_t off) const { return {this->_it + off}; }
-		_base_iterator  operator-(std::ptrdiff_t off) const { return {this->_it - off}; }
-		_base_iterator& operator+=(std::ptrdiff_t off)      { this->_it += off; return *this; }
-		_base_iterator& operator-=(std::ptrdiff_t off)      { this->_it -= off; return *this; }
-		_base_iterator& operator++()    { ++this->_it; return *this; }
-		_base_iterator  operator++(int) { _base_iterator tmp = *this; ++this->_it; return tmp; }
-		_base_iterator& operator--()    { --this->_it; return *this; }
-		_base_iterator  operator--(int) { _base_iterator tmp = *this; --this->_it; return tmp; }
-		bool            operator==(const _base_iterator& other) const noexcept { return this->_it == other._it; }
-		bool            operator!=(const _base_iterator& other) const noexcept { return !this->operator==(other); }
-		bool            operator>(const _base_iterator& other) const noexcept  { return this->_it > other._it; }
-		bool            operator<(const _base_iterator& other) const noexcept  { return this->_it < other._it; }
-	};
+	size_t _probe_dist(size_t slotIdx, size_t hash) const noexcept {
+		return (slotIdx - hash) & (this->_index.size() - 1);
+	}
 
-public:
-	class const_iterator final : public _base_iterator<typename std::vector<entry>::const_iterator> {
-	public:
-		const_iterator() = default;
-		const_iterator(const const_iterator& other) noexcept : _base_iterator(other) { }
-		const_iterator(const typename std::vector<entry>::const_iterator& it) noexcept : _base_iterator<typename std::vector<entry>::const_iterator>(it) { }
-		const_iterator& operator=(const const_iterator& other) noexcept { return this->_base_iterator(other); }
-		const entry&    operator*() const  { return this->_it.operator*(); }
-		const entry*    operator->() const { return this->_it.operator->(); }
-	};
+	static size_t _index_capacity_for(size_t numEntries) noexcept {
+		size_t cap = 32;
+		while (cap - cap / 8 < numEntries) cap *= 2; // max load factor of 7/8
+		return cap;
+	}
 
-	class iterator final : public _base_iterator<typename std::vector<entry>::iterator> {
-	public:
-		iterator() = default;
-		iterator(const iterator& other) noexcept : _base_iterator(other) { }
-		iterator(const typename std::vector<entry>::iterator& it) noexcept : _base_iterator<typename std::vector<entry>::iterator>(it) { }
-		iterator& operator=(const iterator& other) noexcept { return this->_base_iterator(other); }
-		entry&    operator*()  { return this->_it.operator*(); }
-		entry*    operator->() { return this->_it.operator->(); }
-	};
+	void _rebuild_index(size_t numEntries) {
+		if (numEntries < _INDEX_THRESHOLD) {
+			this->_index.clear();
+			return;
+		}
+		this->_index.assign(_index_capacity_for(numEntries), _slot{});
+		for (size_t i = 0; i < this->_items.size(); ++i) {
+			if (!this->_items[i].dead) {
+				this->_index_insert(this->_hash(this->_items[i].e.key), i);
+			}
+		}
+	}
 
-	const_iterator cbegin() const noexcept { return {this->_entries.cbegin()}; }
-	const_iterator begin() const noexcept  { return {this->_entries.cbegin()}; }
-	iterator       begin() noexcept        { return {this->_entries.begin()}; }
-	const_iterator cend() const noexcept   { return {this->_entries.cend()}; }
-	const_iterator end() const noexcept    { return {this->_entries.cend()}; }
-	iterator       end() noexcept          { return {this->_entries.end()}; }
+	void _index_insert(size_t hash, size_t pos) noexcept {
+		_slot cur;
+		cur.hash = hash;
+		cur.pos = pos;
+		size_t mask = this->_index.size() - 1;
+		for (size_t i = hash & mask, dist = 0; ; i = (i + 1) & mask, ++dist) {
+			_slot& slot = this->_index[i];
+			if (slot.pos == _NO_POS) {
+				slot = cur;
+				return;
+			}
+			size_t slotDist = this->_probe_dist(i, slot.hash);
+			if (slotDist < dist) { // Robin Hood: take the place of the richer one
+				std::swap(slot, cur);
+				dist = slotDist;
+			}
+		}
+	}
 
-	class const_reverse_iterator final : public _base_iterator<typename std::vector<entry>::const_reverse_iterator> {
-	public:
-		const_reverse_iterator() = default;
-		const_reverse_iterator(const const_reverse_iterator& other) noexcept : _base_iterator(other) { }
-		const_reverse_iterator(const typename std::vector<entry>::const_reverse_iterator& it) noexcept : _base_iterator<typename std::vector<entry>::const_reverse_iterator>(it) { }
-		const_reverse_iterator& operator=(const const_reverse_iterator& other) noexcept { return this->_base_iterator(other); }
-		const entry&            operator*() const  { return this->_it.operator*(); }
-		const entry*            operator->() const { return this->_it.operator->(); }
-		const_iterator          base() const { return {this->_it.base()}; }
-	};
+	void _index_added(size_t hash) {
+		size_t numEntries = this->size();
+		if (this->_index.empty()) {
+			if (numEntries >= _INDEX_THRESHOLD) this->_rebuild_index(numEntries);
+		} else if (_index_capacity_for(numEntries) > this->_index.size()) {
+			this->_rebuild_index(numEntries);
+		} else {
+			this->_index_insert(hash, this->_items.size() - 1);
+		}
+	}
 
-	class reverse_iterator final : public _base_iterator<typename std::vector<entry>::reverse_iterator> {
-	public:
-		reverse_iterator() = default;
-		reverse_iterator(const reverse_iterator& other) noexcept : _base_iterator(other) { }
-		reverse_iterator(const typename std::vector<entry>::reverse_iterator& it) noexcept : _base_iterator<typename std::vector<entry>::reverse_iterator>(it) { }
-		reverse_iterator& operator=(const reverse_iterator& other) noexcept { return this->_base_iterator(other); }
-		entry&            operator*()  { return this->_it.operator*(); }
-		entry*            operator->() { return this->_it.operator->(); }
-		iterator          base() const { return {this->_it.base()}; }
-	};
+	void _index_erase(size_t hash, size_t pos) noexcept {
+		size_t mask = this->_index.size() - 1;
+		size_t i = hash & mask;
+		while (this->_index[i].pos != pos) i = (i + 1) & mask; // the removed entry is always indexed
+
+		for (size_t next = (i + 1) & mask; // backward shift deletion, no tombstones in the index
+			this->_index[next].pos != _NO_POS && this->_probe_dist(next, this->_index[next].hash) != 0;
+			i = next, next = (next + 1) & mask)
+		{
+			this->_index[i] = this->_index[next];
+		}
+		this->_index[i] = _slot{};
+	}
+
+	void _compact() {
+		std::vector<size_t> newPos(this->_items.size());
+		size_t dest = 0;
+		for (size_t i = 0; i < this->_items.size(); ++i) {
+			newPos[i] = dest;
+			if (this->_items[i].dead) continue;
+			if (dest != i) this->_items[dest] = std::move(this->_items[i]);
+			++dest;
+		}
+		while (this->_items.size() > dest) this->_items.pop_back();
 
-	const_reverse_iterator crbegin() const noexcept { return {this->_entries.crbegin()}; }
-	const_reverse_iterator rbegin() const noexcept  { return {this->_entries.crbegin()}; }
-	reverse_iterator       rbegin() noexcept        { return {this->_entries.rbegin()}; }
-	const_reverse_iterator crend() const noexcept   { return {this->_entries.crend()}; }
-	const_reverse_iterator rend() const noexcept    { return {this->_entries.crend()}; }
-	reverse_iterator       rend() noexcept          { return {this->_entries.rend()}; }
+		for (_slot& slot : this->_index) {
+			if (slot.pos != _NO_POS) slot.pos = newPos[slot.pos];
+		}
+		this->_numDead = 0;
+	}
+
+public:
+	const_iterator cbegin() const noexcept { return this->_iterator_at(0); }
+	const_iterator begin() const noexcept  { return this->_iterator_at(0); }
+	iterator       begin() noexcept        { return this->_iterator_at(0); }
+	const_iterator cend() const noexcept   { return this->_iterator_at(this->_items.size()); }
+	const_iterator end() const noexcept    { return this->_iterator_at(this->_items.size()); }
+	iterator       end() noexcept          { return this->_iterator_at(this->_items.size()); }
+
+	const_reverse_iterator crbegin() const noexcept { return const_reverse_iterator{this->cend()}; }
+	const_reverse_iterator rbegin() const noexcept  { return const_reverse_iterator{this->cend()}; }
+	reverse_iterator       rbegin() noexcept        { return reverse_iterator{this->end()}; }
+	const_reverse_iterator crend() const noexcept   { return const_reverse_iterator{this->cbegin()}; }
+	const_reverse_iterator rend() const noexcept    { return const_reverse_iterator{this->cbegin()}; }
+	reverse_iterator       rend() noexcept          { return reverse_iterator{this->begin()}; }
+
+private:
+	const_iterator _iterator_at(size_t pos) const noexcept {
+		const _item* pItems = this->_items.data();
+		return {pItems + pos, pItems + this->_items.size()};
+	}
+
+	iterator _iterator_at(size_t pos) noexcept {
+		_item* pItems = this->_items.data();
+		return {pItems + pos, pItems + this->_items.size()};
+	}
 };
 
 }//namespace wl
@@ -0,0 +1,92 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace wl {
+namespace _wli {
+namespace crc32 {
+
+// Slicing-by-8 tables, for the reflected polynomial used by zip, gzip and PNG.
+struct tables final {
+	uint32_t t[8][256];
+
+	tables() noexcept {
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (int b = 0; b < 8; ++b) c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			this->t[0][i] = c;
+		}
+		for (uint32_t i = 0; i < 256; ++i) {
+			for (int k = 1; k < 8; ++k) {
+				this->t[k][i] = (this->t[k - 1][i] >> 8) ^ this->t[0][this->t[k - 1][i] & 0xFF];
+			}
+		}
+	}
+
+	static const tables& get() noexcept {
+		static const tables instance;
+		return instance;
+	}
+};
+
+// Computes the CRC-32 of the data, 8 bytes per step; pass a previous result to continue it.
+inline uint32_t calc(const uint8_t* p, size_t sz, uint32_t prev = 0) noexcept {
+	const uint32_t (&t)[8][256] = tables::get().t;
+	uint32_t crc = ~prev;
+
+	for (; sz >= 8; p += 8, sz -= 8) {
+		uint32_t one = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24));
+		uint32_t two = p[4] | (p[5] << 8) | (p[6] << 16) | (static_cast<uint32_t>(p[7]) << 24);
+		crc = t[7][one & 0xFF] ^ t[6][(one >> 8) & 0xFF] ^ t[5][(one >> 16) & 0xFF] ^ t[4][one >> 24]
+			^ t[3][two & 0xFF] ^ t[2][(two >> 8) & 0xFF] ^ t[1][(two >> 16) & 0xFF] ^ t[0][two >> 24];
+	}
+	while (sz--) {
+		crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xFF];
+	}
+	return ~crc;
+}
+
+// Returns the CRC-32 of two blocks together, given the CRC of each, and the size of the second one.
+inline uint32_t combine(uint32_t crc1, uint32_t crc2, uint64_t len2) noexcept {
+	// https://github.com/madler/zlib/blob/v1.2.11/crc32.c#L372
+	auto times = [](const uint32_t* mat, uint32_t vec) -> uint32_t {
+		uint32_t sum = 0;
+		for (; vec; vec >>= 1, ++mat) {
+			if (vec & 1) sum ^= *mat;
+		}
+		return sum;
+	};
+	auto square = [&times](uint32_t* dest, const uint32_t* mat) -> void {
+		for (int n = 0; n < 32; ++n) dest[n] = times(mat, mat[n]);
+	};
+
+	if (!len2) return crc1;
+	uint32_t even[32], odd[32]; // operators to apply an even and odd number of zero bits
+	odd[0] = 0xEDB88320;
+	for (int n = 1; n < 32; ++n) odd[n] = 1u << (n - 1);
+	square(even, odd); // 2 zero bits
+	square(odd, even); // 4 zero bits
+
+	for (;;) { // apply len2 zero bytes to crc1
+		square(even, odd);
+		if (len2 & 1) crc1 = times(even, crc1);
+		len2 >>= 1;
+		if (!len2) break;
+		square(odd, even);
+		if (len2 & 1) crc1 = times(odd, crc1);
+		len2 >>= 1;
+		if (!len2) break;
+	}
+	return crc1 ^ crc2;
+}
+
+}//namespace crc32
+}//namespace _wli
+}//namespace wl
@@ -0,0 +1,464 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace wl {
+namespace _wli {
+
+// Compressor to raw DEFLATE data (RFC 1951), with hash chains and lazy matching.
+// The whole input must be in memory; it can be compressed in pieces, which are concatenated.
+// Keeps its buffers between calls, so one object should be reused by each thread.
+class deflater final {
+private:
+	static const int      _HASH_BITS = 15;
+	static const uint32_t _WINDOW = 32768;
+	static const uint32_t _MAX_DIST = _WINDOW - 1;
+	static const int      _MIN_MATCH = 3;
+	static const int      _MAX_MATCH = 258;
+	static const size_t   _MAX_SYMBOLS = 16384; // per block
+	static const int      _EOB = 256;
+
+	struct _config final {
+		int  maxChain;
+		int  goodLen; // search less when the previous match is already this long
+		int  niceLen; // stop searching when a match is this long
+		bool isLazy;
+	};
+
+	struct _symbol final {
+		uint16_t litLen; // literal byte, or match length
+		uint16_t dist; // zero for literals
+	};
+
+	class _bit_writer final {
+	private:
+		std::vector<uint8_t>& _out;
+		uint64_t _buf = 0;
+		int      _cnt = 0;
+
+	public:
+		explicit _bit_writer(std::vector<uint8_t>& out) noexcept : _out{out} { }
+
+		void put(uint32_t bits, int n) { // up to 32 bits
+			this->_buf |= static_cast<uint64_t>(bits) << this->_cnt;
+			this->_cnt += n;
+			while (this->_cnt >= 8) {
+				this->_out.emplace_back(static_cast<uint8_t>(this->_buf));
+				this->_buf >>= 8;
+				this->_cnt -= 8;
+			}
+		}
+
+		void align_to_byte() {
+			if (this->_cnt) this->put(0, 8 - this->_cnt);
+		}
+
+		void put_bytes(const uint8_t* p, size_t n) { // must be aligned
+			this->_out.insert(this->_out.end(), p, p + n);
+		}
+	};
+
+	struct _codes final {
+		uint16_t code[288]; // already reversed, ready to be written
+		uint8_t  len[288];
+
+		void assign(int numSymbols) noexcept {
+			uint16_t count[16]{}, next[16]{};
+			for (int s = 0; s < numSymbols; ++s) ++count[this->len[s]];
+			count[0] = 0;
+			for (int l = 1, c = 0; l < 16; ++l) {
+				c = (c + count[l - 1]) << 1;
+				next[l] = static_cast<uint16_t>(c);
+			}
+			for (int s = 0; s < numSymbols; ++s) {
+				int l = this->len[s];
+				if (!l) continue;
+				unsigned c = next[l]++, rev = 0;
+				for (int b = 0; b < l; ++b) rev |= ((c >> b) & 1) << (l - 1 - b);
+				this->code[s] = static_cast<uint16_t>(rev);
+			}
+		}
+	};
+
+	std::vector<uint32_t> _head; // last position of each hash, plus _base; zero is none
+	std::vector<uint32_t> _prev; // previous position with the same hash, plus _base
+	uint32_t              _base = 1; // positions of previous calls are below it, so tables aren't cleared each time
+	std::vector<_symbol>  _symbols;
+
+public:
+	// Compresses base[start, end) appending to out; bytes in [dictStart, start) may be referenced by matches.
+	// If isLast, the final block is marked; otherwise the output ends byte-aligned with an empty stored block,
+	// so pieces compressed separately can be concatenated. Level goes from 1 (fastest) to 9 (smallest).
+	void compress(const uint8_t* base, size_t dictStart, size_t start, size_t end,
+		bool isLast, int level, std::vector<uint8_t>& out)
+	{
+		static const _config CONFIGS[9]{
+			{4, 4, 8, false}, {8, 4, 16, false}, {16, 4, 32, false}, {16, 4, 16, true}, {32, 8, 32, true},
+			{128, 8, 128, true}, {256, 8, 128, true}, {1024, 32, 258, true}, {4096, 32, 258, true}};
+		const _config& cfg = CONFIGS[std::min(std::max(level, 1), 9) - 1];
+
+		if (start - dictStart > _WINDOW) dictStart = start - _WINDOW;
+		const uint8_t* p = base + dictStart; // all positions are relative to the dictionary
+		uint32_t pos = static_cast<uint32_t>(start - dictStart);
+		uint32_t endPos = static_cast<uint32_t>(end - dictStart);
+		if (end - dictStart > UINT32_MAX) {
+			throw std::length_error("Piece is too large to be compressed at once.");
+		}
+
+		if (this->_head.empty() || UINT32_MAX - this->_base <= endPos) {
+			this->_head.assign(size_t{1} << _HASH_BITS, 0);
+			this->_prev.assign(_WINDOW, 0);
+			this->_base = 1;
+		}
+		this->_symbols.clear();
+		for (uint32_t i = 0; i < pos; ++i) this->_insert(p, i, endPos);
+
+		_bit_writer bits{out};
+		uint32_t blockStart = pos;
+		bool hasPrev = false;
+		int prevLen = 0;
+		uint32_t prevDist = 0;
+
+		auto flushIfFull = [&](uint32_t blockEnd) -> void {
+			if (this->_symbols.size() >= _MAX_SYMBOLS - 1) {
+				this->_write_block(bits, p + blockStart, blockEnd - blockStart, false);
+				blockStart = blockEnd;
+			}
+		};
+
+		while (pos < endPos) {
+			uint32_t dist = 0;
+			int len = 0;
+			if (!hasPrev || prevLen < cfg.niceLen) {
+				int maxChain = hasPrev && prevLen >= cfg.goodLen ? cfg.maxChain / 4 : cfg.maxChain;
+				len = this->_find_match(p, pos, endPos, std::max(maxChain, 1), cfg.niceLen, dist);
+			}
+			this->_insert(p, pos, endPos);
+
+			if (!cfg.isLazy) { // greedy
+				if (len >= _MIN_MATCH) {
+					this->_symbols.push_back({static_cast<uint16_t>(len), static_cast<uint16_t>(dist)});
+					for (uint32_t i = pos + 1; i < pos + len; ++i) this->_insert(p, i, endPos);
+					pos += len;
+				} else {
+					this->_symbols.push_back({p[pos], 0});
+					++pos;
+				}
+				flushIfFull(pos);
+				continue;
+			}
+
+			if (hasPrev && prevLen >= _MIN_MATCH && len <= prevLen) { // previous match is better, use it
+				this->_symbols.push_back({static_cast<uint16_t>(prevLen), static_cast<uint16_t>(prevDist)});
+				uint32_t matchEnd = pos - 1 + prevLen;
+				for (uint32_t i = pos + 1; i < matchEnd; ++i) this->_insert(p, i, endPos);
+				pos = matchEnd;
+				hasPrev = false;
+				flushIfFull(pos);
+			} else {
+				if (hasPrev) {
+					this->_symbols.push_back({p[pos - 1], 0});
+					flushIfFull(pos);
+				}
+				hasPrev = true;
+				prevLen = len;
+				prevDist = dist;
+				++pos;
+			}
+		}
+		if (hasPrev) this->_symbols.push_back({p[endPos - 1], 0}); // too close to the end to be a match
+
+		this->_write_block(bits, p + blockStart, endPos - blockStart, isLast);
+		if (!isLast) { // empty stored block, to align to a byte boundary
+			bits.put(0, 3);
+			bits.align_to_byte();
+			bits.put(0xFFFF0000, 32);
+		}
+		bits.align_to_byte();
+		this->_base += endPos;
+	}
+
+private:
+	static uint32_t _hash(const uint8_t* q) noexcept {
+		uint32_t v = q[0] | (q[1] << 8) | (q[2] << 16);
+		return (v * 2654435761u) >> (32 - _HASH_BITS);
+	}
+
+	void _insert(const uint8_t* p, uint32_t pos, uint32_t endPos) noexcept {
+		if (pos + _MIN_MATCH > endPos) return; // not enough bytes to be hashed
+		uint32_t& head = this->_head[_hash(p + pos)];
+		this->_prev[pos & (_WINDOW - 1)] = head;
+		head = this->_base + pos;
+	}
+
+	int _find_match(const uint8_t* p, uint32_t pos, uint32_t endPos, int maxChain, int niceLen, uint32_t& dist) const noexcept {
+		if (pos + _MIN_MATCH > endPos) return 0;
+		int maxLen = static_cast<int>(std::min<uint32_t>(_MAX_MATCH, endPos - pos));
+		int bestLen = _MIN_MATCH - 1;
+		const uint8_t* cur = p + pos;
+
+		uint32_t cand = this->_head[_hash(cur)];
+		for (int chain = maxChain; cand >= this->_base && chain; --chain) {
+			uint32_t candPos = cand - this->_base;
+			if (pos - candPos > _MAX_DIST) break;
+			const uint8_t* prior = p + candPos;
+
+			if (prior[bestLen] == cur[bestLen] && prior[0] == cur[0]) {
+				int len = _match_length(prior, cur, maxLen);
+				if (len > bestLen) {
+					bestLen = len;
+					dist = pos - candPos;
+					if (len >= niceLen || len == maxLen) break;
+				}
+			}
+			cand = this->_prev[candPos & (_WINDOW - 1)];
+		}
+		return bestLen >= _MIN_MATCH ? bestLen : 0;
+	}
+
+	static int _match_length(const uint8_t* a, const uint8_t* b, int maxLen) noexcept {
+		int len = 0;
+		while (len + 8 <= maxLen) { // 8 bytes at a time
+			uint64_t va, vb;
+			memcpy(&va, a + len, 8);
+			memcpy(&vb, b + len, 8);
+			if (uint64_t diff = va ^ vb) {
+				while (!(diff & 0xFF)) { diff >>= 8; ++len; } // little-endian
+				return len;
+			}
+			len += 8;
+		}
+		while (len < maxLen && a[len] == b[len]) ++len;
+		return len;
+	}
+
+	static void _len_code(int len, int& code, int& extraBits, int& extra) noexcept {
+		static const uint16_t BASE[29]{3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+		static const uint8_t EXTRA[29]{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+		int i = static_cast<int>(std::upper_bound(BASE, BASE + 29, len) - BASE) - 1;
+		code = 257 + i;
+		extraBits = EXTRA[i];
+		extra = len - BASE[i];
+	}
+
+	static void _dist_code(uint32_t dist, int& code, int& extraBits, int& extra) noexcept {
+		static const uint16_t BASE[30]{1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+		static const uint8_t EXTRA[30]{0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+		int i = static_cast<int>(std::upper_bound(BASE, BASE + 30, dist) - BASE) - 1;
+		code = i;
+		extraBits = EXTRA[i];
+		extra = static_cast<int>(dist - BASE[i]);
+	}
+
+	// Huffman code lengths limited to maxLen bits; the most frequent symbols get the shortest codes.
+	static void _build_lengths(const uint32_t* freqs, int numSymbols, int maxLen, uint8_t* lens) {
+		memset(lens, 0, numSymbols);
+		std::vector<std::pair<uint32_t, int>> used; // frequency and symbol
+		for (int s = 0; s < numSymbols; ++s) {
+			if (freqs[s]) used.emplace_back(freqs[s], s);
+		}
+		if (used.empty()) return;
+		if (used.size() == 1) {
+			lens[used[0].second] = 1;
+			return;
+		}
+		std::sort(used.begin(), used.end());
+
+		// Two queues: sorted leaves and internal nodes, which are created in increasing weight.
+		size_t n = used.size();
+		std::vector<uint64_t> weight(2 * n - 1);
+		std::vector<size_t> parent(2 * n - 1);
+		for (size_t i = 0; i < n; ++i) weight[i] = used[i].first;
+		size_t leaf = 0, node = n, nextNode = n;
+		auto pickLightest = [&]() -> size_t {
+			if (leaf < n && (node == nextNode || weight[leaf] <= weight[node])) return leaf++;
+			return node++;
+		};
+		for (; nextNode < 2 * n - 1; ++nextNode) {
+			size_t a = pickLightest(), b = pickLightest();
+			weight[nextNode] = weight[a] + weight[b];
+			parent[a] = parent[b] = nextNode;
+		}
+
+		std::vector<int> depth(2 * n - 1, 0);
+		int numByLen[64]{};
+		for (size_t i = 2 * n - 2; i-- > 0; ) depth[i] = depth[parent[i]] + 1; // parents come after children
+		for (size_t i = 0; i < n; ++i) ++numByLen[std::min(depth[i], 63)];
+
+		for (int l = maxLen + 1; l < 64; ++l) { // too long codes are shortened, then others lengthened to fit
+			numByLen[maxLen] += numByLen[l];
+			numByLen[l] = 0;
+		}
+		uint32_t total = 0;
+		for (int l = maxLen; l > 0; --l) total += static_cast<uint32_t>(numByLen[l]) << (maxLen - l);
+		while (total != (1u << maxLen)) {
+			--numByLen[maxLen];
+			for (int l = maxLen - 1; l > 0; --l) {
+				if (numByLen[l]) {
+					--numByLen[l];
+					numByLen[l + 1] += 2;
+					break;
+				}
+			}
+			--total;
+		}
+
+		size_t idx = 0;
+		for (int l = maxLen; l > 0; --l) {
+			for (int k = 0; k < numByLen[l]; ++k) lens[used[idx++].second] = static_cast<uint8_t>(l);
+		}
+	}
+
+	void _write_block(_bit_writer& bits, const uint8_t* raw, size_t rawSz, bool isLast) {
+		uint32_t litFreqs[288]{}, distFreqs[30]{};
+		for (const _symbol& sym : this->_symbols) {
+			if (!sym.dist) {
+				++litFreqs[sym.litLen];
+			} else {
+				int code, extraBits, extra;
+				_len_code(sym.litLen, code, extraBits, extra);
+				++litFreqs[code];
+				_dist_code(sym.dist, code, extraBits, extra);
+				++distFreqs[code];
+			}
+		}
+		litFreqs[_EOB] = 1;
+		int numDistUsed = 0;
+		for (uint32_t f : distFreqs) numDistUsed += f ? 1 : 0;
+		if (numDistUsed < 2) { // some decoders want a complete distance code
+			if (!distFreqs[0]) distFreqs[0] = 1;
+			if (!distFreqs[1]) distFreqs[1] = 1;
+		}
+
+		_codes lit, dist;
+		_build_lengths(litFreqs, 286, 15, lit.len);
+		_build_lengths(distFreqs, 30, 15, dist.len);
+
+		int numLit = 286, numDist = 30;
+		while (numLit > 257 && !lit.len[numLit - 1]) --numLit;
+		while (numDist > 1 && !dist.len[numDist - 1]) --numDist;
+
+		// Run-length encoding of the code lengths, with codes 16, 17 and 18.
+		uint8_t allLens[286 + 30];
+		memcpy(allLens, lit.len, numLit);
+		memcpy(allLens + numLit, dist.len, numDist);
+		std::vector<std::pair<uint8_t, uint8_t>> runs; // code and its extra bits value
+		uint32_t clFreqs[19]{};
+		int totalLens = numLit + numDist;
+		for (int i = 0; i < totalLens; ) {
+			uint8_t l = allLens[i];
+			int run = 1;
+			while (i + run < totalLens && allLens[i + run] == l) ++run;
+			i += run;
+			if (!l) {
+				while (run >= 11) { int r = std::min(run, 138); runs.emplace_back(18, static_cast<uint8_t>(r - 11)); run -= r; }
+				if (run >= 3) { runs.emplace_back(17, static_cast<uint8_t>(run - 3)); run = 0; }
+			} else {
+				runs.emplace_back(l, 0);
+				--run;
+				while (run >= 3) { int r = std::min(run, 6); runs.emplace_back(16, static_cast<uint8_t>(r - 3)); run -= r; }
+			}
+			while (run-- > 0) runs.emplace_back(l, 0);
+		}
+		for (const std::pair<uint8_t, uint8_t>& r : runs) ++clFreqs[r.first];
+
+		static const uint8_t ORDER[19]{16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+		_codes cl;
+		_build_lengths(clFreqs, 19, 7, cl.len);
+		int numCl = 19;
+		while (numCl > 4 && !cl.len[ORDER[numCl - 1]]) --numCl;
+
+		// Compare the sizes of the 3 block types.
+		static const uint8_t CL_EXTRA[19]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2, 3, 7};
+		uint64_t dynBits = 3 + 14 + 3 * static_cast<uint64_t>(numCl);
+		for (const std::pair<uint8_t, uint8_t>& r : runs) dynBits += cl.len[r.first] + CL_EXTRA[r.first];
+		uint64_t fixedBits = 3;
+		for (int s = 0; s < 286; ++s) {
+			int extraBits = s >= 265 && s < 285 ? (s - 261) / 4 : 0;
+			dynBits += static_cast<uint64_t>(litFreqs[s]) * (lit.len[s] + extraBits);
+			fixedBits += static_cast<uint64_t>(litFreqs[s]) * ((s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8) + extraBits);
+		}
+		for (int s = 0; s < 30; ++s) {
+			int extraBits = s >= 4 ? (s - 2) / 2 : 0;
+			dynBits += static_cast<uint64_t>(distFreqs[s]) * (dist.len[s] + extraBits);
+			fixedBits += static_cast<uint64_t>(distFreqs[s]) * (5 + extraBits);
+		}
+		uint64_t storedBits = (rawSz + 5 * (rawSz / 65535 + 1)) * 8 + 7;
+
+		if (storedBits <= dynBits && storedBits <= fixedBits) {
+			this->_write_stored(bits, raw, rawSz, isLast);
+		} else if (fixedBits <= dynBits) {
+			_codes fixedLit, fixedDist;
+			for (int s = 0; s < 288; ++s) fixedLit.len[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+			for (int s = 0; s < 30; ++s) fixedDist.len[s] = 5;
+			fixedLit.assign(288);
+			fixedDist.assign(30);
+			bits.put(isLast ? 1 : 0, 1);
+			bits.put(1, 2);
+			this->_write_symbols(bits, fixedLit, fixedDist);
+		} else {
+			lit.assign(numLit);
+			dist.assign(numDist);
+			cl.assign(19);
+			bits.put(isLast ? 1 : 0, 1);
+			bits.put(2, 2);
+			bits.put(numLit - 257, 5);
+			bits.put(numDist - 1, 5);
+			bits.put(numCl - 4, 4);
+			for (int i = 0; i < numCl; ++i) bits.put(cl.len[ORDER[i]], 3);
+			for (const std::pair<uint8_t, uint8_t>& r : runs) {
+				bits.put(cl.code[r.first], cl.len[r.first]);
+				if (CL_EXTRA[r.first]) bits.put(r.second, CL_EXTRA[r.first]);
+			}
+			this->_write_symbols(bits, lit, dist);
+		}
+		this->_symbols.clear();
+	}
+
+	void _write_symbols(_bit_writer& bits, const _codes& lit, const _codes& dist) {
+		for (const _symbol& sym : this->_symbols) {
+			if (!sym.dist) {
+				bits.put(lit.code[sym.litLen], lit.len[sym.litLen]);
+				continue;
+			}
+			int code, extraBits, extra;
+			_len_code(sym.litLen, code, extraBits, extra);
+			bits.put(lit.code[code], lit.len[code]);
+			if (extraBits) bits.put(extra, extraBits);
+			_dist_code(sym.dist, code, extraBits, extra);
+			bits.put(dist.code[code], dist.len[code]);
+			if (extraBits) bits.put(extra, extraBits);
+		}
+		bits.put(lit.code[_EOB], lit.len[_EOB]);
+	}
+
+	static void _write_stored(_bit_writer& bits, const uint8_t* raw, size_t rawSz, bool isLast) {
+		do {
+			size_t n = std::min<size_t>(rawSz, 65535);
+			rawSz -= n;
+			bits.put(isLast && !rawSz ? 1 : 0, 1);
+			bits.put(0, 2);
+			bits.align_to_byte();
+			bits.put(static_cast<uint32_t>(n) | (static_cast<uint32_t>(n ^ 0xFFFF) << 16), 32);
+			bits.put_bytes(raw, n);
+			raw += n;
+		} while (rawSz);
+	}
+};
+
+}//namespace _wli
+}//namespace wl
@@ -0,0 +1,113 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <string>
+#include <system_error>
+#include <Windows.h>
+#include <winhttp.h>
+#include "../insert_order_map.h"
+#include "../str.h"
+
+namespace wl {
+namespace _wli {
+namespace download_priv {
+
+// Parses the response headers into an associative array; the status line goes with an empty key.
+inline void read_headers(HINTERNET hRequest, insert_order_map<std::wstring, std::wstring>& dest) {
+	// Retrieve the response header.
+	DWORD rehSize = 0;
+	WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
+		WINHTTP_HEADER_NAME_BY_INDEX, WINHTTP_NO_OUTPUT_BUFFER, &rehSize, WINHTTP_NO_HEADER_INDEX);
+
+	std::wstring rawReh(rehSize / sizeof(wchar_t), L'\0'); // raw response headers
+
+	if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_RAW_HEADERS_CRLF,
+		WINHTTP_HEADER_NAME_BY_INDEX, &rawReh[0], &rehSize, WINHTTP_NO_HEADER_INDEX))
+	{
+		throw std::system_error(GetLastError(), std::system_category(),
+			"WinHttpQueryHeaders failed");
+	}
+
+	// Parse the raw response headers into an associative array.
+	dest.clear();
+
+	str::trim_nulls(rawReh);
+	for (std::wstring_view line : str::split_lines_view(rawReh)) {
+		if (line.empty()) {
+			continue;
+		}
+		size_t colonIdx = line.find_first_of(L':');
+		if (colonIdx == std::wstring_view::npos) { // not a key/value pair, probably response line
+			dest[L""] = line; // empty key
+		} else {
+			dest[std::wstring{str::trim_view(line.substr(0, colonIdx))}] =
+				str::trim_view(line.substr(colonIdx + 1));
+		}
+	}
+}
+
+// Finds a header by name, which is case-insensitive in HTTP; returns null if absent.
+inline const std::wstring* header(const insert_order_map<std::wstring, std::wstring>& headers, std::wstring_view name) noexcept {
+	for (const insert_order_map<std::wstring, std::wstring>::entry& h : headers) {
+		if (str::eqi(h.key, name)) return &h.value;
+	}
+	return nullptr;
+}
+
+// Returns the content length informed by the server, or zero.
+inline UINT64 content_length(const insert_order_map<std::wstring, std::wstring>& headers) {
+	const std::wstring* contLen = header(headers, L"Content-Length");
+	return (contLen && str::is_uint(*contLen)) ? std::stoull(*contLen) : 0;
+}
+
+// Parses the Content-Range header of a partial response, like "bytes 0-499/1234".
+// Returns false if absent or malformed; total is zero if the server doesn't know it.
+inline bool content_range(const insert_order_map<std::wstring, std::wstring>& headers,
+	UINT64& first, UINT64& last, UINT64& total)
+{
+	const std::wstring* contRange = header(headers, L"Content-Range");
+	if (!contRange || contRange->compare(0, 6, L"bytes ")) return false;
+
+	std::wstring_view spec = std::wstring_view{*contRange}.substr(6);
+	size_t slashIdx = spec.find(L'/');
+	if (slashIdx == std::wstring_view::npos) return false;
+	std::wstring_view range = spec.substr(0, slashIdx), length = spec.substr(slashIdx + 1);
+
+	total = 0;
+	if (length != L"*") {
+		if (!str::is_uint(length)) return false;
+		total = std::stoull(std::wstring{length});
+	}
+	if (range == L"*") { // unsatisfied range, only the total is given
+		first = last = 0;
+		return true;
+	}
+
+	size_t dashIdx = range.find(L'-');
+	if (dashIdx == std::wstring_view::npos
+		|| !str::is_uint(range.substr(0, dashIdx)) || !str::is_uint(range.substr(dashIdx + 1))) return false;
+	first = std::stoull(std::wstring{range.substr(0, dashIdx)});
+	last = std::stoull(std::wstring{range.substr(dashIdx + 1)});
+	return first <= last;
+}
+
+// Returns the HTTP status code of the response, like 200.
+inline DWORD status_code(HINTERNET hRequest) {
+	DWORD status = 0, statusSz = sizeof(status);
+	if (!WinHttpQueryHeaders(hRequest, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+		WINHTTP_HEADER_NAME_BY_INDEX, &status, &statusSz, WINHTTP_NO_HEADER_INDEX))
+	{
+		throw std::system_error(GetLastError(), std::system_category(),
+			"WinHttpQueryHeaders failed to retrieve status code");
+	}
+	return status;
+}
+
+}//namespace download_priv
+}//namespace _wli
+}//namespace wl
@@ -0,0 +1,112 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <Windows.h>
+
+namespace wl {
+namespace _wli {
+
+// Fixed-size circular buffer, filled by a download in one thread and drained by a consumer in another.
+// Memory usage is bounded: the download blocks while the buffer is full.
+class download_ring final {
+private:
+	std::vector<BYTE>       _buf;
+	size_t                  _head = 0, _count = 0; // read position and bytes stored
+	bool                    _closed = false, _failed = false;
+	mutable std::mutex      _mtx;
+	std::condition_variable _cvData, _cvRoom;
+
+public:
+	explicit download_ring(size_t capacity) {
+		if (!capacity) {
+			throw std::invalid_argument("Ring buffer capacity can't be zero.");
+		}
+		this->_buf.resize(capacity);
+	}
+
+	download_ring(const download_ring&) = delete;
+	download_ring& operator=(const download_ring&) = delete;
+
+	size_t capacity() const noexcept { return this->_buf.size(); }
+
+	// Number of bytes waiting to be read.
+	size_t size() const {
+		std::lock_guard<std::mutex> lock{this->_mtx};
+		return this->_count;
+	}
+
+	// After the ring is closed, tells whether the download failed or was aborted before the end.
+	bool failed() const {
+		std::lock_guard<std::mutex> lock{this->_mtx};
+		return this->_failed;
+	}
+
+	// Copies all the bytes in, waiting for room as needed; returns false if the ring was closed meanwhile.
+	bool write(const BYTE* pData, size_t sz) {
+		std::unique_lock<std::mutex> lock{this->_mtx};
+		while (sz) {
+			this->_cvRoom.wait(lock, [this]() { return this->_closed || this->_count < this->_buf.size(); });
+			if (this->_closed) return false;
+
+			size_t tail = (this->_head + this->_count) % this->_buf.size();
+			size_t n = std::min({sz, this->_buf.size() - this->_count, this->_buf.size() - tail}); // contiguous room
+			memcpy(&this->_buf[tail], pData, n);
+			this->_count += n;
+			pData += n;
+			sz -= n;
+			this->_cvData.notify_one();
+		}
+		return true;
+	}
+
+	// Waits until there's something to read, then copies up to sz bytes out.
+	// Returns zero only when the ring is closed and empty.
+	size_t read(BYTE* pDest, size_t sz) {
+		std::unique_lock<std::mutex> lock{this->_mtx};
+		this->_cvData.wait(lock, [this]() { return this->_closed || this->_count > 0; });
+
+		size_t tot = 0;
+		while (tot < sz && this->_count) {
+			size_t n = std::min({sz - tot, this->_count, this->_buf.size() - this->_head}); // contiguous data
+			memcpy(pDest + tot, &this->_buf[this->_head], n);
+			this->_head = (this->_head + n) % this->_buf.size();
+			this->_count -= n;
+			tot += n;
+		}
+		if (tot) this->_cvRoom.notify_one();
+		return tot;
+	}
+
+	// Ends the stream: pending bytes can still be read, further writes are refused.
+	// Called by the download when it ends; the consumer may call it to stop the download.
+	void close(bool failed = false) {
+		{
+			std::lock_guard<std::mutex> lock{this->_mtx};
+			if (!this->_closed) this->_failed = failed;
+			this->_closed = true;
+		}
+		this->_cvData.notify_all();
+		this->_cvRoom.notify_all();
+	}
+
+	// Empties and reopens the ring, so it can be used by another download.
+	void reset() {
+		std::lock_guard<std::mutex> lock{this->_mtx};
+		this->_head = this->_count = 0;
+		this->_closed = this->_failed = false;
+	}
+};
+
+}//namespace _wli
+}//namespace wl
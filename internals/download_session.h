@@ -45,7 +45,8 @@ public:
 		}
 	}
 
-	download_session& open(const wchar_t* userAgent = L"WinLamb/1.0") {
+	// Opens the session; pass WINHTTP_FLAG_ASYNC in flags for an asynchronous one.
+	download_session& open(const wchar_t* userAgent = L"WinLamb/1.0", DWORD flags = 0) {
 		if (!this->_hSession) {
 			// http://social.msdn.microsoft.com/forums/en-US/vclanguage/thread/45ccd91c-6794-4f9b-8f4f-865c76cc146d
 			if (!WinHttpCheckPlatform()) {
@@ -54,7 +55,7 @@ public:
 			}
 
 			this->_hSession = WinHttpOpen(userAgent, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-				WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+				WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, flags);
 			if (!this->_hSession) {
 				throw std::system_error(GetLastError(), std::system_category(),
 					"WinHttpOpen failed when opening session");
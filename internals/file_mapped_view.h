@@ -0,0 +1,51 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <memory>
+#include <stdexcept>
+#include <Windows.h>
+
+namespace wl {
+class file_mapped; // forward declaration
+
+namespace _wli {
+
+// Read-only view to the memory of a mapped file, with no copy.
+// The file stays mapped while any view to it exists.
+class file_mapped_view final {
+private:
+	std::shared_ptr<const file_mapped> _owner;
+	const BYTE* _pData = nullptr;
+	size_t      _sz = 0;
+
+public:
+	file_mapped_view() = default;
+	file_mapped_view(std::shared_ptr<const file_mapped> owner, const BYTE* pData, size_t sz) noexcept :
+		_owner{std::move(owner)}, _pData{pData}, _sz{sz} { }
+
+	const BYTE* data() const noexcept  { return this->_pData; }
+	size_t      size() const noexcept  { return this->_sz; }
+	bool        empty() const noexcept { return this->_sz == 0; }
+	const BYTE* begin() const noexcept { return this->_pData; }
+	const BYTE* end() const noexcept   { return this->_pData + this->_sz; }
+
+	const BYTE& operator[](size_t index) const noexcept { return this->_pData[index]; }
+
+	// Returns a view to a part of this view, which shares the same mapping.
+	file_mapped_view sub(size_t offset, size_t numBytes = -1) const {
+		if (offset > this->_sz) {
+			throw std::invalid_argument("Offset is beyond end of view.");
+		} else if (numBytes > this->_sz - offset) {
+			numBytes = this->_sz - offset;
+		}
+		return {this->_owner, this->_pData + offset, numBytes};
+	}
+};
+
+}//namespace _wli
+}//namespace wl
@@ -0,0 +1,529 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "crc32.h"
+
+namespace wl {
+namespace _wli {
+
+// Decompressor of raw DEFLATE data (RFC 1951), all at once into a buffer of known size.
+class inflater final {
+	friend class inflater_stream;
+
+private:
+	static const int _FAST_BITS = 10; // codes up to this length are decoded with a single table lookup
+
+	struct _truncated final : public std::runtime_error { // more input is needed
+		_truncated() : runtime_error{"Inflate failed: data is truncated."} { }
+	};
+	struct _output_full final : public std::runtime_error { // dest buffer is too small
+		_output_full() : runtime_error{"Inflate failed: output is larger than expected."} { }
+	};
+
+	struct _huffman final {
+		uint16_t fast[1 << _FAST_BITS]; // (length << 9) | symbol, zero if code is longer
+		uint16_t count[16]; // number of codes of each length
+		uint16_t symbol[288]; // symbols ordered by code
+
+		void build(const uint8_t* lengths, int numSymbols) {
+			memset(this->fast, 0, sizeof(this->fast));
+			memset(this->count, 0, sizeof(this->count));
+			for (int s = 0; s < numSymbols; ++s) ++this->count[lengths[s]];
+			this->count[0] = 0;
+
+			int left = 1; // check for over-subscribed code
+			for (int len = 1; len <= 15; ++len) {
+				left = (left << 1) - this->count[len];
+				if (left < 0) _fail("invalid Huffman code");
+			}
+
+			uint16_t offs[16]{};
+			for (int len = 1; len < 15; ++len) offs[len + 1] = offs[len] + this->count[len];
+			for (int s = 0; s < numSymbols; ++s) {
+				if (lengths[s]) this->symbol[offs[lengths[s]]++] = static_cast<uint16_t>(s);
+			}
+
+			unsigned code = 0; // canonical codes, then reversed, since the stream is read from the lowest bit
+			int idx = 0;
+			for (int len = 1; len <= _FAST_BITS; ++len) {
+				for (int i = 0; i < this->count[len]; ++i, ++idx, ++code) {
+					unsigned rev = 0;
+					for (int b = 0; b < len; ++b) rev |= ((code >> b) & 1) << (len - 1 - b);
+					for (unsigned f = rev; f < (1u << _FAST_BITS); f += (1u << len)) {
+						this->fast[f] = static_cast<uint16_t>((len << 9) | this->symbol[idx]);
+					}
+				}
+				code <<= 1;
+			}
+		}
+	};
+
+	class _bits final {
+	private:
+		const uint8_t* _p;
+		const uint8_t* _pEnd;
+		uint64_t       _buf = 0;
+		int            _cnt = 0;
+		int            _phantom = 0; // zero bytes fed past the end, an error if consumed
+
+	public:
+		_bits(const uint8_t* p, size_t sz) noexcept : _p{p}, _pEnd{p + sz} { }
+
+		void refill() noexcept {
+			while (this->_cnt <= 56) {
+				if (this->_p < this->_pEnd) {
+					this->_buf |= static_cast<uint64_t>(*this->_p++) << this->_cnt;
+				} else {
+					++this->_phantom;
+				}
+				this->_cnt += 8;
+			}
+		}
+
+		unsigned peek(int n) noexcept { return static_cast<unsigned>(this->_buf & ((1ull << n) - 1)); }
+
+		void consume(int n) {
+			this->_buf >>= n;
+			this->_cnt -= n;
+			if (this->_phantom * 8 > this->_cnt) throw _truncated{};
+		}
+
+		bool has_real(int n) const noexcept { return this->_cnt - this->_phantom * 8 >= n; } // not past the end
+
+		unsigned get(int n) { // up to 32 bits
+			if (this->_cnt < n) this->refill();
+			unsigned val = this->peek(n);
+			this->consume(n);
+			return val;
+		}
+
+		// Drops the bits up to the next byte boundary and gives back the whole bytes not yet used.
+		const uint8_t* align_to_byte() {
+			this->consume(this->_cnt % 8);
+			const uint8_t* p = this->_p - (this->_cnt / 8 - this->_phantom);
+			this->_buf = 0;
+			this->_cnt = this->_phantom = 0;
+			return p;
+		}
+
+		void restart_at(const uint8_t* p) noexcept { this->_p = p; }
+		const uint8_t* end() const noexcept { return this->_pEnd; }
+
+		// Bytes consumed so far, only exact after the last block.
+		const uint8_t* position() const noexcept { return this->_p - (this->_cnt / 8 - this->_phantom); }
+
+		// Bits consumed so far, counting from base.
+		size_t bit_position(const uint8_t* base) const noexcept {
+			return static_cast<size_t>(this->_p - base + this->_phantom) * 8 - this->_cnt;
+		}
+	};
+
+public:
+	// Decompresses into dest, returns the number of bytes written; throws std::runtime_error on corrupted data,
+	// or if the output doesn't fit. If pSrcUsed is given, receives the number of compressed bytes consumed.
+	static size_t inflate(const uint8_t* src, size_t srcSz, uint8_t* dest, size_t destSz, size_t* pSrcUsed = nullptr) {
+		_bits bits{src, srcSz};
+		size_t outPos = 0;
+		while (!_inflate_block(bits, dest, destSz, outPos)) ;
+
+		if (pSrcUsed) *pSrcUsed = static_cast<size_t>(bits.position() - src);
+		return outPos;
+	}
+
+private:
+	[[noreturn]] static void _fail(const char* what) {
+		throw std::runtime_error(std::string{"Inflate failed: "}.append(what).append("."));
+	}
+
+	[[noreturn]] static void _fail_output() {
+		throw _output_full{};
+	}
+
+	// Decodes one block, appending to dest; bytes before outPos are the history referenced by matches.
+	// Returns true if it was the last block.
+	static bool _inflate_block(_bits& bits, uint8_t* dest, size_t destSz, size_t& outPos) {
+		bool isLast = bits.get(1) != 0;
+		unsigned type = bits.get(2);
+
+		if (type == 0) { // stored block
+			const uint8_t* p = bits.align_to_byte();
+			if (bits.end() - p < 4) throw _truncated{};
+			unsigned len = p[0] | (p[1] << 8), nlen = p[2] | (p[3] << 8);
+			if ((len ^ 0xFFFF) != nlen) _fail("invalid stored block length");
+			p += 4;
+			if (static_cast<size_t>(bits.end() - p) < len) throw _truncated{};
+			if (destSz - outPos < len) _fail_output();
+			memcpy(dest + outPos, p, len);
+			outPos += len;
+			bits.restart_at(p + len);
+		} else if (type == 1) {
+			_decode_block(bits, _fixed_lit(), _fixed_dist(), dest, destSz, outPos);
+		} else if (type == 2) {
+			_huffman lit, dist;
+			_read_dynamic_tables(bits, lit, dist);
+			_decode_block(bits, lit, dist, dest, destSz, outPos);
+		} else {
+			_fail("invalid block type");
+		}
+		return isLast;
+	}
+
+	static const _huffman& _fixed_lit() {
+		static const _huffman h = []() -> _huffman {
+			uint8_t lengths[288];
+			int s = 0;
+			for (; s < 144; ++s) lengths[s] = 8;
+			for (; s < 256; ++s) lengths[s] = 9;
+			for (; s < 280; ++s) lengths[s] = 7;
+			for (; s < 288; ++s) lengths[s] = 8;
+			_huffman ret;
+			ret.build(lengths, 288);
+			return ret;
+		}();
+		return h;
+	}
+
+	static const _huffman& _fixed_dist() {
+		static const _huffman h = []() -> _huffman {
+			uint8_t lengths[30];
+			memset(lengths, 5, sizeof(lengths));
+			_huffman ret;
+			ret.build(lengths, 30);
+			return ret;
+		}();
+		return h;
+	}
+
+	static int _decode_symbol(_bits& bits, const _huffman& h) {
+		bits.refill();
+		uint16_t entry = h.fast[bits.peek(_FAST_BITS)];
+		if (entry) {
+			bits.consume(entry >> 9);
+			return entry & 0x1FF;
+		}
+
+		int code = 0, first = 0, index = 0; // canonical decoding, one bit at a time
+		for (int len = 1; len <= 15; ++len) {
+			code |= static_cast<int>(bits.peek(len) >> (len - 1)) & 1;
+			int count = h.count[len];
+			if (code - count < first) {
+				bits.consume(len);
+				return h.symbol[index + (code - first)];
+			}
+			index += count;
+			first += count;
+			first <<= 1;
+			code <<= 1;
+		}
+		if (!bits.has_real(15)) throw _truncated{}; // code may continue beyond the end
+		_fail("invalid Huffman code");
+	}
+
+	static void _read_dynamic_tables(_bits& bits, _huffman& lit, _huffman& dist) {
+		static const uint8_t ORDER[19]{16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+		int numLit = static_cast<int>(bits.get(5)) + 257;
+		int numDist = static_cast<int>(bits.get(5)) + 1;
+		int numCodeLen = static_cast<int>(bits.get(4)) + 4;
+		if (numLit > 286 || numDist > 30) _fail("too many length or distance codes");
+
+		uint8_t lengths[320]{};
+		for (int i = 0; i < numCodeLen; ++i) lengths[ORDER[i]] = static_cast<uint8_t>(bits.get(3));
+		_huffman lenCodes;
+		lenCodes.build(lengths, 19);
+
+		memset(lengths, 0, sizeof(lengths));
+		for (int i = 0; i < numLit + numDist; ) {
+			int sym = _decode_symbol(bits, lenCodes);
+			if (sym < 16) {
+				lengths[i++] = static_cast<uint8_t>(sym);
+				continue;
+			}
+
+			uint8_t repeated = 0;
+			int times = 0;
+			if (sym == 16) {
+				if (!i) _fail("repeat with no previous length");
+				repeated = lengths[i - 1];
+				times = 3 + static_cast<int>(bits.get(2));
+			} else if (sym == 17) {
+				times = 3 + static_cast<int>(bits.get(3));
+			} else {
+				times = 11 + static_cast<int>(bits.get(7));
+			}
+			if (i + times > numLit + numDist) _fail("too many lengths");
+			while (times--) lengths[i++] = repeated;
+		}
+
+		if (!lengths[256]) _fail("no end of block code");
+		lit.build(lengths, numLit);
+		dist.build(lengths + numLit, numDist);
+	}
+
+	static void _decode_block(_bits& bits, const _huffman& lit, const _huffman& dist,
+		uint8_t* dest, size_t destSz, size_t& outPos)
+	{
+		static const uint16_t LEN_BASE[29]{3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+			35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+		static const uint8_t LEN_EXTRA[29]{0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+			3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+		static const uint16_t DIST_BASE[30]{1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+			257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+		static const uint8_t DIST_EXTRA[30]{0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+			7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+		for (;;) {
+			int sym = _decode_symbol(bits, lit);
+			if (sym < 256) { // literal
+				if (outPos == destSz) _fail_output();
+				dest[outPos++] = static_cast<uint8_t>(sym);
+				continue;
+			} else if (sym == 256) { // end of block
+				return;
+			}
+
+			sym -= 257;
+			if (sym >= 29) _fail("invalid length code");
+			size_t len = LEN_BASE[sym] + bits.get(LEN_EXTRA[sym]);
+
+			int distSym = _decode_symbol(bits, dist);
+			if (distSym >= 30) _fail("invalid distance code");
+			size_t distance = DIST_BASE[distSym] + bits.get(DIST_EXTRA[distSym]);
+			if (distance > outPos) _fail("distance is too far back");
+			if (destSz - outPos < len) _fail_output();
+
+			uint8_t* pOut = dest + outPos;
+			const uint8_t* pFrom = pOut - distance;
+			if (distance >= len) {
+				memcpy(pOut, pFrom, len);
+			} else {
+				for (size_t i = 0; i < len; ++i) pOut[i] = pFrom[i]; // overlapping, repeats a pattern
+			}
+			outPos += len;
+		}
+	}
+};
+
+// Decompressor of DEFLATE data which comes in pieces, like a download body, optionally wrapped in the
+// zlib (RFC 1950) or gzip (RFC 1952) format. Output is handed out block by block, as soon as each block
+// is complete; only the last 32 KB of output, and the input of the unfinished block, are kept.
+class inflater_stream final {
+public:
+	enum class format {
+		RAW,  // bare DEFLATE data
+		ZLIB, // zlib header and Adler-32; bare data is also accepted, as some servers send it as "deflate"
+		GZIP  // gzip header and CRC-32; concatenated members are decoded one after another
+	};
+
+private:
+	enum class _stage { HEADER, BLOCKS, TRAILER, DONE };
+	static const size_t _WINDOW = 32 * 1024; // farthest distance a match can reach back
+	static const size_t _MIN_OUT = 256 * 1024; // initial room for a decoded block, grows if needed
+
+	format               _fmt;
+	_stage               _stg = _stage::HEADER;
+	std::vector<uint8_t> _in; // input not yet consumed
+	size_t               _inBit = 0; // position in _in where the next block starts, less than 8 after each feed
+	size_t               _retryAt = 0; // after a block was cut short, input size worth trying again
+	std::vector<uint8_t> _out; // last output, as history for matches, followed by the block being decoded
+	size_t               _histSz = 0;
+	uint32_t             _check = 0, _outSz = 0; // checksum and size of output, as in the trailer
+
+public:
+	explicit inflater_stream(format fmt) noexcept : _fmt{fmt} { this->_reset_check(); }
+
+	bool is_done() const noexcept { return this->_stg == _stage::DONE; }
+
+	// Takes more input; each piece of decoded output is passed to the callback, a
+	// void(const uint8_t*, size_t), and is valid only during the call. Throws std::runtime_error
+	// on corrupted data.
+	template<typename F>
+	void feed(const uint8_t* src, size_t srcSz, F&& output) {
+		this->_in.insert(this->_in.end(), src, src + srcSz);
+		if (this->_in.size() >= this->_retryAt) { // don't decode the same block again for each little piece
+			this->_run(output);
+		}
+	}
+
+	// Tells the input is over, decoding whatever remains; throws std::runtime_error if the stream is incomplete.
+	template<typename F>
+	void finish(F&& output) {
+		this->_run(output);
+		if (this->_stg != _stage::DONE) {
+			throw std::runtime_error("Inflate failed: data is truncated.");
+		}
+	}
+
+private:
+	template<typename F>
+	void _run(F& output) {
+		bool isStarved = false;
+		while (!isStarved) {
+			switch (this->_stg) {
+			case _stage::HEADER:  isStarved = !this->_read_header(); break;
+			case _stage::BLOCKS:  isStarved = !this->_read_block(output); break;
+			case _stage::TRAILER: isStarved = !this->_read_trailer(); break;
+			case _stage::DONE:    isStarved = !this->_next_member();
+			}
+		}
+
+		this->_in.erase(this->_in.begin(), this->_in.begin() + this->_inBit / 8); // drop consumed bytes
+		this->_inBit %= 8;
+		this->_retryAt = (this->_stg == _stage::BLOCKS) ? this->_in.size() * 2 : 0;
+	}
+
+	const uint8_t* _in_bytes(size_t& avail) const noexcept { // unconsumed input, from a byte boundary
+		avail = this->_in.size() - this->_inBit / 8;
+		return this->_in.data() + this->_inBit / 8;
+	}
+
+	void _reset_check() noexcept {
+		this->_check = (this->_fmt == format::ZLIB) ? 1 : 0; // initial Adler-32 is 1
+		this->_outSz = 0;
+		this->_histSz = 0;
+	}
+
+	bool _read_header() {
+		size_t avail = 0;
+		const uint8_t* p = this->_in_bytes(avail);
+
+		if (this->_fmt == format::ZLIB) {
+			if (avail < 2) return false;
+			if ((p[0] & 0x0F) == 8 && !(((p[0] << 8) | p[1]) % 31)) { // else it's bare data
+				if (p[1] & 0x20) {
+					throw std::runtime_error("Inflate failed: zlib preset dictionary is not supported.");
+				}
+				this->_inBit += 16;
+			} else {
+				this->_fmt = format::RAW;
+			}
+		} else if (this->_fmt == format::GZIP) {
+			if (avail < 10) return false;
+			if (p[0] != 0x1F || p[1] != 0x8B || p[2] != 8) {
+				throw std::runtime_error("Inflate failed: invalid gzip header.");
+			}
+			uint8_t flags = p[3];
+			size_t len = 10;
+			if (flags & 0x04) { // extra field
+				if (avail < len + 2) return false;
+				len += 2 + (p[len] | (p[len + 1] << 8));
+			}
+			for (int zeroEnded : {0x08, 0x10}) { // file name and comment
+				if (!(flags & zeroEnded)) continue;
+				const uint8_t* pZero = (len < avail) ? static_cast<const uint8_t*>(memchr(p + len, 0, avail - len)) : nullptr;
+				if (!pZero) return false;
+				len = pZero - p + 1;
+			}
+			if (flags & 0x02) len += 2; // header CRC
+			if (avail < len) return false;
+			this->_inBit += len * 8;
+		}
+
+		this->_stg = _stage::BLOCKS;
+		return true;
+	}
+
+	template<typename F>
+	bool _read_block(F& output) {
+		size_t avail = 0;
+		const uint8_t* p = this->_in_bytes(avail);
+		inflater::_bits bits{p, avail};
+		bool isLast = false;
+		size_t outPos = 0;
+
+		for (;;) { // the block is decoded again if it doesn't fit the buffer
+			if (this->_out.size() < this->_histSz + _MIN_OUT) this->_out.resize(this->_histSz + _MIN_OUT);
+			inflater::_bits tryBits = bits;
+			try {
+				tryBits.get(this->_inBit % 8); // block may start in the middle of a byte
+				outPos = this->_histSz;
+				isLast = inflater::_inflate_block(tryBits, this->_out.data(), this->_out.size(), outPos);
+				this->_inBit = (this->_inBit / 8) * 8 + tryBits.bit_position(p);
+				break;
+			} catch (const inflater::_truncated&) {
+				return false; // wait for more input
+			} catch (const inflater::_output_full&) {
+				this->_out.resize(this->_out.size() * 2);
+			}
+		}
+
+		const uint8_t* pNew = this->_out.data() + this->_histSz;
+		size_t newSz = outPos - this->_histSz;
+		if (this->_fmt == format::GZIP) {
+			this->_check = crc32::calc(pNew, newSz, this->_check);
+		} else if (this->_fmt == format::ZLIB) {
+			this->_check = _adler32(pNew, newSz, this->_check);
+		}
+		this->_outSz += static_cast<uint32_t>(newSz);
+		if (newSz) output(pNew, newSz);
+
+		this->_histSz = outPos < _WINDOW ? outPos : _WINDOW; // keep the tail as history
+		memmove(this->_out.data(), this->_out.data() + outPos - this->_histSz, this->_histSz);
+
+		if (isLast) this->_stg = (this->_fmt == format::RAW) ? _stage::DONE : _stage::TRAILER;
+		return true;
+	}
+
+	bool _read_trailer() {
+		this->_inBit = (this->_inBit + 7) / 8 * 8; // trailer starts at a byte boundary
+		size_t avail = 0;
+		const uint8_t* p = this->_in_bytes(avail);
+
+		if (this->_fmt == format::ZLIB) {
+			if (avail < 4) return false;
+			uint32_t adler = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; // big-endian
+			if (adler != this->_check) {
+				throw std::runtime_error("Inflate failed: Adler-32 mismatch.");
+			}
+			this->_inBit += 32;
+		} else {
+			if (avail < 8) return false;
+			uint32_t crc = p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+			uint32_t isize = p[4] | (p[5] << 8) | (p[6] << 16) | (static_cast<uint32_t>(p[7]) << 24);
+			if (crc != this->_check || isize != this->_outSz) {
+				throw std::runtime_error("Inflate failed: CRC-32 or size mismatch.");
+			}
+			this->_inBit += 64;
+		}
+
+		this->_stg = _stage::DONE;
+		return true;
+	}
+
+	bool _next_member() { // after a gzip member, another one may follow; anything else is ignored
+		size_t avail = 0;
+		const uint8_t* p = this->_in_bytes(avail);
+		if (this->_fmt != format::GZIP || avail < 2 || p[0] != 0x1F || p[1] != 0x8B) return false;
+		this->_reset_check();
+		this->_stg = _stage::HEADER;
+		return true;
+	}
+
+	static uint32_t _adler32(const uint8_t* p, size_t sz, uint32_t prev) noexcept {
+		uint32_t a = prev & 0xFFFF, b = prev >> 16;
+		while (sz) {
+			size_t n = sz < 5552 ? sz : 5552; // most bytes before the sums can overflow
+			sz -= n;
+			while (n--) {
+				a += *p++;
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+		}
+		return (b << 16) | a;
+	}
+};
+
+}//namespace _wli
+}//namespace wl
@@ -0,0 +1,37 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace wl {
+namespace _wli {
+
+// Default hasher of insert_order_map, same as std::hash.
+template<typename keyT>
+struct insert_order_hash : public std::hash<keyT> { };
+
+// String keys are hashed as views, so they can be looked up with views and literals without allocations.
+// Hashes are the same of std::hash<std::wstring>, which is guaranteed to match std::hash<std::wstring_view>.
+template<>
+struct insert_order_hash<std::wstring> final {
+	using is_transparent = void;
+	size_t operator()(std::wstring_view key) const noexcept { return std::hash<std::wstring_view>{}(key); }
+};
+
+// Does the hasher accept any type which can be compared to the key?
+template<typename hashT, typename = void>
+struct is_transparent_hash : public std::false_type { };
+
+template<typename hashT>
+struct is_transparent_hash<hashT, std::void_t<typename hashT::is_transparent>> : public std::true_type { };
+
+}//namespace _wli
+}//namespace wl
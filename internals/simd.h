@@ -0,0 +1,54 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+
+// SSE2 is always present on x64, and on x86 when compiling with /arch:SSE2 or above.
+#if defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define WINLAMB_SSE2
+#include <emmintrin.h>
+#endif
+
+// AVX2 is only used when explicitly enabled with /arch:AVX2.
+#if defined(__AVX2__)
+#define WINLAMB_AVX2
+#include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace wl {
+namespace _wli {
+namespace simd {
+
+// Index of the lowest set bit; mask must not be zero.
+inline unsigned first_bit(unsigned mask) noexcept {
+#ifdef _MSC_VER
+	unsigned long idx = 0;
+	_BitScanForward(&idx, mask);
+	return idx;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+// Index of the highest set bit; mask must not be zero.
+inline unsigned last_bit(unsigned mask) noexcept {
+#ifdef _MSC_VER
+	unsigned long idx = 0;
+	_BitScanReverse(&idx, mask);
+	return idx;
+#else
+	return 31 - __builtin_clz(mask);
+#endif
+}
+
+}//namespace simd
+}//namespace _wli
+}//namespace wl
@@ -0,0 +1,234 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <Windows.h>
+#include "simd.h"
+
+namespace wl {
+namespace _wli {
+
+// Table which maps each UTF-16 code unit to its uppercase, built once with CharUpperBuff.
+inline const wchar_t* str_fold_table() {
+	struct table final {
+		wchar_t chars[0x10000];
+		table() noexcept {
+			for (size_t i = 0; i < 0x10000; ++i) {
+				this->chars[i] = static_cast<wchar_t>(i);
+			}
+			CharUpperBuffW(this->chars, 0xD800); // surrogates are kept as they are
+			CharUpperBuffW(this->chars + 0xE000, 0x10000 - 0xE000);
+		}
+	};
+	static const table foldTable; // thread-safe initialization
+	return foldTable.chars;
+}
+
+// Case-insensitive substring search over code units folded to uppercase, with no allocations.
+// Keeps a copy of the needle and its shift tables, so it can be reused on many haystacks.
+class str_needle final {
+public:
+	static const size_t npos = std::wstring_view::npos;
+
+private:
+	static constexpr size_t _HORSPOOL_MIN_LEN = 12; // from this length on, Horspool skips faster than the first char scan
+	const wchar_t* _fold = str_fold_table();
+	std::wstring   _needle; // folded
+	size_t         _shift[256]; // Horspool bad-char shifts, by low byte of folded char
+	size_t         _rshift[256]; // same, for reverse search
+	wchar_t        _asciiFirst[2]; // ASCII chars which fold into the first needle char
+	size_t         _numAsciiFirst = 0;
+
+public:
+	explicit str_needle(std::wstring_view needle) : _needle{needle} {
+		for (wchar_t& ch : this->_needle) ch = this->_fold[ch];
+		build_shifts(this->_fold, this->_needle, this->_shift, this->_rshift);
+		if (!this->_needle.empty()) {
+			this->_numAsciiFirst = ascii_first(this->_fold, this->_needle, this->_asciiFirst);
+		}
+	}
+
+	size_t length() const noexcept { return this->_needle.length(); }
+
+	// Finds the first occurrence at or after offset.
+	size_t find_in(std::wstring_view haystack, size_t offset = 0) const noexcept {
+		if (this->_needle.empty()) return offset <= haystack.length() ? offset : npos;
+		if (first_char_pays(this->_numAsciiFirst, this->_needle.length())) {
+			return find_first_char(this->_fold, haystack, this->_needle,
+				this->_asciiFirst, this->_numAsciiFirst, offset);
+		}
+		return find_horspool(this->_fold, haystack, this->_needle, this->_shift, offset);
+	}
+
+	// Finds the last occurrence which begins at or before offset.
+	size_t rfind_in(std::wstring_view haystack, size_t offset = npos) const noexcept {
+		if (this->_needle.empty()) return offset < haystack.length() ? offset : haystack.length();
+		return rfind_horspool(this->_fold, haystack, this->_needle, this->_rshift, offset);
+	}
+
+	// One-shot search, the needle is folded on the fly and tables are built on the stack only if worth it.
+	static size_t find(std::wstring_view haystack, std::wstring_view needle, size_t offset = 0) noexcept {
+		if (needle.empty()) return offset <= haystack.length() ? offset : npos;
+		if (offset >= haystack.length() || needle.length() > haystack.length() - offset) return npos;
+
+		const wchar_t* fold = str_fold_table();
+		wchar_t asciiFirst[2]{};
+		size_t numAsciiFirst = ascii_first(fold, needle, asciiFirst);
+		if (first_char_pays(numAsciiFirst, needle.length())) {
+			return find_first_char(fold, haystack, needle, asciiFirst, numAsciiFirst, offset);
+		}
+
+		if (needle.length() < 3 || haystack.length() - offset < 256) { // not worth building the tables
+			for (size_t pos = offset; pos + needle.length() <= haystack.length(); ++pos) {
+				if (matches(fold, haystack.data() + pos, needle)) return pos;
+			}
+			return npos;
+		}
+		size_t shift[256], rshift[256];
+		build_shifts(fold, needle, shift, rshift);
+		return find_horspool(fold, haystack, needle, shift, offset);
+	}
+
+	// One-shot reverse search, finds the last occurrence which begins at or before offset.
+	static size_t rfind(std::wstring_view haystack, std::wstring_view needle, size_t offset = npos) noexcept {
+		if (needle.empty()) return offset < haystack.length() ? offset : haystack.length();
+		if (needle.length() > haystack.length()) return npos;
+
+		const wchar_t* fold = str_fold_table();
+		size_t pos = haystack.length() - needle.length();
+		if (offset < pos) pos = offset;
+
+		if (needle.length() < 3 || pos < 256) { // not worth building the tables
+			for (;;) {
+				if (matches(fold, haystack.data() + pos, needle)) return pos;
+				if (!pos--) return npos;
+			}
+		}
+		size_t shift[256], rshift[256];
+		build_shifts(fold, needle, shift, rshift);
+		return rfind_horspool(fold, haystack, needle, rshift, offset);
+	}
+
+private:
+	static bool matches(const wchar_t* fold, const wchar_t* pHay, std::wstring_view needle) noexcept {
+		for (size_t i = 0; i < needle.length(); ++i) {
+			if (fold[pHay[i]] != fold[needle[i]]) return false;
+		}
+		return true;
+	}
+
+	static void build_shifts(const wchar_t* fold, std::wstring_view needle, size_t* shift, size_t* rshift) noexcept {
+		size_t m = needle.length();
+		for (size_t c = 0; c < 256; ++c) {
+			shift[c] = rshift[c] = m;
+		}
+		for (size_t i = 0; i + 1 < m; ++i) { // later chars overwrite with smaller shifts
+			shift[fold[needle[i]] & 0xFF] = m - 1 - i;
+		}
+		for (size_t i = m; i-- > 1; ) {
+			rshift[fold[needle[i]] & 0xFF] = i;
+		}
+	}
+
+	static bool first_char_pays(size_t numAsciiFirst, size_t needleLen) noexcept {
+		// The scan filters only ASCII candidates, so a non-ASCII first char would stop at every non-ASCII char.
+		return numAsciiFirst && numAsciiFirst <= 2 && needleLen < _HORSPOOL_MIN_LEN;
+	}
+
+	static size_t ascii_first(const wchar_t* fold, std::wstring_view needle, wchar_t* asciiFirst) noexcept {
+		// Collects the ASCII chars which fold into the first needle char; more than 2 disables the fast path.
+		size_t count = 0;
+		wchar_t first = fold[needle[0]];
+		for (wchar_t c = 0; c < 0x80; ++c) {
+			if (fold[c] == first) {
+				if (count == 2) return 3;
+				asciiFirst[count++] = c;
+			}
+		}
+		return count;
+	}
+
+	static size_t find_first_char(const wchar_t* fold, std::wstring_view haystack, std::wstring_view needle,
+		const wchar_t* asciiFirst, size_t numAsciiFirst, size_t offset) noexcept
+	{
+		// Candidates are the ASCII chars which fold into the first needle char, and any non-ASCII char.
+		if (offset >= haystack.length() || needle.length() > haystack.length() - offset) return npos;
+		const wchar_t* pHay = haystack.data();
+		size_t lastPos = haystack.length() - needle.length();
+		wchar_t first = fold[needle[0]];
+		size_t pos = offset;
+
+#ifdef WINLAMB_SSE2
+		const __m128i c1 = _mm_set1_epi16(static_cast<short>(numAsciiFirst > 0 ? asciiFirst[0] : 0xFFFF));
+		const __m128i c2 = _mm_set1_epi16(static_cast<short>(numAsciiFirst > 1 ? asciiFirst[1] : 0xFFFF));
+		const __m128i highMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+		const __m128i zero = _mm_setzero_si128();
+
+		while (pos + 8 <= lastPos + 1) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pHay + pos));
+			__m128i cand = _mm_or_si128(
+				_mm_or_si128(_mm_cmpeq_epi16(v, c1), _mm_cmpeq_epi16(v, c2)),
+				_mm_andnot_si128(_mm_cmpeq_epi16(_mm_and_si128(v, highMask), zero), _mm_set1_epi16(-1))); // non-ASCII
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(cand));
+			while (mask) {
+				unsigned i = simd::first_bit(mask) / 2; // 2 mask bits per char
+				if (fold[pHay[pos + i]] == first && matches(fold, pHay + pos + i, needle)) {
+					return pos + i;
+				}
+				mask &= ~(3u << (i * 2));
+			}
+			pos += 8;
+		}
+#endif
+		for (; pos <= lastPos; ++pos) {
+			if (fold[pHay[pos]] == first && matches(fold, pHay + pos, needle)) return pos;
+		}
+		return npos;
+	}
+
+	static size_t find_horspool(const wchar_t* fold, std::wstring_view haystack, std::wstring_view needle,
+		const size_t* shift, size_t offset) noexcept
+	{
+		size_t m = needle.length();
+		if (offset >= haystack.length() || m > haystack.length() - offset) return npos;
+		wchar_t last = fold[needle[m - 1]];
+
+		for (size_t pos = offset; pos + m <= haystack.length(); ) {
+			wchar_t ch = fold[haystack[pos + m - 1]];
+			if (ch == last && matches(fold, haystack.data() + pos, needle.substr(0, m - 1))) {
+				return pos;
+			}
+			pos += shift[ch & 0xFF];
+		}
+		return npos;
+	}
+
+	static size_t rfind_horspool(const wchar_t* fold, std::wstring_view haystack, std::wstring_view needle,
+		const size_t* rshift, size_t offset) noexcept
+	{
+		size_t m = needle.length();
+		if (m > haystack.length()) return npos;
+		size_t pos = haystack.length() - m;
+		if (offset < pos) pos = offset;
+		wchar_t first = fold[needle[0]];
+
+		for (;;) {
+			wchar_t ch = fold[haystack[pos]];
+			if (ch == first && matches(fold, haystack.data() + pos + 1, needle.substr(1))) {
+				return pos;
+			}
+			size_t step = rshift[ch & 0xFF];
+			if (step > pos) return npos;
+			pos -= step;
+		}
+	}
+};
+
+}//namespace _wli
+}//namespace wl
@@ -6,9 +6,12 @@
  */
 
 #pragma once
+#include <algorithm>
 #include <cwctype>
 #include <string>
+#include <vector>
 #include <Windows.h>
+#include "str_utf.h"
 
 namespace wl {
 namespace _wli {
@@ -38,44 +41,103 @@ inline std::wstring format_raw(size_t strFormatLen, const wchar_t* strFormat, co
 	return ret;
 }
 
-inline bool ends_begins_first_check(const std::wstring& s, const wchar_t* what, size_t& whatLen) noexcept {
-	if (s.empty()) return false;
-
-	whatLen = lstrlenW(what);
-	if (!whatLen || whatLen > s.length()) {
-		return false;
-	}
-	return true;
-}
-
 inline std::wstring parse_ascii(const BYTE* data, size_t sz) {
 	std::wstring ret;
 	if (data && sz) {
+		const BYTE* pNull = static_cast<const BYTE*>(memchr(data, 0, sz));
+		if (pNull) sz = pNull - data; // stop at terminating null
+
 		ret.resize(sz);
 		for (size_t i = 0; i < sz; ++i) {
-			if (!data[i]) { // found terminating null
-				ret.resize(i);
-				return ret;
-			}
 			ret[i] = static_cast<wchar_t>(data[i]); // raw conversion
 		}
 	}
-	return ret; // data didn't have a terminating null
+	return ret;
 }
 
 inline std::wstring parse_encoded(const BYTE* data, size_t sz, UINT codePage) {
+	// Converted text never has more chars than the source has bytes, so the output
+	// buffer is allocated once and the conversion is done in a single pass.
 	std::wstring ret;
 	if (data && sz) {
-		int neededLen = MultiByteToWideChar(codePage, 0, reinterpret_cast<const char*>(data),
-			static_cast<int>(sz), nullptr, 0);
-		ret.resize(neededLen);
-		MultiByteToWideChar(codePage, 0, reinterpret_cast<const char*>(data),
-			static_cast<int>(sz), &ret[0], neededLen);
-		ret.resize( lstrlenW(ret.c_str()) ); // trim_nulls()
+		ret.resize(sz);
+		if (codePage == CP_UTF8) {
+			ret.resize(str_utf::utf8_to_utf16(data, sz, &ret[0]));
+		} else {
+			const BYTE* pNull = static_cast<const BYTE*>(memchr(data, 0, sz));
+			if (pNull) sz = pNull - data; // stop at terminating null
+
+			int convLen = sz ? MultiByteToWideChar(codePage, 0, reinterpret_cast<const char*>(data),
+				static_cast<int>(sz), &ret[0], static_cast<int>(sz)) : 0;
+			ret.resize(convLen);
+		}
+	}
+	return ret;
+}
+
+// Decodes into an existing string, reusing its memory; code page zero is a raw conversion.
+// Unlike parse_ascii and parse_encoded, nulls are not searched for.
+inline void decode_into(std::wstring& dest, const BYTE* data, size_t sz, UINT codePage) {
+	dest.resize(sz); // converted text never has more chars than the source has bytes
+	if (!sz) return;
+
+	if (!codePage) {
+		for (size_t i = 0; i < sz; ++i) {
+			dest[i] = static_cast<wchar_t>(data[i]);
+		}
+	} else if (codePage == CP_UTF8) {
+		dest.resize(str_utf::utf8_to_utf16(data, sz, &dest[0]));
+	} else {
+		dest.resize(MultiByteToWideChar(codePage, 0, reinterpret_cast<const char*>(data),
+			static_cast<int>(sz), &dest[0], static_cast<int>(sz)));
+	}
+}
+
+inline std::wstring& trim_at_null(std::wstring& s) {
+	s.erase(std::find(s.begin(), s.end(), L'\0'), s.end());
+	return s;
+}
+
+inline std::wstring parse_utf16(const BYTE* data, size_t sz, bool bigEndian) {
+	std::wstring ret;
+	if (data && sz >= sizeof(wchar_t)) {
+		ret.resize(sz / sizeof(wchar_t)); // a trailing odd byte is ignored
+		if (bigEndian) {
+			str_utf::utf16_swap(data, ret.length(), &ret[0]);
+		} else {
+			memcpy(&ret[0], data, ret.length() * sizeof(wchar_t)); // native Windows encoding
+		}
+		trim_at_null(ret);
+	}
+	return ret;
+}
+
+inline std::wstring parse_utf32(const BYTE* data, size_t sz, bool bigEndian) {
+	std::wstring ret;
+	if (data && sz >= 4) {
+		ret.resize((sz / 4) * 2); // worst case, all chars need surrogate pairs
+		ret.resize(str_utf::utf32_to_utf16(data, sz / 4, bigEndian, &ret[0]));
+		trim_at_null(ret);
 	}
 	return ret;
 }
 
+inline void append_utf8(std::vector<BYTE>& buf, const wchar_t* s, size_t len) {
+	// Converts in blocks, so the buffer only grows as much as needed, with no size probing.
+	const size_t BLOCK = 16 * 1024; // in chars
+	while (len) {
+		size_t blockLen = len < BLOCK ? len : BLOCK;
+		if (blockLen < len && s[blockLen - 1] >= 0xD800 && s[blockLen - 1] <= 0xDBFF) {
+			++blockLen; // don't split a surrogate pair
+		}
+		size_t prevSz = buf.size();
+		buf.resize(prevSz + blockLen * 3); // worst case
+		buf.resize(prevSz + str_utf::utf16_to_utf8(s, blockLen, &buf[prevSz]));
+		s += blockLen;
+		len -= blockLen;
+	}
+}
+
 }//namespace str_priv
 }//namespace wli
 }//namespace wl
@@ -0,0 +1,188 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <cwctype>
+#include <iterator>
+#include <string_view>
+#include "simd.h"
+
+namespace wl {
+namespace _wli {
+namespace str_split {
+
+// Finds the first occurrence of any of the two chars, returns the string length if not found.
+inline size_t find_any_of(std::wstring_view s, size_t pos, wchar_t ch1, wchar_t ch2) noexcept {
+	const wchar_t* p = s.data();
+#ifdef WINLAMB_SSE2
+	const __m128i v1 = _mm_set1_epi16(static_cast<short>(ch1));
+	const __m128i v2 = _mm_set1_epi16(static_cast<short>(ch2));
+	for (; pos + 8 <= s.length(); pos += 8) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + pos));
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi16(v, v1), _mm_cmpeq_epi16(v, v2))));
+		if (mask) return pos + simd::first_bit(mask) / 2; // 2 mask bits per char
+	}
+#endif
+	for (; pos < s.length(); ++pos) {
+		if (p[pos] == ch1 || p[pos] == ch2) return pos;
+	}
+	return s.length();
+}
+
+// Finds the first occurrence of any of the two bytes, returns the string length if not found.
+inline size_t find_any_of(std::string_view s, size_t pos, char ch1, char ch2) noexcept {
+	const char* p = s.data();
+#ifdef WINLAMB_SSE2
+	const __m128i v1 = _mm_set1_epi8(ch1);
+	const __m128i v2 = _mm_set1_epi8(ch2);
+	for (; pos + 16 <= s.length(); pos += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + pos));
+		unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(v, v1), _mm_cmpeq_epi8(v, v2))));
+		if (mask) return pos + simd::first_bit(mask);
+	}
+#endif
+	for (; pos < s.length(); ++pos) {
+		if (p[pos] == ch1 || p[pos] == ch2) return pos;
+	}
+	return s.length();
+}
+
+// Splits at a delimiter; a single-char delimiter is searched with SIMD.
+class by_delimiter final {
+private:
+	std::wstring_view _delim;
+	bool              _skipLastEmpty;
+
+public:
+	by_delimiter(std::wstring_view delimiter, bool skipLastEmpty = false) noexcept :
+		_delim{delimiter}, _skipLastEmpty{skipLastEmpty} { }
+
+	bool next(std::wstring_view src, size_t& pos, std::wstring_view& token) const noexcept {
+		if (pos > src.length() || src.empty()) return false; // past the last token
+		if (this->_skipLastEmpty && pos == src.length()) return false;
+
+		size_t found = src.length();
+		if (this->_delim.empty()) {
+			// no delimiter, the whole string is one single token
+		} else if (this->_delim.length() == 1) {
+			found = find_any_of(src, pos, this->_delim[0], this->_delim[0]);
+		} else {
+			for (size_t head = pos; ; ++head) {
+				head = find_any_of(src, head, this->_delim[0], this->_delim[0]);
+				if (head + this->_delim.length() > src.length()) break;
+				if (src.compare(head, this->_delim.length(), this->_delim) == 0) {
+					found = head;
+					break;
+				}
+			}
+		}
+
+		if (found == src.length()) { // last token
+			token = src.substr(pos);
+			pos = src.length() + 1;
+		} else {
+			token = src.substr(pos, found - pos);
+			pos = found + this->_delim.length();
+		}
+		return true;
+	}
+};
+
+// Splits at any CR, LF or CR+LF linebreak.
+class by_linebreak final {
+public:
+	bool next(std::wstring_view src, size_t& pos, std::wstring_view& token) const noexcept {
+		if (pos > src.length() || src.empty()) return false;
+
+		size_t found = find_any_of(src, pos, L'\r', L'\n');
+		if (found == src.length()) { // last line
+			token = src.substr(pos);
+			pos = src.length() + 1;
+		} else {
+			token = src.substr(pos, found - pos);
+			pos = found + ((src[found] == L'\r' && found + 1 < src.length() && src[found + 1] == L'\n') ? 2 : 1);
+		}
+		return true;
+	}
+};
+
+// Splits at spaces, tokens may be enclosed in double quotes.
+class by_quotes final {
+public:
+	bool next(std::wstring_view src, size_t& pos, std::wstring_view& token) const noexcept {
+		while (pos < src.length() && src[pos] != L'\"' && std::iswspace(src[pos])) ++pos; // skip white space
+		if (pos >= src.length()) return false;
+
+		if (src[pos] == L'\"') { // begin of quoted string
+			size_t iBase = pos + 1; // 1st char of string
+			size_t iClose = find_any_of(src, iBase, L'\"', L'\"');
+			if (iClose == src.length()) { // won't compute open-quoted
+				pos = src.length();
+				return false;
+			}
+			token = src.substr(iBase, iClose - iBase);
+			pos = iClose + 1; // 1st char after closing quote
+		} else { // 1st char of non-quoted string
+			size_t iBase = pos++;
+			while (pos < src.length() && !std::iswspace(src[pos]) && src[pos] != L'\"') ++pos;
+			token = src.substr(iBase, pos - iBase);
+		}
+		return true;
+	}
+};
+
+// Lazy range of tokens, each one a view to the source string; nothing is allocated.
+template<typename splitterT>
+class tokens final {
+private:
+	std::wstring_view _src;
+	splitterT         _splitter;
+
+public:
+	class iterator final {
+	private:
+		const tokens*     _owner = nullptr;
+		size_t            _pos = 0;
+		std::wstring_view _cur;
+
+	public:
+		using iterator_category = std::input_iterator_tag;
+		using value_type        = std::wstring_view;
+		using difference_type   = std::ptrdiff_t;
+		using pointer           = const std::wstring_view*;
+		using reference         = const std::wstring_view&;
+
+		iterator() = default; // end of range
+		explicit iterator(const tokens* owner) noexcept : _owner{owner} { this->operator++(); }
+
+		const std::wstring_view& operator*() const noexcept  { return this->_cur; }
+		const std::wstring_view* operator->() const noexcept { return &this->_cur; }
+		bool operator==(const iterator& other) const noexcept { return this->_owner == other._owner && this->_pos == other._pos; }
+		bool operator!=(const iterator& other) const noexcept { return !this->operator==(other); }
+
+		iterator& operator++() noexcept {
+			if (!this->_owner->_splitter.next(this->_owner->_src, this->_pos, this->_cur)) {
+				this->_owner = nullptr; // reached the end
+				this->_pos = 0;
+			}
+			return *this;
+		}
+
+		iterator operator++(int) noexcept { iterator tmp = *this; this->operator++(); return tmp; }
+	};
+
+	tokens(std::wstring_view src, splitterT splitter) noexcept : _src{src}, _splitter{splitter} { }
+
+	iterator begin() const noexcept { return iterator{this}; }
+	iterator end() const noexcept   { return {}; }
+};
+
+}//namespace str_split
+}//namespace _wli
+}//namespace wl
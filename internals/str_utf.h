@@ -0,0 +1,256 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <Windows.h>
+#include "simd.h"
+
+namespace wl {
+namespace _wli {
+namespace str_utf {
+
+const wchar_t REPLACEMENT_CHAR = 0xFFFD;
+
+// Decodes one UTF-8 sequence whose lead byte is >= 0x80, advancing the pointer.
+// On an ill-formed sequence, returns false and skips its maximal subpart.
+inline bool decode_multibyte(const BYTE*& p, const BYTE* pEnd, char32_t& codePoint) noexcept {
+	// https://www.unicode.org/versions/Unicode11.0.0/ch03.pdf#G7404
+	BYTE lead = *p++;
+	size_t numTrail = 0;
+	BYTE lo = 0x80, hi = 0xBF; // valid range of the first trailing byte
+
+	if (lead >= 0xC2 && lead <= 0xDF) {
+		numTrail = 1;
+		codePoint = lead & 0x1F;
+	} else if (lead >= 0xE0 && lead <= 0xEF) {
+		numTrail = 2;
+		codePoint = lead & 0x0F;
+		if (lead == 0xE0) lo = 0xA0; // overlong
+		else if (lead == 0xED) hi = 0x9F; // surrogates
+	} else if (lead >= 0xF0 && lead <= 0xF4) {
+		numTrail = 3;
+		codePoint = lead & 0x07;
+		if (lead == 0xF0) lo = 0x90; // overlong
+		else if (lead == 0xF4) hi = 0x8F; // beyond U+10FFFF
+	} else {
+		return false; // stray continuation byte, or C0, C1, F5..FF
+	}
+
+	for (size_t i = 0; i < numTrail; ++i) {
+		if (p == pEnd || *p < lo || *p > hi) return false; // truncated or ill-formed
+		codePoint = (codePoint << 6) | (*p++ & 0x3F);
+		lo = 0x80; hi = 0xBF; // following trailing bytes have the full range
+	}
+	return true;
+}
+
+// Result of scanning a buffer for UTF-8 well-formedness.
+enum class utf8_scan { ASCII, VALID, INVALID };
+
+// Scans the buffer, stopping at the first ill-formed sequence. If a multibyte sequence
+// is truncated by the end of the buffer, it's considered valid only if allowTruncated is set.
+inline utf8_scan validate_utf8(const BYTE* data, size_t sz, bool allowTruncated) noexcept {
+	const BYTE* p = data;
+	const BYTE* pEnd = data + sz;
+	bool hasMultibyte = false;
+
+	for (;;) {
+		// Skip ASCII blocks, 64 bytes per step.
+#ifdef WINLAMB_AVX2
+		while (pEnd - p >= 64) {
+			__m256i v = _mm256_or_si256(
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)),
+				_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32)));
+			if (_mm256_movemask_epi8(v)) break;
+			p += 64;
+		}
+#elif defined(WINLAMB_SSE2)
+		while (pEnd - p >= 64) {
+			__m128i v = _mm_or_si128(
+				_mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)),
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16))),
+				_mm_or_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32)),
+					_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48))));
+			if (_mm_movemask_epi8(v)) break;
+			p += 64;
+		}
+#endif
+		while (p < pEnd && *p < 0x80) ++p; // remaining ASCII chars, up to 63
+		if (p == pEnd) break;
+
+		char32_t codePoint = 0;
+		BYTE lead = *p;
+		if (!decode_multibyte(p, pEnd, codePoint)) {
+			if (allowTruncated && p == pEnd && lead >= 0xC2 && lead <= 0xF4) break; // valid sequence cut by the end of the sample
+			return utf8_scan::INVALID;
+		}
+		hasMultibyte = true;
+	}
+	return hasMultibyte ? utf8_scan::VALID : utf8_scan::ASCII;
+}
+
+// Converts UTF-8 to UTF-16 in a single pass, stopping at the first null byte.
+// Ill-formed sequences become U+FFFD. Output never has more units than input bytes,
+// so dest must have room for sz chars. Returns the number of chars written.
+inline size_t utf8_to_utf16(const BYTE* src, size_t sz, wchar_t* dest) noexcept {
+	const BYTE* p = src;
+	const BYTE* pEnd = src + sz;
+	wchar_t* d = dest;
+
+	for (;;) {
+		// ASCII fast path: widen whole blocks while there are no high bytes and no nulls.
+#ifdef WINLAMB_AVX2
+		while (pEnd - p >= 32) {
+			__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+			unsigned stop = static_cast<unsigned>(_mm256_movemask_epi8(v)) |
+				static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())));
+			if (stop) break;
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d),
+				_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(d + 16),
+				_mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)));
+			p += 32;
+			d += 32;
+		}
+#endif
+#ifdef WINLAMB_SSE2
+		const __m128i zero = _mm_setzero_si128();
+		while (pEnd - p >= 16) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			unsigned stop = static_cast<unsigned>(_mm_movemask_epi8(v)) |
+				static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)));
+			if (stop) {
+				for (unsigned i = simd::first_bit(stop); i > 0; --i) { // ASCII chars before the stop
+					*d++ = *p++;
+				}
+				break;
+			}
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d), _mm_unpacklo_epi8(v, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d + 8), _mm_unpackhi_epi8(v, zero));
+			p += 16;
+			d += 16;
+		}
+#endif
+		if (p == pEnd || !*p) break; // end of data, or terminating null
+
+		if (*p < 0x80) {
+			*d++ = *p++;
+			continue;
+		}
+
+		char32_t codePoint = 0;
+		if (!decode_multibyte(p, pEnd, codePoint)) {
+			*d++ = REPLACEMENT_CHAR;
+		} else if (codePoint < 0x10000) {
+			*d++ = static_cast<wchar_t>(codePoint);
+		} else { // needs a surrogate pair
+			codePoint -= 0x10000;
+			*d++ = static_cast<wchar_t>(0xD800 + (codePoint >> 10));
+			*d++ = static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF));
+		}
+	}
+	return d - dest;
+}
+
+// Converts UTF-16 to UTF-8 in a single pass, embedded nulls are kept.
+// Unpaired surrogates become U+FFFD. Dest must have room for 3 * len bytes.
+// Returns the number of bytes written.
+inline size_t utf16_to_utf8(const wchar_t* src, size_t len, BYTE* dest) noexcept {
+	const wchar_t* p = src;
+	const wchar_t* pEnd = src + len;
+	BYTE* d = dest;
+
+	while (p < pEnd) {
+#ifdef WINLAMB_SSE2
+		// ASCII fast path: narrow 16 chars at a time while all of them are below 0x80.
+		const __m128i highMask = _mm_set1_epi16(static_cast<short>(0xFF80));
+		const __m128i zero = _mm_setzero_si128();
+		while (pEnd - p >= 16) {
+			__m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+			__m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+			__m128i high = _mm_or_si128(_mm_and_si128(v1, highMask), _mm_and_si128(v2, highMask));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(high, zero)) != 0xFFFF) break;
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(d), _mm_packus_epi16(v1, v2));
+			p += 16;
+			d += 16;
+		}
+		if (p == pEnd) break;
+#endif
+		char32_t ch = *p++;
+		if (ch < 0x80) {
+			*d++ = static_cast<BYTE>(ch);
+			continue;
+		} else if (ch < 0x800) {
+			*d++ = static_cast<BYTE>(0xC0 | (ch >> 6));
+			*d++ = static_cast<BYTE>(0x80 | (ch & 0x3F));
+			continue;
+		} else if (ch >= 0xD800 && ch <= 0xDFFF) {
+			if (ch <= 0xDBFF && p < pEnd && *p >= 0xDC00 && *p <= 0xDFFF) { // valid surrogate pair
+				ch = 0x10000 + ((ch - 0xD800) << 10) + (*p++ - 0xDC00);
+				*d++ = static_cast<BYTE>(0xF0 | (ch >> 18));
+				*d++ = static_cast<BYTE>(0x80 | ((ch >> 12) & 0x3F));
+				*d++ = static_cast<BYTE>(0x80 | ((ch >> 6) & 0x3F));
+				*d++ = static_cast<BYTE>(0x80 | (ch & 0x3F));
+				continue;
+			}
+			ch = REPLACEMENT_CHAR; // unpaired surrogate
+		}
+		*d++ = static_cast<BYTE>(0xE0 | (ch >> 12));
+		*d++ = static_cast<BYTE>(0x80 | ((ch >> 6) & 0x3F));
+		*d++ = static_cast<BYTE>(0x80 | (ch & 0x3F));
+	}
+	return d - dest;
+}
+
+// Copies UTF-16 chars from a possibly unaligned buffer, swapping the bytes of each one.
+inline void utf16_swap(const BYTE* src, size_t numChars, wchar_t* dest) noexcept {
+	size_t i = 0;
+#ifdef WINLAMB_AVX2
+	for (; i + 16 <= numChars; i += 16) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i * 2));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i),
+			_mm256_or_si256(_mm256_slli_epi16(v, 8), _mm256_srli_epi16(v, 8)));
+	}
+#endif
+#ifdef WINLAMB_SSE2
+	for (; i + 8 <= numChars; i += 8) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i),
+			_mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)));
+	}
+#endif
+	for (; i < numChars; ++i) {
+		dest[i] = static_cast<wchar_t>((src[i * 2] << 8) | src[i * 2 + 1]);
+	}
+}
+
+// Converts UTF-32 to UTF-16, from a possibly unaligned buffer. Invalid code points become
+// U+FFFD. Dest must have room for 2 * numUnits chars. Returns the number of chars written.
+inline size_t utf32_to_utf16(const BYTE* src, size_t numUnits, bool bigEndian, wchar_t* dest) noexcept {
+	wchar_t* d = dest;
+	for (size_t i = 0; i < numUnits; ++i, src += 4) {
+		char32_t codePoint = bigEndian ? // bytes are widened first, shifting an int into its sign bit is undefined
+			(char32_t{src[0]} << 24) | (char32_t{src[1]} << 16) | (char32_t{src[2]} << 8) | src[3] :
+			(char32_t{src[3]} << 24) | (char32_t{src[2]} << 16) | (char32_t{src[1]} << 8) | src[0];
+
+		if (codePoint < 0x10000) {
+			*d++ = (codePoint >= 0xD800 && codePoint <= 0xDFFF) ?
+				REPLACEMENT_CHAR : static_cast<wchar_t>(codePoint); // surrogates aren't valid code points
+		} else if (codePoint <= 0x10FFFF) {
+			codePoint -= 0x10000;
+			*d++ = static_cast<wchar_t>(0xD800 + (codePoint >> 10));
+			*d++ = static_cast<wchar_t>(0xDC00 + (codePoint & 0x3FF));
+		} else {
+			*d++ = REPLACEMENT_CHAR;
+		}
+	}
+	return d - dest;
+}
+
+}//namespace str_utf
+}//namespace _wli
+}//namespace wl
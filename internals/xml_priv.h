@@ -0,0 +1,67 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <string>
+#include <string_view>
+#include <Windows.h>
+#include "file_mapped_view.h"
+#include "../str.h"
+
+namespace wl {
+namespace _wli {
+namespace xml_priv {
+
+// Text of an XML file, viewed straight from the mapped memory whenever possible.
+struct file_text final {
+	enum class form { UTF8, UTF16, CONVERTED };
+
+	form              how = form::UTF8;
+	std::string_view  utf8;      // UTF-8 or ASCII, past the BOM
+	std::wstring_view utf16;     // UTF-16LE, past the BOM
+	std::wstring      converted; // any other encoding
+};
+
+// Finds out how the file content must be parsed, scanning only the BOM and a sample.
+// UTF-16 with no BOM is recognized by the zero byte of the first char, which must be ASCII in an XML file.
+inline file_text read_text(const file_mapped_view& content) {
+	file_text ret;
+	const BYTE* data = content.data();
+	size_t sz = content.size();
+	str::encoding_info enc = str::get_encoding(data, sz, 64 * 1024); // not a whole pass over big files
+
+	if (!enc.bomSize && sz >= 2 && !data[0] != !data[1]) {
+		if (data[1]) { // big endian
+			ret.how = file_text::form::CONVERTED;
+			ret.converted = str_priv::parse_utf16(data, sz, true);
+		} else { // mapped memory is aligned
+			ret.how = file_text::form::UTF16;
+			ret.utf16 = {reinterpret_cast<const wchar_t*>(data), sz / sizeof(wchar_t)};
+		}
+		return ret;
+	}
+
+	switch (enc.encType) {
+	case str::encoding::UNKNOWN:
+	case str::encoding::ASCII:
+	case str::encoding::UTF8:
+		ret.utf8 = {reinterpret_cast<const char*>(data + enc.bomSize), sz - enc.bomSize};
+		break;
+	case str::encoding::UTF16LE:
+		ret.how = file_text::form::UTF16;
+		ret.utf16 = str::to_wstring_view(data, sz);
+		break;
+	default:
+		ret.how = file_text::form::CONVERTED;
+		ret.converted = str::to_wstring(data, sz);
+	}
+	return ret;
+}
+
+}//namespace xml_priv
+}//namespace _wli
+}//namespace wl
@@ -0,0 +1,365 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace wl {
+namespace _wli {
+
+// Pull parser which walks XML text in place, with no copies: names, attributes and texts are views to the source.
+// Works over UTF-8 (char) or UTF-16 (wchar_t) text; DTDs, comments and processing instructions are skipped.
+template<typename charT>
+class xml_pull final {
+public:
+	using viewT = std::basic_string_view<charT>;
+
+	enum class token { START_ELEM, END_ELEM, TEXT, END_DOC };
+
+	struct attr final {
+		viewT name;
+		viewT value; // raw, entities not yet replaced
+	};
+
+private:
+	viewT              _src;
+	size_t             _pos = 0;
+	token              _tok = token::END_DOC;
+	viewT              _name;
+	viewT              _text;
+	bool               _isCdata = false;
+	bool               _pendingEnd = false; // element was self-closed, its end is the next token
+	bool               _rootDone = false;
+	std::vector<attr>  _attrs; // memory reused across elements
+	std::vector<viewT> _stack; // names of the open elements
+
+public:
+	explicit xml_pull(viewT src) noexcept : _src{src} {
+		if constexpr (sizeof(charT) == 1) {
+			if (this->_starts_with("\xEF\xBB\xBF")) this->_pos = 3; // BOM of UTF-8
+		} else {
+			if (!this->_src.empty() && this->_src[0] == charT(0xFEFF)) this->_pos = 1; // BOM of UTF-16
+		}
+	}
+
+	token                    current() const noexcept  { return this->_tok; }
+	viewT                    name() const noexcept     { return this->_name; } // element name, at START_ELEM and END_ELEM
+	const std::vector<attr>& attrs() const noexcept    { return this->_attrs; } // at START_ELEM
+	viewT                    text() const noexcept     { return this->_text; } // raw, at TEXT
+	bool                     is_cdata() const noexcept { return this->_isCdata; } // TEXT is a CDATA section, with no entities
+	size_t                   depth() const noexcept    { return this->_stack.size(); } // open elements, including current one
+	size_t                   offset() const noexcept   { return this->_pos; } // chars already consumed
+
+	// Moves to the next token; throws std::runtime_error on malformed XML.
+	token next() {
+		if (this->_pendingEnd) {
+			this->_pendingEnd = false;
+			this->_stack.pop_back();
+			this->_rootDone = this->_stack.empty();
+			return this->_tok = token::END_ELEM; // name is still the same
+		}
+
+		for (;;) {
+			if (this->_pos >= this->_src.length()) {
+				if (!this->_stack.empty()) this->_fail("unexpected end of document, element not closed");
+				if (!this->_rootDone) this->_fail("no root element");
+				return this->_tok = token::END_DOC;
+			}
+
+			if (this->_src[this->_pos] != charT('<')) {
+				size_t idxLt = this->_src.find(charT('<'), this->_pos);
+				if (idxLt == viewT::npos) idxLt = this->_src.length();
+				viewT text = this->_src.substr(this->_pos, idxLt - this->_pos);
+				this->_pos = idxLt;
+
+				if (this->_stack.empty()) { // outside the root element
+					if (!_is_blank(text)) this->_fail("text outside root element");
+					continue;
+				}
+				this->_text = text;
+				this->_isCdata = false;
+				return this->_tok = token::TEXT;
+			}
+
+			if (this->_starts_with("<?")) {
+				this->_skip_past(2, "?>");
+			} else if (this->_starts_with("<!--")) {
+				this->_skip_past(4, "-->");
+			} else if (this->_starts_with("<![CDATA[")) {
+				if (this->_stack.empty()) this->_fail("CDATA outside root element");
+				size_t idxBegin = this->_pos + 9;
+				this->_skip_past(9, "]]>");
+				this->_text = this->_src.substr(idxBegin, this->_pos - 3 - idxBegin);
+				this->_isCdata = true;
+				return this->_tok = token::TEXT;
+			} else if (this->_starts_with("<!")) {
+				this->_skip_doctype();
+			} else if (this->_starts_with("</")) {
+				this->_pos += 2;
+				this->_name = this->_read_name();
+				this->_skip_blanks();
+				this->_expect(charT('>'));
+				if (this->_stack.empty() || this->_stack.back() != this->_name) {
+					this->_fail("closing tag doesn't match opening tag");
+				}
+				this->_stack.pop_back();
+				this->_rootDone = this->_stack.empty();
+				return this->_tok = token::END_ELEM;
+			} else {
+				if (this->_rootDone) this->_fail("more than one root element");
+				++this->_pos;
+				this->_read_start_tag();
+				return this->_tok = token::START_ELEM;
+			}
+		}
+	}
+
+	// Skips the rest of the current element, including all its children.
+	void skip_element() {
+		if (this->_tok != token::START_ELEM) return;
+		size_t targetDepth = this->depth() - 1;
+		while (this->next() != token::END_ELEM || this->depth() != targetDepth) ;
+	}
+
+	// Replaces the entities of a raw text or attribute value, in place.
+	// Attribute values also have their line breaks and tabs replaced by spaces, as the XML spec says.
+	template<typename strCharT>
+	static void unescape(std::basic_string<strCharT>& s, bool isAttr = false) {
+		if (isAttr) {
+			for (strCharT& ch : s) {
+				if (ch == strCharT('\t') || ch == strCharT('\n') || ch == strCharT('\r')) ch = strCharT(' ');
+			}
+		}
+
+		size_t idxAmp = s.find(strCharT('&'));
+		if (idxAmp == std::basic_string<strCharT>::npos) return; // most common case, nothing to do
+
+		size_t dest = idxAmp;
+		for (size_t src = idxAmp; src < s.length(); ) {
+			if (s[src] != strCharT('&')) {
+				s[dest++] = s[src++];
+				continue;
+			}
+			size_t idxSemi = s.find(strCharT(';'), src);
+			if (idxSemi == std::basic_string<strCharT>::npos || idxSemi - src > 10) { // not an entity, kept as it is
+				s[dest++] = s[src++];
+				continue;
+			}
+
+			std::basic_string_view<strCharT> ent{s.data() + src + 1, idxSemi - src - 1};
+			unsigned long codePoint = _entity_code_point(ent);
+			if (!codePoint) { // unknown entity, kept as it is
+				s[dest++] = s[src++];
+				continue;
+			}
+			dest += _put_code_point(codePoint, &s[dest]); // never longer than the entity itself
+			src = idxSemi + 1;
+		}
+		s.resize(dest);
+	}
+
+private:
+	[[noreturn]] void _fail(const char* what) const {
+		throw std::runtime_error(std::string{"XML parsing failed at char "}
+			.append(std::to_string(this->_pos)).append(": ").append(what).append("."));
+	}
+
+	static bool _is_blank(charT ch) noexcept {
+		return ch == charT(' ') || ch == charT('\t') || ch == charT('\n') || ch == charT('\r');
+	}
+
+	static bool _is_blank(viewT s) noexcept {
+		for (charT ch : s) {
+			if (!_is_blank(ch)) return false;
+		}
+		return true;
+	}
+
+	bool _starts_with(const char* ascii) const noexcept {
+		size_t i = this->_pos;
+		for (; *ascii; ++ascii, ++i) {
+			if (i >= this->_src.length() || this->_src[i] != charT(*ascii)) return false;
+		}
+		return true;
+	}
+
+	// Skips the opener at the current position, then everything up to and including the closer.
+	void _skip_past(size_t openerLen, const char* ascii) {
+		charT first = charT(*ascii);
+		size_t len = 0;
+		while (ascii[len]) ++len;
+
+		for (size_t idx = this->_src.find(first, this->_pos + openerLen); idx != viewT::npos;
+			idx = this->_src.find(first, idx + 1))
+		{
+			this->_pos = idx;
+			if (this->_starts_with(ascii)) {
+				this->_pos += len;
+				return;
+			}
+		}
+		this->_pos = this->_src.length();
+		this->_fail("unexpected end of document");
+	}
+
+	void _skip_doctype() {
+		int brackets = 0; // internal subset is enclosed in brackets
+		for (size_t i = this->_pos + 2; i < this->_src.length(); ++i) {
+			charT ch = this->_src[i];
+			if (ch == charT('[')) {
+				++brackets;
+			} else if (ch == charT(']')) {
+				--brackets;
+			} else if (ch == charT('>') && brackets <= 0) {
+				this->_pos = i + 1;
+				return;
+			}
+		}
+		this->_pos = this->_src.length();
+		this->_fail("unexpected end of document in DOCTYPE");
+	}
+
+	void _skip_blanks() noexcept {
+		while (this->_pos < this->_src.length() && _is_blank(this->_src[this->_pos])) ++this->_pos;
+	}
+
+	void _expect(charT ch) {
+		if (this->_pos >= this->_src.length() || this->_src[this->_pos] != ch) {
+			this->_fail("unexpected char");
+		}
+		++this->_pos;
+	}
+
+	viewT _read_name() {
+		size_t idxBegin = this->_pos;
+		while (this->_pos < this->_src.length()) {
+			charT ch = this->_src[this->_pos];
+			if (_is_blank(ch) || ch == charT('>') || ch == charT('/') || ch == charT('=')
+				|| ch == charT('<') || ch == charT('"') || ch == charT('\'')) break;
+			++this->_pos;
+		}
+		if (this->_pos == idxBegin) this->_fail("name expected");
+		return this->_src.substr(idxBegin, this->_pos - idxBegin);
+	}
+
+	void _read_start_tag() {
+		this->_name = this->_read_name();
+		this->_attrs.clear();
+
+		for (;;) {
+			this->_skip_blanks();
+			if (this->_pos >= this->_src.length()) {
+				this->_fail("unexpected end of document in tag");
+			} else if (this->_src[this->_pos] == charT('>')) {
+				++this->_pos;
+				break;
+			} else if (this->_starts_with("/>")) {
+				this->_pos += 2;
+				this->_pendingEnd = true;
+				break;
+			}
+
+			attr newAttr;
+			newAttr.name = this->_read_name();
+			this->_skip_blanks();
+			this->_expect(charT('='));
+			this->_skip_blanks();
+			if (this->_pos >= this->_src.length()
+				|| (this->_src[this->_pos] != charT('"') && this->_src[this->_pos] != charT('\'')))
+			{
+				this->_fail("attribute value must be quoted");
+			}
+			charT quote = this->_src[this->_pos++];
+			size_t idxQuote = this->_src.find(quote, this->_pos);
+			if (idxQuote == viewT::npos) {
+				this->_pos = this->_src.length();
+				this->_fail("unexpected end of document in attribute value");
+			}
+			newAttr.value = this->_src.substr(this->_pos, idxQuote - this->_pos);
+			this->_pos = idxQuote + 1;
+			this->_attrs.emplace_back(newAttr);
+		}
+
+		this->_stack.emplace_back(this->_name);
+	}
+
+	template<typename strCharT>
+	static unsigned long _entity_code_point(std::basic_string_view<strCharT> ent) noexcept {
+		auto is = [&ent](const char* ascii) -> bool {
+			size_t i = 0;
+			for (; ascii[i]; ++i) {
+				if (i >= ent.length() || ent[i] != strCharT(ascii[i])) return false;
+			}
+			return i == ent.length();
+		};
+
+		if (is("lt"))   return '<';
+		if (is("gt"))   return '>';
+		if (is("amp"))  return '&';
+		if (is("quot")) return '"';
+		if (is("apos")) return '\'';
+
+		if (ent.length() < 2 || ent[0] != strCharT('#')) return 0;
+		bool isHex = ent[1] == strCharT('x');
+		unsigned long codePoint = 0;
+		for (size_t i = isHex ? 2 : 1; i < ent.length(); ++i) {
+			unsigned long ch = static_cast<unsigned long>(ent[i]), digit = 0;
+			if (ch >= '0' && ch <= '9') {
+				digit = ch - '0';
+			} else if (isHex && ch >= 'a' && ch <= 'f') {
+				digit = ch - 'a' + 10;
+			} else if (isHex && ch >= 'A' && ch <= 'F') {
+				digit = ch - 'A' + 10;
+			} else {
+				return 0;
+			}
+			codePoint = codePoint * (isHex ? 16 : 10) + digit;
+			if (codePoint > 0x10FFFF) return 0;
+		}
+		return codePoint;
+	}
+
+	// Writes the code point as UTF-8 or UTF-16, returns the number of chars written.
+	template<typename strCharT>
+	static size_t _put_code_point(unsigned long cp, strCharT* dest) noexcept {
+		if constexpr (sizeof(strCharT) == 1) {
+			if (cp < 0x80) {
+				dest[0] = static_cast<strCharT>(cp);
+				return 1;
+			} else if (cp < 0x800) {
+				dest[0] = static_cast<strCharT>(0xC0 | (cp >> 6));
+				dest[1] = static_cast<strCharT>(0x80 | (cp & 0x3F));
+				return 2;
+			} else if (cp < 0x10000) {
+				dest[0] = static_cast<strCharT>(0xE0 | (cp >> 12));
+				dest[1] = static_cast<strCharT>(0x80 | ((cp >> 6) & 0x3F));
+				dest[2] = static_cast<strCharT>(0x80 | (cp & 0x3F));
+				return 3;
+			}
+			dest[0] = static_cast<strCharT>(0xF0 | (cp >> 18));
+			dest[1] = static_cast<strCharT>(0x80 | ((cp >> 12) & 0x3F));
+			dest[2] = static_cast<strCharT>(0x80 | ((cp >> 6) & 0x3F));
+			dest[3] = static_cast<strCharT>(0x80 | (cp & 0x3F));
+			return 4;
+		}
+
+		if (cp < 0x10000 || sizeof(strCharT) > 2) {
+			dest[0] = static_cast<strCharT>(cp);
+			return 1;
+		}
+		cp -= 0x10000; // surrogate pair
+		dest[0] = static_cast<strCharT>(0xD800 | (cp >> 10));
+		dest[1] = static_cast<strCharT>(0xDC00 | (cp & 0x3FF));
+		return 2;
+	}
+};
+
+}//namespace _wli
+}//namespace wl
@@ -7,8 +7,12 @@
 
 #pragma once
 #include <stdexcept>
+#include <string_view>
 #include <vector>
+#include "internals/file_mapped_view.h"
+#include "internals/str_needle.h"
 #include "internals/str_priv.h"
+#include "internals/str_split.h"
 
 namespace wl {
 
@@ -26,37 +30,22 @@ inline std::wstring& trim_nulls(std::wstring& s) {
 	return s;
 }
 
+// Returns a view to the string without leading and trailing spaces, validated with std::iswspace.
+inline std::wstring_view trim_view(std::wstring_view s) noexcept {
+	size_t iFirst = 0, iPast = s.length(); // bounds of trimmed string
+	while (iFirst < iPast && std::iswspace(s[iFirst])) ++iFirst;
+	while (iPast > iFirst && std::iswspace(s[iPast - 1])) --iPast;
+	return s.substr(iFirst, iPast - iFirst);
+}
+
 // Trims the string using std::iswspace to validate spaces, in-place.
 inline std::wstring& trim(std::wstring& s) {
 	if (s.empty()) return s;
 	trim_nulls(s);
 
-	size_t len = s.length();
-	size_t iFirst = 0, iLast = len - 1; // bounds of trimmed string
-	bool onlySpaces = true; // our string has only spaces?
-
-	for (size_t i = 0; i < len; ++i) {
-		if (!std::iswspace(s[i])) {
-			iFirst = i;
-			onlySpaces = false;
-			break;
-		}
-	}
-	if (onlySpaces) {
-		s.clear();
-		return s;
-	}
-
-	for (size_t i = len; i-- > 0; ) {
-		if (!std::iswspace(s[i])) {
-			iLast = i;
-			break;
-		}
-	}
-
-	std::copy(s.begin() + iFirst, // move the non-space chars back
-		s.begin() + iLast + 1, s.begin());
-	s.resize(iLast - iFirst + 1); // trim container size
+	std::wstring_view trimmed = trim_view(s);
+	std::copy(trimmed.begin(), trimmed.end(), s.begin()); // move the non-space chars back
+	s.resize(trimmed.length()); // trim container size
 	return s;
 }
 
@@ -74,66 +63,109 @@ inline std::wstring format(const std::wstring& strFormat, const argsT&... args)
 		std::forward<const argsT&>(args)...);
 }
 
+// Compares two strings, case insensitive.
+inline bool eqi(std::wstring_view s, std::wstring_view what) noexcept {
+	// Same comparison of lstrcmpi, but with explicit lengths.
+	return CompareStringW(LOCALE_USER_DEFAULT, NORM_IGNORECASE,
+		s.data(), static_cast<int>(s.length()),
+		what.data(), static_cast<int>(what.length())) == CSTR_EQUAL; // str::eq() would be just operator==(), that's why there's no str::eq()
+}
+
 // Compares two strings, case insensitive.
 inline bool eqi(const std::wstring& s, const wchar_t* what) noexcept {
-	return !lstrcmpiW(s.c_str(), what); // str::eq() would be just operator==(), that's why there's no str::eq()
+	if (!what) return false; // like lstrcmpi, null is different from any string
+	return eqi(std::wstring_view{s}, std::wstring_view{what});
 }
 
 // Compares two strings, case insensitive.
 inline bool eqi(const std::wstring& s, const std::wstring& what) noexcept {
-	return eqi(s.c_str(), what.c_str());
+	return eqi(std::wstring_view{s}, std::wstring_view{what});
+}
+
+// Checks, case sensitive, if the string ends with the given text.
+inline bool ends_with(std::wstring_view s, std::wstring_view what) noexcept {
+	return !what.empty() && what.length() <= s.length()
+		&& s.substr(s.length() - what.length()) == what;
 }
 
 // Checks, case sensitive, if the string ends with the given text.
 inline bool ends_with(const std::wstring& s, const wchar_t* what) noexcept {
-	size_t whatLen = 0;
-	if (!_wli::str_priv::ends_begins_first_check(s, what, whatLen)) {
-		return false;
-	}
-	return !lstrcmpW(s.c_str() + s.length() - whatLen, what);
+	if (!what) return false;
+	return ends_with(std::wstring_view{s}, std::wstring_view{what});
+}
+
+// Checks, case insensitive, if the string ends with the given text.
+inline bool ends_withi(std::wstring_view s, std::wstring_view what) noexcept {
+	return !what.empty() && what.length() <= s.length()
+		&& eqi(s.substr(s.length() - what.length()), what);
 }
 
 // Checks, case insensitive, if the string ends with the given text.
 inline bool ends_withi(const std::wstring& s, const wchar_t* what) noexcept {
-	size_t whatLen = 0;
-	if (!_wli::str_priv::ends_begins_first_check(s, what, whatLen)) {
-		return false;
-	}
-	return !lstrcmpiW(s.c_str() + s.length() - whatLen, what);
+	if (!what) return false;
+	return ends_withi(std::wstring_view{s}, std::wstring_view{what});
+}
+
+// Checks, case sensitive, if the string begins with the given text.
+inline bool begins_with(std::wstring_view s, std::wstring_view what) noexcept {
+	return !what.empty() && what.length() <= s.length()
+		&& s.substr(0, what.length()) == what;
 }
 
 // Checks, case sensitive, if the string begins with the given text.
 inline bool begins_with(const std::wstring& s, const wchar_t* what) noexcept {
-	size_t whatLen = 0;
-	if (!_wli::str_priv::ends_begins_first_check(s, what, whatLen)) {
-		return false;
-	}
-	return !wcsncmp(s.c_str(), what, whatLen);
+	if (!what) return false;
+	return begins_with(std::wstring_view{s}, std::wstring_view{what});
+}
+
+// Checks, case insensitive, if the string begins with the given text.
+inline bool begins_withi(std::wstring_view s, std::wstring_view what) noexcept {
+	return !what.empty() && what.length() <= s.length()
+		&& !_wcsnicmp(s.data(), what.data(), what.length());
 }
 
 // Checks, case insensitive, if the string begins with the given text.
 inline bool begins_withi(const std::wstring& s, const wchar_t* what) noexcept {
-	size_t whatLen = 0;
-	if (!_wli::str_priv::ends_begins_first_check(s, what, whatLen)) {
-		return false;
-	}
-	return !_wcsnicmp(s.c_str(), what, whatLen);
+	if (!what) return false;
+	return begins_withi(std::wstring_view{s}, std::wstring_view{what});
+}
+
+// Converts the string to uppercase, in-place.
+inline std::wstring& upper_in_place(std::wstring& s) noexcept {
+	if (!s.empty()) CharUpperBuffW(&s[0], static_cast<DWORD>(s.length()));
+	return s;
+}
+
+// Converts the string to lowercase, in-place.
+inline std::wstring& lower_in_place(std::wstring& s) noexcept {
+	if (!s.empty()) CharLowerBuffW(&s[0], static_cast<DWORD>(s.length()));
+	return s;
 }
 
 // Returns a new string converted to uppercase.
-inline std::wstring upper(const std::wstring& s) {
-	std::wstring ret = s;
-	CharUpperBuffW(&ret[0], static_cast<DWORD>(ret.length()));
-	return ret;
+inline std::wstring upper(std::wstring_view s) {
+	std::wstring ret{s};
+	return upper_in_place(ret);
 }
 
+// Returns a new string converted to uppercase.
+inline std::wstring upper(const std::wstring& s) { return upper(std::wstring_view{s}); }
+
+// Returns a new string converted to uppercase.
+inline std::wstring upper(const wchar_t* s)      { return upper(std::wstring_view{s}); }
+
 // Returns a new string converted to lowercase.
-inline std::wstring lower(const std::wstring& s) {
-	std::wstring ret = s;
-	CharLowerBuffW(&ret[0], static_cast<DWORD>(ret.length()));
-	return ret;
+inline std::wstring lower(std::wstring_view s) {
+	std::wstring ret{s};
+	return lower_in_place(ret);
 }
 
+// Returns a new string converted to lowercase.
+inline std::wstring lower(const std::wstring& s) { return lower(std::wstring_view{s}); }
+
+// Returns a new string converted to lowercase.
+inline std::wstring lower(const wchar_t* s)      { return lower(std::wstring_view{s}); }
+
 // Reverses the string, in-place.
 inline std::wstring& reverse(std::wstring& s) noexcept {
 	size_t lim = (s.length() - (s.length() % 2)) / 2;
@@ -146,7 +178,7 @@ inline std::wstring& reverse(std::wstring& s) noexcept {
 // Reverses the string, in-place.
 inline std::wstring reverse(const wchar_t* s) {
 	std::wstring ret = s;
-	return reverse(s);
+	return reverse(ret);
 }
 
 // Simple diacritics removal, in-place.
@@ -165,30 +197,39 @@ inline std::wstring& remove_diacritics(std::wstring& s) noexcept {
 	return s;
 }
 
+// Precompiled case-insensitive needle, to search the same text repeatedly with no allocations.
+using needlei = _wli::str_needle;
+
 // Finds index of substring within string, case insensitive.
-inline size_t findi(const std::wstring& haystack, const wchar_t* needle, size_t offset = 0) {
-	std::wstring haystack2 = upper(haystack);
-	std::wstring needle2 = needle;
-	CharUpperBuffW(&needle2[0], static_cast<DWORD>(needle2.length()));
-	return haystack2.find(needle2, offset);
+inline size_t findi(std::wstring_view haystack, std::wstring_view needle, size_t offset = 0) noexcept {
+	return needlei::find(haystack, needle, offset);
 }
 
 // Finds index of substring within string, case insensitive.
-inline size_t findi(const std::wstring& haystack, const std::wstring& needle, size_t offset = 0) {
-	return findi(haystack, needle.c_str(), offset);
+inline size_t findi(const std::wstring& haystack, const wchar_t* needle, size_t offset = 0) noexcept {
+	if (!needle) return std::wstring::npos;
+	return needlei::find(haystack, needle, offset);
+}
+
+// Finds index of substring within string, case insensitive.
+inline size_t findi(const std::wstring& haystack, const std::wstring& needle, size_t offset = 0) noexcept {
+	return needlei::find(haystack, needle, offset);
+}
+
+// Finds index of substring within string, case insensitive, reverse search.
+inline size_t rfindi(std::wstring_view haystack, std::wstring_view needle, size_t offset = std::wstring::npos) noexcept {
+	return needlei::rfind(haystack, needle, offset);
 }
 
 // Finds index of substring within string, case insensitive, reverse search.
-inline size_t rfindi(const std::wstring& haystack, const wchar_t* needle, size_t offset = 0) {
-	std::wstring haystack2 = upper(haystack);
-	std::wstring needle2 = needle;
-	CharUpperBuffW(&needle2[0], static_cast<DWORD>(needle2.length()));
-	return haystack2.rfind(needle2, offset);
+inline size_t rfindi(const std::wstring& haystack, const wchar_t* needle, size_t offset = std::wstring::npos) noexcept {
+	if (!needle) return std::wstring::npos;
+	return needlei::rfind(haystack, needle, offset);
 }
 
 // Finds index of substring within string, case insensitive, reverse search.
-inline size_t rfindi(const std::wstring& haystack, const std::wstring& needle, size_t offset = 0) {
-	return rfindi(haystack, needle, offset);
+inline size_t rfindi(const std::wstring& haystack, const std::wstring& needle, size_t offset = std::wstring::npos) noexcept {
+	return needlei::rfind(haystack, needle, offset);
 }
 
 // Finds all occurrences of a substring, case sensitive, and replaces them all, in-place.
@@ -215,22 +256,22 @@ inline std::wstring& replace(std::wstring& haystack, const std::wstring& needle,
 }
 
 // Finds all occurrences of a substring, case insensitive, and replaces them all, in-place.
-inline std::wstring& replacei(std::wstring& haystack, const std::wstring& needle, const std::wstring& replacement) {
+inline std::wstring& replacei(std::wstring& haystack, std::wstring_view needle, std::wstring_view replacement) {
 	if (haystack.empty() || needle.empty()) return haystack;
 
-	std::wstring haystackU = upper(haystack);
-	std::wstring needleU = upper(needle);
+	needlei finder{needle};
+	size_t found = finder.find_in(haystack);
+	if (found == std::wstring::npos) return haystack; // nothing to replace, no allocation
 
 	std::wstring output;
 	size_t base = 0;
-	size_t found = 0;
 
 	for (;;) {
-		found = haystackU.find(needleU, found);
 		output.insert(output.length(), haystack, base, found - base);
 		if (found != std::wstring::npos) {
 			output.append(replacement);
-			base = found = found + needle.length();
+			base = found + needle.length();
+			found = finder.find_in(haystack, base);
 		} else {
 			break;
 		}
@@ -241,17 +282,22 @@ inline std::wstring& replacei(std::wstring& haystack, const std::wstring& needle
 }
 
 // Does the string represent a signed int?
-inline bool is_int(const std::wstring& s) noexcept {
+inline bool is_int(std::wstring_view s) noexcept {
 	if (s.empty()) return false;
 	if (s[0] != L'-' && !std::iswdigit(s[0]) && !std::iswblank(s[0])) return false;
-	for (wchar_t ch : s) {
-		if (!std::iswdigit(ch) && !std::iswblank(ch)) return false;
+	bool hasDigit = std::iswdigit(s[0]) != 0; // a sign alone is not a number
+	for (wchar_t ch : s.substr(1)) {
+		if (std::iswdigit(ch)) {
+			hasDigit = true;
+		} else if (!std::iswblank(ch)) {
+			return false;
+		}
 	}
-	return true;
+	return hasDigit;
 }
 
 // Does the string represent an unsigned int?
-inline bool is_uint(const std::wstring& s) noexcept {
+inline bool is_uint(std::wstring_view s) noexcept {
 	if (s.empty()) return false;
 	for (wchar_t ch : s) {
 		if (!std::iswdigit(ch) && !std::iswblank(ch)) return false;
@@ -260,7 +306,7 @@ inline bool is_uint(const std::wstring& s) noexcept {
 }
 
 // Does the string represent a hexadecimal int?
-inline bool is_hex(const std::wstring& s) noexcept {
+inline bool is_hex(std::wstring_view s) noexcept {
 	if (s.empty()) return false;
 	for (wchar_t ch : s) {
 		if (!std::iswxdigit(ch) && !std::iswblank(ch)) return false;
@@ -269,36 +315,47 @@ inline bool is_hex(const std::wstring& s) noexcept {
 }
 
 // Does the string represent a float?
-inline bool is_float(const std::wstring& s) noexcept {
+inline bool is_float(std::wstring_view s) noexcept {
 	if (s.empty()) return false;
 	if (s[0] != L'-' && s[0] != L'.' && !std::iswdigit(s[0]) && !std::iswblank(s[0])) return false;
 
-	bool hasDot = false;
-	for (wchar_t ch : s) {
+	bool hasDot = (s[0] == L'.');
+	bool hasDigit = std::iswdigit(s[0]) != 0; // a sign or a dot alone is not a number
+	for (wchar_t ch : s.substr(1)) {
 		if (ch == L'.') {
 			if (hasDot) {
 				return false;
 			} else {
 				hasDot = true;
 			}
-		} else {
-			if (!std::iswdigit(ch) && !std::iswblank(ch)) return false;
+		} else if (std::iswdigit(ch)) {
+			hasDigit = true;
+		} else if (!std::iswblank(ch)) {
+			return false;
 		}
 	}
-	return true;
+	return hasDigit;
 }
 
 // Possible string encodings.
 enum class encoding { UNKNOWN, ASCII, WIN1252, UTF8, UTF16BE, UTF16LE, UTF32BE, UTF32LE, SCSU, BOCU1 };
 
+// How reliable is the encoding detection.
+enum class confidence {
+	CERTAIN,  // BOM found, or whole data scanned
+	PROBABLE, // only a sample of the data was scanned
+	GUESS     // data is not UTF-8, Windows-1252 is assumed but any single-byte code page could fit
+};
+
 // Encoding information of a string.
 struct encoding_info final {
-	encoding encType = encoding::UNKNOWN;
-	size_t   bomSize = 0;
+	encoding   encType = encoding::UNKNOWN;
+	size_t     bomSize = 0;
+	confidence confLevel = confidence::CERTAIN;
 };
 
-// Returns encoding information about the given string.
-inline encoding_info get_encoding(const BYTE* data, size_t sz) noexcept {
+// Returns encoding information about the given string, scanning at most maxScanBytes.
+inline encoding_info get_encoding(const BYTE* data, size_t sz, size_t maxScanBytes) noexcept {
 	auto match = [&](const BYTE* pBom, int szBom) noexcept -> bool {
 		return (sz >= static_cast<size_t>(szBom)) &&
 			!memcmp(data, pBom, sizeof(BYTE) * szBom);
@@ -312,49 +369,61 @@ inline encoding_info get_encoding(const BYTE* data, size_t sz) noexcept {
 	BYTE utf16be[] = {0xFE, 0xFF};
 	if (match(utf16be, 2)) return {encoding::UTF16BE, 2};
 
+	BYTE utf32le[] = {0xFF, 0xFE, 0x00, 0x00}; // must be tested before UTF-16LE, which is a prefix
+	if (match(utf32le, 4)) return {encoding::UTF32LE, 4};
+
 	BYTE utf16le[] = {0xFF, 0xFE};
 	if (match(utf16le, 2)) return {encoding::UTF16LE, 2};
 
 	BYTE utf32be[] = {0x00, 0x00, 0xFE, 0xFF};
 	if (match(utf32be, 4)) return {encoding::UTF32BE, 4};
 
-	BYTE utf32le[] = {0xFF, 0xFE, 0x00, 0x00};
-	if (match(utf32le, 4)) return {encoding::UTF32LE, 4};
-
 	BYTE scsu[] = {0x0E, 0xFE, 0xFF};
 	if (match(scsu, 3)) return {encoding::SCSU, 3};
 
 	BYTE bocu1[] = {0xFB, 0xEE, 0x28};
 	if (match(bocu1, 3)) return {encoding::BOCU1, 3};
 
-	// No BOM found, guess UTF-8 without BOM, or Windows-1252 (superset of ISO-8859-1).
-	bool canBeWin1252 = false;
-	for (size_t i = 0; i < sz; ++i) {
-		if (data[i] > 0x7F) { // 127
-			canBeWin1252 = true;
-			if (i <= sz - 2 && (
-				(data[i] == 0xC2 && (data[i+1] >= 0xA1 && data[i+1] <= 0xBF)) || // http://www.utf8-chartable.de
-				(data[i] == 0xC3 && (data[i+1] >= 0x80 && data[i+1] <= 0xBF)) ))
-			{
-				return {encoding::UTF8, 0}; // UTF-8 without BOM
-			}
-		}
+	// No BOM found, validate as UTF-8 without BOM; if not valid, guess Windows-1252 (superset of ISO-8859-1).
+	bool isSample = maxScanBytes < sz;
+	switch (_wli::str_utf::validate_utf8(data, isSample ? maxScanBytes : sz, isSample)) {
+	case _wli::str_utf::utf8_scan::ASCII:
+		return {encoding::ASCII, 0, isSample ? confidence::PROBABLE : confidence::CERTAIN};
+	case _wli::str_utf::utf8_scan::VALID:
+		return {encoding::UTF8, 0, isSample ? confidence::PROBABLE : confidence::CERTAIN}; // UTF-8 without BOM
+	default:
+		return {encoding::WIN1252, 0, confidence::GUESS};
 	}
-	return {(canBeWin1252 ? encoding::WIN1252 : encoding::ASCII), 0};
+}
+
+// Returns encoding information about the given string.
+inline encoding_info get_encoding(const BYTE* data, size_t sz) noexcept {
+	return get_encoding(data, sz, sz);
 }
 
 // Returns encoding information about the given string.
 inline encoding_info get_encoding(const std::vector<BYTE>& data) noexcept {
-	return get_encoding(&data[0], data.size());
+	return get_encoding(data.data(), data.size());
+}
+
+// Returns encoding information about the given string, scanning at most maxScanBytes.
+inline encoding_info get_encoding(const std::vector<BYTE>& data, size_t maxScanBytes) noexcept {
+	return get_encoding(data.data(), data.size(), maxScanBytes);
+}
+
+// Returns encoding information about the content of a mapped file.
+inline encoding_info get_encoding(const _wli::file_mapped_view& data) noexcept {
+	return get_encoding(data.data(), data.size());
 }
 
 // What linebreak is being used on a given string (unknown, N, R, RN or NR). If different linebreaks are used, only the first one is reported.
-inline const wchar_t* get_linebreak(const std::wstring& s) noexcept {
-	for (size_t i = 0; i < s.length() - 1; ++i) {
+inline const wchar_t* get_linebreak(std::wstring_view s) noexcept {
+	for (size_t i = 0; i < s.length(); ++i) {
+		bool hasNext = i + 1 < s.length();
 		if (s[i] == L'\r') {
-			return s[i + 1] == L'\n' ? L"\r\n" : L"\r";
+			return (hasNext && s[i + 1] == L'\n') ? L"\r\n" : L"\r";
 		} else if (s[i] == L'\n') {
-			return s[i + 1] == L'\r' ? L"\n\r" : L"\n";
+			return (hasNext && s[i + 1] == L'\r') ? L"\n\r" : L"\n";
 		}
 	}
 	return nullptr; // unknown
@@ -364,31 +433,21 @@ inline const wchar_t* get_linebreak(const std::wstring& s) noexcept {
 enum class write_bom { YES, NO };
 
 // Converts a string to an UTF-8 blob, ready to be written to a file.
-inline std::vector<BYTE> to_utf8_blob(const std::wstring& s, write_bom writeBom) {
+inline std::vector<BYTE> to_utf8_blob(std::wstring_view s, write_bom writeBom) {
 	std::vector<BYTE> ret;
 	if (!s.empty()) {
 		BYTE utf8bom[]{0xEF, 0xBB, 0xBF};
-		int szBom = (writeBom == write_bom::YES) ? ARRAYSIZE(utf8bom) : 0;
+		size_t szBom = (writeBom == write_bom::YES) ? ARRAYSIZE(utf8bom) : 0;
 
-		int neededLen = WideCharToMultiByte(CP_UTF8, 0,
-			s.c_str(), static_cast<int>(s.length()),
-			nullptr, 0, nullptr, 0);
-		ret.resize(neededLen + szBom);
-
-		if (writeBom == write_bom::YES) {
-			memcpy(&ret[0], utf8bom, szBom);
-		}
-
-		WideCharToMultiByte(CP_UTF8, 0,
-			s.c_str(), static_cast<int>(s.length()),
-			reinterpret_cast<char*>(&ret[0 + szBom]),
-			neededLen, nullptr, nullptr);
+		ret.reserve(s.length() + szBom); // exact size if all chars are ASCII
+		ret.insert(ret.end(), utf8bom, utf8bom + szBom);
+		_wli::str_priv::append_utf8(ret, s.data(), s.length());
 	}
 	return ret;
 }
 
 // Converts wstring to string.
-inline std::string to_ascii(const std::wstring& s) {
+inline std::string to_ascii(std::wstring_view s) {
 	std::string ret(s.length(), '\0');
 	for (size_t i = 0; i < s.length(); ++i) {
 		ret[i] = static_cast<char>(s[i]); // raw conversion
@@ -402,16 +461,17 @@ inline std::wstring to_wstring(const BYTE* data, size_t sz) {
 
 	encoding_info fileEnc = get_encoding(data, sz);
 	data += fileEnc.bomSize; // skip BOM, if any
+	sz -= fileEnc.bomSize;
 
 	switch (fileEnc.encType) {
 	case encoding::UNKNOWN:
 	case encoding::ASCII:   return _wli::str_priv::parse_ascii(data, sz);
 	case encoding::WIN1252: return _wli::str_priv::parse_encoded(data, sz, 1252);
 	case encoding::UTF8:    return _wli::str_priv::parse_encoded(data, sz, CP_UTF8);
-	case encoding::UTF16BE: throw std::invalid_argument("UTF-16 big endian: encoding not implemented.");
-	case encoding::UTF16LE: throw std::invalid_argument("UTF-16 little endian: encoding not implemented.");
-	case encoding::UTF32BE: throw std::invalid_argument("UTF-32 big endian: encoding not implemented.");
-	case encoding::UTF32LE: throw std::invalid_argument("UTF-32 little endian: encoding not implemented.");
+	case encoding::UTF16BE: return _wli::str_priv::parse_utf16(data, sz, true);
+	case encoding::UTF16LE: return _wli::str_priv::parse_utf16(data, sz, false);
+	case encoding::UTF32BE: return _wli::str_priv::parse_utf32(data, sz, true);
+	case encoding::UTF32LE: return _wli::str_priv::parse_utf32(data, sz, false);
 	case encoding::SCSU:    throw std::invalid_argument("Standard compression scheme for Unicode: encoding not implemented.");
 	case encoding::BOCU1:   throw std::invalid_argument("Binary ordered compression for Unicode: encoding not implemented.");
 	default:                throw std::invalid_argument("Unknown encoding.");
@@ -420,7 +480,38 @@ inline std::wstring to_wstring(const BYTE* data, size_t sz) {
 
 // Conversion to wstring.
 inline std::wstring to_wstring(const std::vector<BYTE>& data) {
-	return to_wstring(&data[0], data.size());
+	return to_wstring(data.data(), data.size());
+}
+
+// Conversion to wstring, straight from the memory of a mapped file.
+inline std::wstring to_wstring(const _wli::file_mapped_view& data) {
+	return to_wstring(data.data(), data.size());
+}
+
+// For UTF-16LE data with BOM, which is the native wchar_t encoding, returns a view directly
+// over the data, with no copy; like the memory of a file_mapped. Any other encoding throws.
+inline std::wstring_view to_wstring_view(const BYTE* data, size_t sz) {
+	if (!data || !sz) return {};
+
+	encoding_info fileEnc = get_encoding(data, sz, 0); // only the BOM matters
+	if (fileEnc.encType != encoding::UTF16LE) {
+		throw std::invalid_argument("Only UTF-16 little endian data can be viewed without conversion.");
+	} else if (reinterpret_cast<uintptr_t>(data) % alignof(wchar_t)) {
+		throw std::invalid_argument("UTF-16 data is not aligned, it can't be viewed without conversion.");
+	}
+
+	const wchar_t* pStr = reinterpret_cast<const wchar_t*>(data + fileEnc.bomSize);
+	size_t len = (sz - fileEnc.bomSize) / sizeof(wchar_t); // a trailing odd byte is ignored
+	for (size_t i = 0; i < len; ++i) {
+		if (!pStr[i]) return {pStr, i}; // stop at terminating null
+	}
+	return {pStr, len};
+}
+
+// For UTF-16LE data with BOM, returns a view directly over the memory of a mapped file.
+// The returned view is valid only while the file_mapped::view is alive.
+inline std::wstring_view to_wstring_view(const _wli::file_mapped_view& data) {
+	return to_wstring_view(data.data(), data.size());
 }
 
 // Conversion to wstring.
@@ -479,143 +570,89 @@ inline std::wstring to_wstring_with_separator(size_t number, wchar_t separator =
 	return to_wstring_with_separator(static_cast<int>(number), separator);
 }
 
-// Splits the string at the given characters, the characters themselves will be removed.
-inline std::vector<std::wstring> split(const std::wstring& s, const wchar_t* delimiter) {
-	std::vector<std::wstring> ret;
-	if (s.empty()) return ret;
+// Lazily splits the string at the given characters, yielding views to the source string; nothing is allocated.
+inline _wli::str_split::tokens<_wli::str_split::by_delimiter> split_view(std::wstring_view s, std::wstring_view delimiter) noexcept {
+	// for (std::wstring_view token : str::split_view(text, L",")) {
+	//   ...
+	// }
+	return {s, _wli::str_split::by_delimiter{delimiter}};
+}
 
-	if (!delimiter) {
-		ret.emplace_back(s); // one single line
-		return ret;
-	}
+// Lazily splits a string line by line, at any CR, LF or CR+LF, yielding views to the source string.
+// Unlike split_lines(), which splits only at the first kind of line break found, mixed line breaks are all honored.
+inline _wli::str_split::tokens<_wli::str_split::by_linebreak> split_lines_view(std::wstring_view s) noexcept {
+	return {s, _wli::str_split::by_linebreak{}};
+}
 
-	size_t base = 0, head = 0;
+// Lazily splits a zero-delimited multi-string, yielding views to the source string.
+inline _wli::str_split::tokens<_wli::str_split::by_delimiter> split_multi_zero_view(const wchar_t* s) noexcept {
+	// Example multi-zero string:
+	// L"first one\0second one\0third one\0"
+	// Assumes a well-formed multiStr, which ends with two nulls.
+	const wchar_t* pRun = s;
+	while (*pRun) pRun += lstrlenW(pRun) + 1; // find the double null
+	return {{s, static_cast<size_t>(pRun - s)}, _wli::str_split::by_delimiter{{L"\0", 1}, true}};
+}
 
-	for (;;) {
-		head = s.find(delimiter, head);
-		if (head == std::wstring::npos) break;
-		ret.emplace_back();
-		ret.back().insert(0, s, base, head - base);
-		head += lstrlenW(delimiter);
-		base = head;
-	}
+// Lazily splits string into tokens, which may be enclosed in double quotes, yielding views to the source string.
+inline _wli::str_split::tokens<_wli::str_split::by_quotes> split_quoted_view(std::wstring_view s) noexcept {
+	// Example quoted string:
+	// "First one" NoQuoteSecond "Third one"
+	return {s, _wli::str_split::by_quotes{}};
+}
 
-	ret.emplace_back();
-	ret.back().insert(0, s, base, s.length() - base);
+// Splits the string at the given characters, the characters themselves will be removed.
+inline std::vector<std::wstring> split(std::wstring_view s, std::wstring_view delimiter) {
+	std::vector<std::wstring> ret;
+	for (std::wstring_view token : split_view(s, delimiter)) {
+		ret.emplace_back(token);
+	}
 	return ret;
 }
 
+// Splits the string at the given characters, the characters themselves will be removed.
+inline std::vector<std::wstring> split(const std::wstring& s, const wchar_t* delimiter) {
+	return split(std::wstring_view{s}, delimiter ? std::wstring_view{delimiter} : std::wstring_view{});
+}
+
 // Splits the string at the given characters, the characters themselves will be removed.
 inline std::vector<std::wstring> split(const std::wstring& s, const std::wstring& delimiter) {
-	return split(s, delimiter.c_str());
+	return split(std::wstring_view{s}, std::wstring_view{delimiter});
 }
 
-// Splits a string line by line.
-inline std::vector<std::wstring> split_lines(const std::wstring& s) {
-	return split(s, get_linebreak(s));
+// Splits a string line by line, at the kind of line break found first; see get_linebreak().
+// Other kinds of line breaks are kept within the lines; split_lines_view() splits at all of them.
+inline std::vector<std::wstring> split_lines(std::wstring_view s) {
+	const wchar_t* linebreak = get_linebreak(s);
+	return split(s, linebreak ? std::wstring_view{linebreak} : std::wstring_view{});
 }
 
 // Splits a zero-delimited multi-string.
 inline std::vector<std::wstring> split_multi_zero(const wchar_t* s) {
-	// Example multi-zero string:
-	// L"first one\0second one\0third one\0"
-	// Assumes a well-formed multiStr, which ends with two nulls.
-
-	// Count number of null-delimited strings; string end with double null.
-	size_t numStrings = 0;
-	const wchar_t* pRun = s;
-	while (*pRun) {
-		++numStrings;
-		pRun += lstrlenW(pRun) + 1;
-	}
-
-	// Alloc return array of strings.
 	std::vector<std::wstring> ret;
-	ret.reserve(numStrings);
-
-	// Copy each string.
-	pRun = s;
-	for (size_t i = 0; i < numStrings; ++i) {
-		ret.emplace_back(pRun);
-		pRun += lstrlenW(pRun) + 1;
+	for (std::wstring_view token : split_multi_zero_view(s)) {
+		ret.emplace_back(token);
 	}
 	return ret;
 }
 
 // Splits string into tokens, which may be enclosed in double quotes.
-inline std::vector<std::wstring> split_quoted(const wchar_t* s) {
-	// Example quoted string:
-	// "First one" NoQuoteSecond "Third one"
-
-	// Count number of strings.
-	size_t numStrings = 0;
-	const wchar_t* pRun = s;
-	while (*pRun) {
-		if (*pRun == L'\"') { // begin of quoted string
-			++pRun; // point to 1st char of string
-			for (;;) {
-				if (!*pRun) {
-					break; // won't compute open-quoted
-				} else if (*pRun == L'\"') {
-					++pRun; // point to 1st char after closing quote
-					++numStrings;
-					break;
-				}
-				++pRun;
-			}
-		} else if (!std::iswspace(*pRun)) { // 1st char of non-quoted string
-			++pRun; // point to 2nd char of string
-			while (*pRun && !std::iswspace(*pRun) && *pRun != L'\"') ++pRun; // passed string
-			++numStrings;
-		} else {
-			++pRun; // some white space
-		}
-	}
-
-	// Alloc return array of strings.
+inline std::vector<std::wstring> split_quoted(std::wstring_view s) {
 	std::vector<std::wstring> ret;
-	ret.reserve(numStrings);
-
-	// Alloc and copy each string.
-	pRun = s;
-	const wchar_t* pBase;
-	int i = 0;
-	while (*pRun) {
-		if (*pRun == L'\"') { // begin of quoted string
-			++pRun; // point to 1st char of string
-			pBase = pRun;
-			for (;;) {
-				if (!*pRun) {
-					break; // won't compute open-quoted
-				} else if (*pRun == L'\"') {
-					ret.emplace_back();
-					ret.back().insert(0, pBase, pRun - pBase); // copy to buffer
-					++i; // next string
-
-					++pRun; // point to 1st char after closing quote
-					break;
-				}
-				++pRun;
-			}
-		} else if (!std::iswspace(*pRun)) { // 1st char of non-quoted string
-			pBase = pRun;
-			++pRun; // point to 2nd char of string
-			while (*pRun && !std::iswspace(*pRun) && *pRun != L'\"') ++pRun; // passed string
-
-			ret.emplace_back();
-			ret.back().insert(0, pBase, pRun - pBase); // copy to buffer
-			++i; // next string
-		} else {
-			++pRun; // some white space
-		}
+	for (std::wstring_view token : split_quoted_view(s)) {
+		ret.emplace_back(token);
 	}
-
 	return ret;
 }
 
+// Splits string into tokens, which may be enclosed in double quotes.
+inline std::vector<std::wstring> split_quoted(const wchar_t* s) {
+	return split_quoted(std::wstring_view{s});
+}
+
 // Splits string into tokens, which may be enclosed in double quotes.
 inline std::vector<std::wstring> split_quoted(const std::wstring& s) {
-	return split_quoted(s.c_str());
+	return split_quoted(std::wstring_view{s});
 }
 
 }//namespace str
@@ -7,16 +7,22 @@
 
 #pragma once
 #include <string>
-#include "com.h"
+#include "file_mapped.h"
 #include "insert_order_map.h"
-#include <MsXml2.h>
-#pragma comment(lib, "msxml2.lib")
+#include "str.h"
+#include "internals/xml_priv.h"
+#include "internals/xml_pull.h"
 
 namespace wl {
 
-// XML wrapper class to MSXML2 Windows library.
+// XML parser, which builds a tree of nodes; no COM is needed.
+// Elements can also be read one by one, with no tree, through a reader.
 class xml final {
 public:
+	// Pull parser over UTF-8 (char) or UTF-16 (wchar_t) text, which makes no copies.
+	template<typename charT>
+	using reader = _wli::xml_pull<charT>;
+
 	// A single XML node.
 	class node final {
 	public:
@@ -60,9 +66,6 @@ public:
 		}
 	};
 
-private:
-	com::lib _comLib{com::lib::init::LATER};
-
 public:
 	// Root node of this XML document.
 	node root;
@@ -78,129 +81,110 @@ public:
 		return *this;
 	}
 
-	xml& parse(const wchar_t* str) {
-		this->_comLib.initialize(); // init COM library, if not yet
-		this->root.clear();
+	// Parses UTF-16 text; throws std::runtime_error if malformed.
+	xml& parse(std::wstring_view str) {
+		reader<wchar_t> rd{str};
+		return this->_build_tree(rd);
+	}
 
-		// Create COM object for XML document.
-		com::ptr<IXMLDOMDocument2> doc;
-		doc.co_create_instance(CLSID_DOMDocument30, IID_IXMLDOMDocument);
-		doc->put_async(FALSE);
-
-		// Parse the XML string.
-		VARIANT_BOOL vb = FALSE;
-		com::check_hr(
-			doc->loadXML(static_cast<BSTR>(const_cast<wchar_t*>(str)), &vb),
-			"IXMLDOMDocument::loadXML failed");
-
-		// Get document element and root node from XML.
-		com::ptr<IXMLDOMElement> docElem;
-		com::check_hr(
-			doc->get_documentElement(&docElem),
-			"IXMLDOMDocument::get_documentElement failed");
-
-		com::ptr<IXMLDOMNode> rootNode;
-		docElem.query_interface(IID_IXMLDOMNode, &rootNode);
-		this->root = _build_node(rootNode); // recursive, the whole tree is loaded into memory
-		return *this;
+	xml& parse(const wchar_t* str)      { return this->parse(std::wstring_view{str}); }
+	xml& parse(const std::wstring& str) { return this->parse(std::wstring_view{str}); }
+
+	// Parses UTF-8 text; throws std::runtime_error if malformed.
+	xml& parse_utf8(std::string_view str) {
+		reader<char> rd{str};
+		return this->_build_tree(rd);
 	}
 
-	xml& parse(const std::wstring& str) {
-		return this->parse(str.c_str());
+	// Parses the file straight from the mapped memory; UTF-8 and UTF-16LE are not converted before parsing.
+	// UTF-16 with no BOM is recognized by the zero byte of the first char, which must be ASCII in an XML file.
+	xml& load_from_file(const wchar_t* filePath) {
+		file_mapped::view content = file_mapped::util::read_view(filePath);
+		_wli::xml_priv::file_text text = _wli::xml_priv::read_text(content);
+
+		switch (text.how) {
+		case _wli::xml_priv::file_text::form::UTF8:  return this->parse_utf8(text.utf8);
+		case _wli::xml_priv::file_text::form::UTF16: return this->parse(text.utf16);
+		default:                                     return this->parse(text.converted);
+		}
 	}
 
+	xml& load_from_file(const std::wstring& filePath) { return this->load_from_file(filePath.c_str()); }
+
 private:
-	static xml::node _build_node(com::ptr<IXMLDOMNode>& xmlDomNode) {
-		xml::node ret;
-
-		// Get node name.
-		com::bstr bstrName;
-		xmlDomNode->get_nodeName(&bstrName);
-		ret.name = bstrName.c_str();
-
-		// Parse attributes of node, if any.
-		ret.attrs = _read_attrs(xmlDomNode);
-
-		// Process children, if any.
-		VARIANT_BOOL vb = FALSE;
-		xmlDomNode->hasChildNodes(&vb);
-		if (vb) {
-			com::ptr<IXMLDOMNodeList> nodeList;
-			xmlDomNode->get_childNodes(&nodeList);
-			ret.children.reserve(_count_child_nodes(nodeList));
-
-			int childCount = 0;
-			long totalCount = 0;
-			nodeList->get_length(&totalCount);
-
-			for (long i = 0; i < totalCount; ++i) {
-				com::ptr<IXMLDOMNode> child;
-				nodeList->get_item(i, &child);
-
-				// Node can be text or an actual child node.
-				DOMNodeType type = NODE_INVALID;
-				child->get_nodeType(&type);
-				if (type == NODE_TEXT) {
-					com::bstr bstrText;
-					xmlDomNode->get_text(&bstrText);
-					ret.value.append(bstrText.c_str());
-				} else if (type == NODE_ELEMENT) {
-					ret.children.emplace_back(_build_node(child)); // recursively
+	// Builds the whole tree at once, with no recursion.
+	// Whitespace-only text between elements is ignored; the other texts are appended to the value of the element,
+	// which is then trimmed, like the text of a node in MSXML.
+	template<typename charT>
+	xml& _build_tree(reader<charT>& rd) {
+		using tokenT = typename reader<charT>::token;
+		this->root.clear();
+		std::vector<node*> parents; // ancestors of current node; their vectors don't grow while we're deeper
+		node* cur = nullptr;
+		std::wstring buf;
+
+		for (tokenT tok = rd.next(); tok != tokenT::END_DOC; tok = rd.next()) {
+			if (tok == tokenT::START_ELEM) {
+				if (cur) {
+					parents.emplace_back(cur);
+					cur = &cur->children.emplace_back();
 				} else {
-					// (L"Unhandled node type: %d.\n", type);
+					cur = &this->root;
 				}
+				_to_wstring(rd.name(), cur->name);
+				cur->attrs.reserve(rd.attrs().size());
+				for (const typename reader<charT>::attr& a : rd.attrs()) {
+					_to_wstring(a.name, buf);
+					std::wstring& value = cur->attrs[buf];
+					_to_wstring(a.value, value);
+					reader<charT>::unescape(value, true);
+				}
+			} else if (tok == tokenT::END_ELEM) {
+				_trim_blanks(cur->value);
+				if (parents.empty()) {
+					cur = nullptr; // root closed
+				} else {
+					cur = parents.back();
+					parents.pop_back();
+				}
+			} else if (rd.is_cdata()) {
+				_to_wstring(rd.text(), buf);
+				cur->value.append(buf);
+			} else if (!_is_blank(rd.text())) {
+				_to_wstring(rd.text(), buf);
+				reader<charT>::unescape(buf);
+				cur->value.append(buf);
 			}
-		} else {
-			// Assumes that only a leaf node can have text.
-			com::bstr bstrText;
-			xmlDomNode->get_text(&bstrText);
-			ret.value = bstrText.c_str();
 		}
-		return ret;
+		return *this;
 	}
 
-	static insert_order_map<std::wstring, std::wstring> _read_attrs(com::ptr<IXMLDOMNode>& xmlnode) {
-		// Read attribute collection.
-		com::ptr<IXMLDOMNamedNodeMap> attrs;
-		xmlnode->get_attributes(&attrs);
-
-		long attrCount = 0;
-		attrs->get_length(&attrCount);
-
-		insert_order_map<std::wstring, std::wstring> ret;
-		ret.reserve(attrCount);
-
-		for (long i = 0; i < attrCount; ++i) {
-			com::ptr<IXMLDOMNode> attr;
-			attrs->get_item(i, &attr);
-
-			DOMNodeType type = NODE_INVALID;
-			attr->get_nodeType(&type);
-			if (type == NODE_ATTRIBUTE) {
-				com::bstr bstrName;
-				attr->get_nodeName(&bstrName); // get attribute name
-				com::variant variNodeVal;
-				attr->get_nodeValue(&variNodeVal); // get attribute value
-				ret[bstrName.c_str()] = variNodeVal.get_str(); // add hash entry
-			}
+	template<typename charT>
+	static bool _is_blank_char(charT ch) noexcept {
+		return ch == charT(' ') || ch == charT('\t') || ch == charT('\n') || ch == charT('\r');
+	}
+
+	template<typename charT>
+	static bool _is_blank(std::basic_string_view<charT> s) noexcept {
+		for (charT ch : s) {
+			if (!_is_blank_char(ch)) return false;
 		}
-		return ret;
+		return true;
 	}
 
-	static int _count_child_nodes(com::ptr<IXMLDOMNodeList>& nodeList) noexcept {
-		int childCount = 0;
-		long totalCount = 0;
-		nodeList->get_length(&totalCount); // includes text and actual element nodes
+	static void _trim_blanks(std::wstring& s) {
+		size_t iFirst = 0, iPast = s.length();
+		while (iFirst < iPast && _is_blank_char(s[iFirst])) ++iFirst;
+		while (iPast > iFirst && _is_blank_char(s[iPast - 1])) --iPast;
+		s.erase(iPast).erase(0, iFirst);
+	}
 
-		for (long i = 0; i < totalCount; ++i) {
-			com::ptr<IXMLDOMNode> child;
-			nodeList->get_item(i, &child);
+	static void _to_wstring(std::string_view s, std::wstring& dest) {
+		_wli::str_priv::decode_into(dest, reinterpret_cast<const BYTE*>(s.data()), s.length(), CP_UTF8);
+	}
 
-			DOMNodeType type = NODE_INVALID;
-			child->get_nodeType(&type);
-			if (type == NODE_ELEMENT) ++childCount;
-		}
-		return childCount;
+	static void _to_wstring(std::wstring_view s, std::wstring& dest) {
+		dest.assign(s);
 	}
 };
 
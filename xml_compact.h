@@ -0,0 +1,292 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "file_mapped.h"
+#include "str.h"
+#include "internals/str_utf.h"
+#include "internals/xml_priv.h"
+#include "internals/xml_pull.h"
+
+namespace wl {
+
+// Read-only XML document with a compact memory layout: all nodes live in a single block, linked by indexes.
+// Names are interned, and values are views to the source text, with entities replaced only when asked.
+class xml_compact final {
+private:
+	static const UINT _NONE = 0xFFFFFFFF;
+
+	struct _name final {
+		std::wstring_view text;
+		UINT              foldId; // same for names which differ only in case
+	};
+
+	struct _attr final {
+		UINT              name;
+		std::wstring_view value; // raw
+	};
+
+	struct _node final {
+		UINT              name = _NONE;
+		UINT              parent = _NONE;
+		UINT              firstChild = _NONE;
+		UINT              lastChild = _NONE;
+		UINT              nextSibling = _NONE;
+		UINT              firstAttr = 0;
+		UINT              numAttrs = 0;
+		bool              isLiteral = false; // value has no entities to be replaced
+		std::wstring_view value; // raw
+	};
+
+	std::vector<wchar_t>                          _ownedSrc; // when source had to be converted; buffer doesn't move
+	file_mapped::view                             _mappedSrc; // when source is viewed straight from the file
+	std::vector<_node>                            _nodes;
+	std::vector<_attr>                            _attrs;
+	std::vector<_name>                            _names;
+	std::unordered_map<std::wstring_view, UINT> _nameIds;
+	std::unordered_map<std::wstring, UINT>      _foldIds; // lowercase names
+	std::deque<std::wstring>                      _joinedTexts; // values made of many pieces; deque doesn't move them
+
+public:
+	// Lightweight handle to a node, valid while the document is alive.
+	class node final {
+	private:
+		const xml_compact* _doc = nullptr;
+		UINT               _idx = _NONE;
+
+	public:
+		node() = default;
+		node(const xml_compact* doc, UINT idx) noexcept : _doc{doc}, _idx{idx} { }
+
+		explicit operator bool() const noexcept           { return this->_idx != _NONE; } // false if node doesn't exist
+		bool operator==(const node& other) const noexcept { return this->_idx == other._idx && (this->_doc == other._doc || this->_idx == _NONE); }
+		bool operator!=(const node& other) const noexcept { return !this->operator==(other); }
+
+		std::wstring_view name() const noexcept         { return this->_doc->_names[this->_n().name].text; }
+		std::wstring_view raw_value() const noexcept    { return this->_n().value; } // entities not replaced
+		node              parent() const noexcept       { return {this->_doc, this->_n().parent}; }
+		node              first_child() const noexcept  { return {this->_doc, this->_n().firstChild}; }
+		node              next_sibling() const noexcept { return {this->_doc, this->_n().nextSibling}; }
+		size_t            num_attrs() const noexcept    { return this->_n().numAttrs; }
+
+		// Text of the node, with entities replaced.
+		std::wstring value() const {
+			std::wstring ret{this->_n().value};
+			if (!this->_n().isLiteral) _wli::xml_pull<wchar_t>::unescape(ret);
+			return ret;
+		}
+
+		// Name and raw value of the attribute at the given index.
+		std::pair<std::wstring_view, std::wstring_view> attr_at(size_t index) const noexcept {
+			const _attr& a = this->_doc->_attrs[this->_n().firstAttr + index];
+			return {this->_doc->_names[a.name].text, a.value};
+		}
+
+		// Value of the attribute, with entities replaced; returns false if not found.
+		bool attr(std::wstring_view attrName, std::wstring& value) const {
+			const _node& n = this->_n();
+			for (UINT i = n.firstAttr; i < n.firstAttr + n.numAttrs; ++i) {
+				const _attr& a = this->_doc->_attrs[i];
+				if (this->_doc->_names[a.name].text == attrName) { // case-sensitive, as XML is
+					value.assign(a.value);
+					_wli::xml_pull<wchar_t>::unescape(value, true);
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Case-insensitive match, the name is looked up only once.
+		std::vector<node> children_by_name(std::wstring_view elemName) const {
+			std::vector<node> nodeBuf;
+			UINT foldId = this->_doc->_fold_id_of(elemName);
+			if (foldId != _NONE) {
+				for (node child = this->first_child(); child; child = child.next_sibling()) {
+					if (child._fold_id() == foldId) nodeBuf.emplace_back(child);
+				}
+			}
+			return nodeBuf;
+		}
+
+		// Case-insensitive match, the name is looked up only once.
+		node first_child_by_name(std::wstring_view elemName) const {
+			UINT foldId = this->_doc->_fold_id_of(elemName);
+			if (foldId != _NONE) {
+				for (node child = this->first_child(); child; child = child.next_sibling()) {
+					if (child._fold_id() == foldId) return child;
+				}
+			}
+			return {}; // not found
+		}
+
+	private:
+		const _node& _n() const noexcept { return this->_doc->_nodes[this->_idx]; }
+		UINT _fold_id() const noexcept { return this->_doc->_names[this->_n().name].foldId; }
+	};
+
+	xml_compact() = default;
+	xml_compact(xml_compact&&) = default;
+	xml_compact& operator=(xml_compact&&) = default;
+
+	node   root() const noexcept      { return {this, this->_nodes.empty() ? _NONE : 0}; }
+	size_t num_nodes() const noexcept { return this->_nodes.size(); }
+
+	void clear() noexcept {
+		this->_ownedSrc.clear();
+		this->_mappedSrc = {};
+		this->_nodes.clear();
+		this->_attrs.clear();
+		this->_names.clear();
+		this->_nameIds.clear();
+		this->_foldIds.clear();
+		this->_joinedTexts.clear();
+	}
+
+	// Parses UTF-16 text, which is copied once; throws std::runtime_error if malformed.
+	xml_compact& parse(std::wstring_view str) {
+		this->clear();
+		this->_ownedSrc.assign(str.begin(), str.end());
+		return this->_build({this->_ownedSrc.data(), this->_ownedSrc.size()});
+	}
+
+	// Parses UTF-8 text, which is converted once; throws std::runtime_error if malformed.
+	xml_compact& parse_utf8(std::string_view str) {
+		this->clear();
+		this->_ownedSrc.resize(str.length()); // converted text never has more chars than the source has bytes
+		this->_ownedSrc.resize(_wli::str_utf::utf8_to_utf16(reinterpret_cast<const BYTE*>(str.data()), str.length(),
+			this->_ownedSrc.data()));
+		return this->_build({this->_ownedSrc.data(), this->_ownedSrc.size()});
+	}
+
+	// Parses the file; UTF-16LE content is used straight from the mapped memory, with no copy.
+	// UTF-16 with no BOM is recognized by the zero byte of the first char, which must be ASCII in an XML file.
+	xml_compact& load_from_file(const wchar_t* filePath) {
+		file_mapped::view content = file_mapped::util::read_view(filePath);
+		_wli::xml_priv::file_text text = _wli::xml_priv::read_text(content);
+
+		switch (text.how) {
+		case _wli::xml_priv::file_text::form::UTF8:
+			return this->parse_utf8(text.utf8);
+		case _wli::xml_priv::file_text::form::UTF16:
+			this->clear();
+			this->_mappedSrc = std::move(content); // file stays mapped while the document is alive
+			return this->_build(text.utf16);
+		default:
+			return this->parse(text.converted);
+		}
+	}
+
+	xml_compact& load_from_file(const std::wstring& filePath) { return this->load_from_file(filePath.c_str()); }
+
+private:
+	xml_compact& _build(std::wstring_view src) {
+		using readerT = _wli::xml_pull<wchar_t>;
+		readerT rd{src};
+		UINT cur = _NONE;
+
+		try {
+			for (readerT::token tok = rd.next(); tok != readerT::token::END_DOC; tok = rd.next()) {
+				if (tok == readerT::token::START_ELEM) {
+					if (this->_nodes.size() >= _NONE) {
+						throw std::length_error("Too many XML nodes.");
+					}
+					UINT idx = static_cast<UINT>(this->_nodes.size());
+					_node& n = this->_nodes.emplace_back();
+					n.name = this->_intern(rd.name());
+					n.parent = cur;
+					n.firstAttr = static_cast<UINT>(this->_attrs.size());
+					n.numAttrs = static_cast<UINT>(rd.attrs().size());
+					for (const readerT::attr& a : rd.attrs()) {
+						this->_attrs.push_back({this->_intern(a.name), a.value});
+					}
+
+					if (cur != _NONE) { // append to parent
+						_node& parent = this->_nodes[cur];
+						if (parent.lastChild == _NONE) {
+							parent.firstChild = idx;
+						} else {
+							this->_nodes[parent.lastChild].nextSibling = idx;
+						}
+						parent.lastChild = idx;
+					}
+					cur = idx;
+				} else if (tok == readerT::token::END_ELEM) {
+					cur = this->_nodes[cur].parent;
+				} else if (rd.is_cdata() || !_is_blank(rd.text())) {
+					this->_append_text(this->_nodes[cur], rd.text(), rd.is_cdata());
+				}
+			}
+		} catch (...) {
+			this->clear();
+			throw;
+		}
+
+		this->_nodes.shrink_to_fit();
+		this->_attrs.shrink_to_fit();
+		return *this;
+	}
+
+	// Most nodes have a single piece of text, which is just viewed; many pieces are joined into a new string.
+	void _append_text(_node& n, std::wstring_view text, bool isCdata) {
+		if (n.value.empty()) {
+			n.value = text;
+			n.isLiteral = isCdata;
+			return;
+		}
+
+		std::wstring joined{n.value};
+		if (!n.isLiteral) _wli::xml_pull<wchar_t>::unescape(joined);
+		std::wstring piece{text};
+		if (!isCdata) _wli::xml_pull<wchar_t>::unescape(piece);
+		joined.append(piece);
+
+		if (!this->_joinedTexts.empty() && n.value.data() == this->_joinedTexts.back().data()) {
+			this->_joinedTexts.back() = std::move(joined); // node was the last one to be joined, reuse it
+		} else {
+			this->_joinedTexts.emplace_back(std::move(joined));
+		}
+		n.value = this->_joinedTexts.back();
+		n.isLiteral = true; // entities already replaced
+	}
+
+	UINT _intern(std::wstring_view nameText) {
+		auto found = this->_nameIds.find(nameText);
+		if (found != this->_nameIds.end()) return found->second;
+
+		std::wstring folded{nameText};
+		str::lower_in_place(folded);
+		UINT id = static_cast<UINT>(this->_names.size());
+		UINT foldId = this->_foldIds.emplace(std::move(folded), id).first->second; // first name with this folding
+		this->_names.push_back({nameText, foldId});
+		this->_nameIds.emplace(nameText, id);
+		return id;
+	}
+
+	UINT _fold_id_of(std::wstring_view nameText) const {
+		auto found = this->_nameIds.find(nameText);
+		if (found != this->_nameIds.end()) return this->_names[found->second].foldId; // exact name, no folding needed
+
+		std::wstring folded{nameText};
+		str::lower_in_place(folded);
+		auto foundFold = this->_foldIds.find(folded);
+		return foundFold == this->_foldIds.end() ? _NONE : foundFold->second;
+	}
+
+	static bool _is_blank(std::wstring_view s) noexcept {
+		for (wchar_t ch : s) {
+			if (ch != L' ' && ch != L'\t' && ch != L'\n' && ch != L'\r') return false;
+		}
+		return true;
+	}
+};
+
+}//namespace wl
@@ -0,0 +1,294 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "str.h"
+#include "xml.h"
+
+namespace wl {
+
+// Compiled path to find nodes in a tree of xml::node, a small subset of XPath:
+// "/root/item[@id='x']/value", "//item[@type]", "item[2]/*".
+// A path starting with "/" begins at the given node itself; "//" searches all descendants.
+// As in XPath, a position counts among the matching siblings, so "//item[1]" is the first item of each parent.
+// Element names match case-insensitively, like xml::node::children_by_name; attribute names are case-sensitive.
+class xml_path final {
+public:
+	// Index of all elements of a tree by name, which speeds up the "//" searches.
+	// Must be rebuilt if the tree changes.
+	class index final {
+	private:
+		friend xml_path;
+
+		struct _entry final {
+			size_t     pre; // position in document order
+			xml::node* pNode;
+			xml::node* pParent; // null for the root
+		};
+
+		std::unordered_map<std::wstring, std::vector<_entry>>          _byName; // lowercase names, in document order
+		std::unordered_map<const xml::node*, std::pair<size_t, size_t>> _ranges; // position of node and of its last descendant
+
+	public:
+		index() = default;
+		explicit index(xml::node& root) { this->build(root); }
+
+		index& build(xml::node& root) {
+			this->_byName.clear();
+			this->_ranges.clear();
+
+			size_t pre = 0;
+			std::vector<std::pair<xml::node*, size_t>> stack{{&root, 0}}; // node and next child to visit
+			this->_add(root, nullptr, pre++);
+			while (!stack.empty()) {
+				xml::node* pCur = stack.back().first;
+				size_t& nextChild = stack.back().second;
+				if (nextChild < pCur->children.size()) {
+					xml::node& child = pCur->children[nextChild++];
+					this->_add(child, pCur, pre++);
+					stack.emplace_back(&child, 0);
+				} else {
+					this->_ranges[pCur].second = pre - 1;
+					stack.pop_back();
+				}
+			}
+			return *this;
+		}
+
+	private:
+		void _add(xml::node& n, xml::node* pParent, size_t pre) {
+			this->_byName[str::lower(n.name)].push_back({pre, &n, pParent});
+			this->_ranges[&n] = {pre, pre};
+		}
+	};
+
+private:
+	struct _pred final {
+		std::wstring attrName; // if empty, it's a position
+		std::wstring attrValue;
+		bool         anyValue = true; // just [@attr]
+		size_t       position = 0; // 1-based
+	};
+
+	struct _step final {
+		bool               isDescendant = false;
+		std::wstring       name; // lowercase, empty means any
+		std::vector<_pred> preds;
+	};
+
+	struct _match final {
+		xml::node* pNode;
+		xml::node* pParent; // positions are counted among the matches of the same parent
+	};
+
+	std::vector<_step> _steps;
+	bool               _isAbsolute = false;
+
+public:
+	xml_path() = default;
+	explicit xml_path(std::wstring_view expr) { this->compile(expr); }
+
+	// Parses the path expression; throws std::invalid_argument if malformed.
+	xml_path& compile(std::wstring_view expr) {
+		this->_steps.clear();
+		this->_isAbsolute = !expr.empty() && expr[0] == L'/';
+		size_t pos = 0;
+
+		auto fail = [](const char* what) -> void {
+			throw std::invalid_argument(std::string{"Invalid XML path: "}.append(what).append("."));
+		};
+
+		while (pos < expr.length() || this->_steps.empty()) {
+			_step newStep;
+			if (expr.substr(pos, 2) == L"//") {
+				newStep.isDescendant = true;
+				pos += 2;
+			} else if (expr.substr(pos, 1) == L"/") {
+				pos += 1;
+			} else if (pos) {
+				fail("steps must be separated by slashes");
+			}
+
+			size_t idxNameEnd = std::min(expr.find_first_of(L"/[", pos), expr.length());
+			newStep.name = expr.substr(pos, idxNameEnd - pos);
+			if (newStep.name.empty()) fail("element name expected");
+			if (newStep.name.find_first_of(L"]@='\" \t") != std::wstring::npos) fail("invalid char in element name");
+			if (newStep.name == L"*") newStep.name.clear();
+			str::lower_in_place(newStep.name);
+			pos = idxNameEnd;
+
+			while (pos < expr.length() && expr[pos] == L'[') {
+				size_t idxClose = _find_closing(expr, pos + 1);
+				if (idxClose == std::wstring_view::npos) fail("predicate not closed");
+				std::wstring_view inner = str::trim_view(expr.substr(pos + 1, idxClose - pos - 1));
+				_pred newPred;
+
+				if (!inner.empty() && inner[0] == L'@') {
+					size_t idxEq = inner.find(L'=');
+					newPred.attrName = str::trim_view(inner.substr(1, idxEq == std::wstring_view::npos ? std::wstring_view::npos : idxEq - 1));
+					if (newPred.attrName.empty()) fail("attribute name expected");
+					if (idxEq != std::wstring_view::npos) {
+						std::wstring_view quoted = str::trim_view(inner.substr(idxEq + 1));
+						if (quoted.length() < 2 || (quoted[0] != L'\'' && quoted[0] != L'"') || quoted.back() != quoted[0]) {
+							fail("attribute value must be quoted");
+						}
+						newPred.attrValue = quoted.substr(1, quoted.length() - 2);
+						newPred.anyValue = false;
+					}
+				} else if (str::is_uint(inner)) {
+					newPred.position = std::stoul(std::wstring{inner});
+					if (!newPred.position) fail("positions start at 1");
+				} else {
+					fail("unsupported predicate");
+				}
+				newStep.preds.emplace_back(std::move(newPred));
+				pos = idxClose + 1;
+			}
+
+			this->_steps.emplace_back(std::move(newStep));
+		}
+		return *this;
+	}
+
+	// Returns all nodes which match the path, starting from the given node.
+	// If an index of the tree is given, it's used to search descendants.
+	std::vector<std::reference_wrapper<xml::node>> select(xml::node& context, const index* pIdx = nullptr) const {
+		std::vector<xml::node*> cur{&context};
+		for (size_t i = 0; i < this->_steps.size() && !cur.empty(); ++i) {
+			cur = this->_eval_step(this->_steps[i], cur, i == 0 && this->_isAbsolute, pIdx);
+		}
+
+		std::vector<std::reference_wrapper<xml::node>> nodeBuf;
+		nodeBuf.reserve(cur.size());
+		for (xml::node* pNode : cur) {
+			nodeBuf.emplace_back(*pNode);
+		}
+		return nodeBuf;
+	}
+
+	// Returns the first node which matches the path, or null.
+	xml::node* select_first(xml::node& context, const index* pIdx = nullptr) const {
+		std::vector<std::reference_wrapper<xml::node>> found = this->select(context, pIdx);
+		return found.empty() ? nullptr : &found[0].get();
+	}
+
+	// Compiles the path and runs it once.
+	static std::vector<std::reference_wrapper<xml::node>> select(xml::node& context, std::wstring_view expr) {
+		return xml_path{expr}.select(context);
+	}
+
+private:
+	// If fromDocument, the contexts are the root itself, not its children.
+	std::vector<xml::node*> _eval_step(const _step& step, const std::vector<xml::node*>& contexts,
+		bool fromDocument, const index* pIdx) const
+	{
+		std::vector<xml::node*> ret;
+		std::vector<_match> matches;
+		std::unordered_set<const xml::node*> seen; // descendants of nested contexts would repeat
+		bool mayRepeat = step.isDescendant && contexts.size() > 1;
+
+		for (xml::node* pCtx : contexts) {
+			matches.clear();
+			if (fromDocument && !step.isDescendant) {
+				if (_name_matches(*pCtx, step.name)) matches.push_back({pCtx, nullptr});
+			} else if (step.isDescendant) {
+				this->_descendants(*pCtx, step.name, fromDocument, pIdx, matches);
+			} else {
+				for (xml::node& child : pCtx->children) {
+					if (_name_matches(child, step.name)) matches.push_back({&child, pCtx});
+				}
+			}
+
+			for (const _pred& pred : step.preds) {
+				_filter(pred, matches);
+			}
+			for (const _match& match : matches) {
+				if (!mayRepeat || seen.emplace(match.pNode).second) ret.emplace_back(match.pNode);
+			}
+		}
+		return ret;
+	}
+
+	void _descendants(xml::node& ctx, const std::wstring& name, bool includeSelf,
+		const index* pIdx, std::vector<_match>& matches) const
+	{
+		if (pIdx && !name.empty()) {
+			auto foundRange = pIdx->_ranges.find(&ctx);
+			if (foundRange != pIdx->_ranges.end()) { // binary search within the nodes of same name
+				auto foundName = pIdx->_byName.find(name);
+				if (foundName == pIdx->_byName.end()) return;
+				const std::vector<index::_entry>& entries = foundName->second;
+				size_t first = foundRange->second.first + (includeSelf ? 0 : 1);
+				auto it = std::lower_bound(entries.begin(), entries.end(), first,
+					[](const index::_entry& e, size_t pre) -> bool { return e.pre < pre; });
+				for (; it != entries.end() && it->pre <= foundRange->second.second; ++it) {
+					matches.push_back({it->pNode, it->pParent});
+				}
+				return;
+			}
+		}
+
+		if (includeSelf && _name_matches(ctx, name)) matches.push_back({&ctx, nullptr});
+		std::vector<std::pair<xml::node*, size_t>> stack{{&ctx, 0}}; // document order, with no recursion
+		while (!stack.empty()) {
+			xml::node* pCur = stack.back().first;
+			size_t& nextChild = stack.back().second;
+			if (nextChild < pCur->children.size()) {
+				xml::node& child = pCur->children[nextChild++];
+				if (_name_matches(child, name)) matches.push_back({&child, pCur});
+				stack.emplace_back(&child, 0);
+			} else {
+				stack.pop_back();
+			}
+		}
+	}
+
+	static void _filter(const _pred& pred, std::vector<_match>& matches) {
+		if (pred.attrName.empty()) { // position; siblings are in document order, even if mixed with their descendants
+			std::unordered_map<const xml::node*, size_t> numSeen; // per parent
+			matches.erase(std::remove_if(matches.begin(), matches.end(), [&](const _match& match) -> bool {
+				return ++numSeen[match.pParent] != pred.position;
+			}), matches.end());
+			return;
+		}
+
+		matches.erase(std::remove_if(matches.begin(), matches.end(), [&pred](const _match& match) -> bool {
+			const std::wstring* pValue = match.pNode->attrs.get_if_exists(pred.attrName);
+			return !pValue || (!pred.anyValue && *pValue != pred.attrValue);
+		}), matches.end());
+	}
+
+	// Finds the "]" closing a predicate, skipping quoted values, which may contain it.
+	static size_t _find_closing(std::wstring_view expr, size_t pos) noexcept {
+		wchar_t quote = L'\0';
+		for (; pos < expr.length(); ++pos) {
+			if (quote) {
+				if (expr[pos] == quote) quote = L'\0';
+			} else if (expr[pos] == L'\'' || expr[pos] == L'"') {
+				quote = expr[pos];
+			} else if (expr[pos] == L']') {
+				return pos;
+			}
+		}
+		return std::wstring_view::npos;
+	}
+
+	static bool _name_matches(const xml::node& n, const std::wstring& lowerName) noexcept {
+		return lowerName.empty() // wildcard
+			|| (n.name.length() == lowerName.length() && !lstrcmpiW(n.name.c_str(), lowerName.c_str()));
+	}
+};
+
+}//namespace wl
@@ -0,0 +1,304 @@
+/**
+ * Part of WinLamb - Win32 API Lambda Library
+ * https://github.com/rodrigocfd/winlamb
+ * Copyright 2017-present Rodrigo Cesar de Freitas Dias
+ * This library is released under the MIT License
+ */
+
+#pragma once
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+#include "file.h"
+#include "xml.h"
+#include "internals/simd.h"
+#include "internals/str_utf.h"
+
+namespace wl {
+
+// Writes XML as UTF-8, element by element, into a memory buffer or straight into a file.
+// Text and attribute values are escaped; element and attribute names are written as they are.
+// Control chars other than tab, LF and CR are not allowed in XML 1.0 and are written as they are, so don't pass them.
+class xml_writer final {
+public:
+	// Output layout: compact has no whitespace at all, pretty puts each element in its own line, indented with tabs.
+	enum class layout { COMPACT, PRETTY };
+
+private:
+	struct _open_elem final {
+		size_t nameOffset; // in _names
+		bool   hasChildElems;
+	};
+
+	static const size_t _FLUSH_SIZE = 64 * 1024;
+
+	std::vector<BYTE>       _buf;
+	file*                   _pSink = nullptr;
+	layout                  _layout = layout::COMPACT;
+	std::vector<BYTE>       _names; // names of all open elements, already in UTF-8
+	std::vector<_open_elem> _stack;
+	bool                    _tagOpen = false; // start tag not yet closed with ">", so attributes can be added
+	bool                    _hasRoot = false;
+
+public:
+	// Output goes to an internal buffer, see data().
+	explicit xml_writer(layout layoutType = layout::COMPACT) noexcept : _layout{layoutType} { }
+
+	// Output goes to the file, which must remain open while writing; data() holds only what wasn't flushed yet.
+	xml_writer(file& sink, layout layoutType = layout::COMPACT) noexcept : _pSink{&sink}, _layout{layoutType} { }
+
+	xml_writer(const xml_writer&) = delete;
+	xml_writer& operator=(const xml_writer&) = delete;
+
+	const std::vector<BYTE>& data() const noexcept  { return this->_buf; }
+	size_t                   depth() const noexcept { return this->_stack.size(); } // open elements
+
+	// Discards all output and state; file sink, if any, is kept.
+	xml_writer& clear() noexcept {
+		this->_buf.clear();
+		this->_names.clear();
+		this->_stack.clear();
+		this->_tagOpen = false;
+		this->_hasRoot = false;
+		return *this;
+	}
+
+	// Writes the XML declaration, must be the first thing written.
+	xml_writer& declaration() {
+		if (!this->_buf.empty() || this->_hasRoot) {
+			throw std::logic_error("XML declaration must come first.");
+		}
+		this->_append_ascii("<?xml version=\"1.0\" encoding=\"UTF-8\"?>");
+		if (this->_layout == layout::PRETTY) this->_append_ascii("\r\n");
+		return *this;
+	}
+
+	// Begins a new element, child of the current one.
+	xml_writer& start(std::wstring_view name) {
+		if (name.empty()) {
+			throw std::invalid_argument("Element name can't be empty.");
+		} else if (this->_stack.empty() && this->_hasRoot) {
+			throw std::logic_error("XML can't have more than one root element.");
+		}
+
+		this->_close_start_tag();
+		if (!this->_stack.empty()) {
+			this->_stack.back().hasChildElems = true;
+			this->_new_line();
+		}
+		this->_buf.emplace_back('<');
+
+		size_t nameOffset = this->_names.size();
+		_append_utf8(this->_names, name);
+		this->_buf.insert(this->_buf.end(), this->_names.begin() + nameOffset, this->_names.end());
+
+		this->_stack.push_back({nameOffset, false});
+		this->_tagOpen = true;
+		this->_hasRoot = true;
+		return *this;
+	}
+
+	// Adds an attribute to the element just started, before any content.
+	xml_writer& attr(std::wstring_view name, std::wstring_view value) {
+		if (!this->_tagOpen) {
+			throw std::logic_error("Attributes must be written right after the element start.");
+		}
+		this->_buf.emplace_back(' ');
+		_append_utf8(this->_buf, name);
+		this->_append_ascii("=\"");
+		this->_append_escaped(value, true);
+		this->_buf.emplace_back('"');
+		return *this;
+	}
+
+	// Writes text inside the current element, escaping it.
+	xml_writer& text(std::wstring_view s) {
+		this->_check_inside_elem();
+		this->_close_start_tag();
+		this->_append_escaped(s, false);
+		return this->_flush_if_big();
+	}
+
+	// Writes text inside the current element as a CDATA section, with no escaping.
+	xml_writer& cdata(std::wstring_view s) {
+		this->_check_inside_elem();
+		this->_close_start_tag();
+		this->_append_ascii("<![CDATA[");
+		for (size_t pos = 0; ; ) {
+			size_t idxEnd = s.find(L"]]>", pos);
+			if (idxEnd == std::wstring_view::npos) {
+				_append_utf8(this->_buf, s.substr(pos));
+				break;
+			}
+			_append_utf8(this->_buf, s.substr(pos, idxEnd + 2 - pos));
+			this->_append_ascii("]]><![CDATA["); // "]]>" can't appear inside, so it's split in two sections
+			pos = idxEnd + 2;
+		}
+		this->_append_ascii("]]>");
+		return this->_flush_if_big();
+	}
+
+	// Ends the current element; an element with no content is self-closed.
+	xml_writer& end() {
+		this->_check_inside_elem();
+		_open_elem elem = this->_stack.back();
+		this->_stack.pop_back();
+
+		if (this->_tagOpen) {
+			this->_append_ascii("/>");
+			this->_tagOpen = false;
+		} else {
+			if (elem.hasChildElems) this->_new_line();
+			this->_append_ascii("</");
+			this->_buf.insert(this->_buf.end(), this->_names.begin() + elem.nameOffset, this->_names.end());
+			this->_buf.emplace_back('>');
+		}
+		this->_names.resize(elem.nameOffset);
+
+		if (this->_stack.empty() && this->_layout == layout::PRETTY) this->_append_ascii("\r\n");
+		return this->_flush_if_big();
+	}
+
+	// Writes an element with only text.
+	xml_writer& element(std::wstring_view name, std::wstring_view textContent) {
+		this->start(name);
+		if (!textContent.empty()) this->text(textContent);
+		return this->end();
+	}
+
+	// Writes the node with its attributes, value and all its children, with no recursion.
+	// The value is written before the children.
+	xml_writer& node(const xml::node& n) {
+		std::vector<std::pair<const xml::node*, size_t>> pending{{&n, 0}}; // node and next child to write
+		this->_write_node_start(n);
+		while (!pending.empty()) {
+			const xml::node* pCur = pending.back().first;
+			size_t& nextChild = pending.back().second;
+			if (nextChild < pCur->children.size()) {
+				const xml::node& child = pCur->children[nextChild++];
+				this->_write_node_start(child);
+				pending.emplace_back(&child, 0);
+			} else {
+				this->end();
+				pending.pop_back();
+			}
+		}
+		return *this;
+	}
+
+	// Ends all open elements and writes any pending output to the file.
+	xml_writer& finish() {
+		while (!this->_stack.empty()) this->end();
+		return this->flush();
+	}
+
+	// Writes the pending output to the file, if any.
+	xml_writer& flush() {
+		if (this->_pSink && !this->_buf.empty()) {
+			this->_pSink->write(this->_buf.data(), this->_buf.size());
+			this->_buf.clear(); // memory is reused
+		}
+		return *this;
+	}
+
+	// Serializes a whole tree.
+	static std::vector<BYTE> serialize(const xml::node& root, layout layoutType = layout::COMPACT) {
+		xml_writer wr{layoutType};
+		wr.declaration().node(root);
+		return std::move(wr._buf);
+	}
+
+private:
+	void _write_node_start(const xml::node& n) {
+		this->start(n.name);
+		for (const insert_order_map<std::wstring, std::wstring>::entry& a : n.attrs) {
+			this->attr(a.key, a.value);
+		}
+		if (!n.value.empty()) this->text(n.value);
+	}
+
+	void _check_inside_elem() const {
+		if (this->_stack.empty()) {
+			throw std::logic_error("No element is open.");
+		}
+	}
+
+	void _close_start_tag() {
+		if (this->_tagOpen) {
+			this->_buf.emplace_back('>');
+			this->_tagOpen = false;
+		}
+	}
+
+	void _new_line() {
+		if (this->_layout == layout::PRETTY) {
+			this->_append_ascii("\r\n");
+			this->_buf.insert(this->_buf.end(), this->_stack.size(), '\t'); // one tab per open element
+		}
+	}
+
+	xml_writer& _flush_if_big() {
+		if (this->_pSink && this->_buf.size() >= _FLUSH_SIZE) this->flush();
+		return *this;
+	}
+
+	void _append_ascii(const char* s) {
+		while (*s) this->_buf.emplace_back(static_cast<BYTE>(*s++));
+	}
+
+	// Converts and writes runs of plain chars at once; only the chars which must be escaped are handled one by one.
+	void _append_escaped(std::wstring_view s, bool isAttr) {
+		for (size_t pos = 0; pos < s.length(); ) {
+			size_t idxSpecial = _find_special(s, pos, isAttr);
+			_append_utf8(this->_buf, s.substr(pos, idxSpecial - pos)); // special chars are ASCII, never in a surrogate pair
+			if (idxSpecial == s.length()) break;
+
+			switch (s[idxSpecial]) {
+			case L'&':  this->_append_ascii("&amp;"); break;
+			case L'<':  this->_append_ascii("&lt;"); break;
+			case L'>':  this->_append_ascii("&gt;"); break;
+			case L'"':  this->_append_ascii("&quot;"); break;
+			case L'\t': this->_append_ascii("&#9;"); break; // would become spaces in attributes
+			case L'\n': this->_append_ascii("&#10;"); break;
+			case L'\r': this->_append_ascii("&#13;"); // would be normalized to LF when read
+			}
+			pos = idxSpecial + 1;
+		}
+	}
+
+	// Finds the first char which must be escaped, returns the string length if none.
+	static size_t _find_special(std::wstring_view s, size_t pos, bool isAttr) noexcept {
+		const wchar_t* p = s.data();
+#ifdef WINLAMB_SSE2
+		const __m128i amp = _mm_set1_epi16(L'&'), lt = _mm_set1_epi16(L'<'), gt = _mm_set1_epi16(L'>');
+		const __m128i quot = _mm_set1_epi16(L'"'), tab = _mm_set1_epi16(L'\t');
+		const __m128i lf = _mm_set1_epi16(L'\n'), cr = _mm_set1_epi16(L'\r');
+		for (; pos + 8 <= s.length(); pos += 8) {
+			__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + pos));
+			__m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(v, amp), _mm_cmpeq_epi16(v, lt)),
+				_mm_or_si128(_mm_cmpeq_epi16(v, gt), _mm_cmpeq_epi16(v, cr)));
+			if (isAttr) {
+				hits = _mm_or_si128(hits, _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(v, quot), _mm_cmpeq_epi16(v, tab)),
+					_mm_cmpeq_epi16(v, lf)));
+			}
+			unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(hits));
+			if (mask) return pos + _wli::simd::first_bit(mask) / 2; // 2 mask bits per char
+		}
+#endif
+		for (; pos < s.length(); ++pos) {
+			wchar_t ch = p[pos];
+			if (ch == L'&' || ch == L'<' || ch == L'>' || ch == L'\r') return pos;
+			if (isAttr && (ch == L'"' || ch == L'\t' || ch == L'\n')) return pos;
+		}
+		return s.length();
+	}
+
+	static void _append_utf8(std::vector<BYTE>& dest, std::wstring_view s) {
+		if (s.empty()) return;
+		size_t prevSz = dest.size();
+		dest.resize(prevSz + s.length() * 3); // worst case
+		dest.resize(prevSz + _wli::str_utf::utf16_to_utf8(s.data(), s.length(), &dest[prevSz]));
+	}
+};
+
+}//namespace wl
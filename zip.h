@@ -6,9 +6,26 @@
  */
 
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "file.h"
-#include "com.h"
-#include <Shlobj.h>
+#include "file_mapped.h"
+#include "internals/crc32.h"
+#include "internals/deflate.h"
+#include "internals/inflate.h"
+#include "internals/str_priv.h"
+#include "internals/str_utf.h"
 
 namespace wl {
 
@@ -18,7 +35,698 @@ private:
 	zip() = delete;
 
 public:
+	// Compression methods supported by the reader.
+	enum class method : WORD { STORED = 0, DEFLATED = 8 };
+
+	// Information about a file or directory inside the zip, read from the central directory.
+	struct entry final {
+		std::wstring name; // full path inside the zip, with forward slashes
+		UINT64       size = 0; // uncompressed
+		UINT64       compressedSize = 0;
+		UINT64       localHeaderOffset = 0;
+		DWORD        crc32 = 0;
+		DWORD        dosDateTime = 0; // date in the high word, time in the low word
+		WORD         method = 0;
+		WORD         flags = 0;
+
+		bool is_dir() const noexcept       { return !this->name.empty() && this->name.back() == L'/'; }
+		bool is_encrypted() const noexcept { return (this->flags & 0x0001) != 0; }
+	};
+
+	// Reads a zip file straight from its mapped memory.
+	// Entries are found by name with no search, and extracted one by one, in any order.
+	class reader final {
+	private:
+		file_mapped::view                             _data;
+		std::vector<entry>                            _entries;
+		std::unordered_map<std::wstring_view, size_t> _byName; // views to the names in _entries
+
+	public:
+		reader() = default;
+		reader(reader&&) = default;
+		reader& operator=(reader&&) = default;
+
+		explicit reader(const std::wstring& zipFile) { this->open(zipFile); }
+
+		const std::vector<entry>& entries() const noexcept { return this->_entries; }
+		size_t                    size() const noexcept    { return this->_entries.size(); }
+
+		reader& close() noexcept {
+			this->_byName.clear();
+			this->_entries.clear();
+			this->_data = {};
+			return *this;
+		}
+
+		// Maps the file and reads its central directory; throws std::runtime_error if it's not a valid zip.
+		reader& open(const wchar_t* zipFile) {
+			return this->open(file_mapped::util::read_view(zipFile));
+		}
+
+		reader& open(const std::wstring& zipFile) { return this->open(zipFile.c_str()); }
+
+		// Reads the central directory of zip data already in memory; throws std::runtime_error if not valid.
+		reader& open(file_mapped::view zipData) {
+			this->close();
+			this->_data = std::move(zipData);
+			try {
+				this->_read_central_dir();
+			} catch (...) {
+				this->close();
+				throw;
+			}
+			return *this;
+		}
+
+		// Finds the entry with exactly this name, with forward slashes; returns null if not found.
+		const entry* find(std::wstring_view name) const {
+			auto found = this->_byName.find(name);
+			return found == this->_byName.end() ? nullptr : &this->_entries[found->second];
+		}
+
+		// Returns the data of the entry as it's stored in the file, which is compressed if not STORED.
+		file_mapped::view raw_view(const entry& e) const {
+			size_t offset = this->_data_offset(e);
+			if (e.compressedSize > this->_data.size() - offset) _fail("entry data goes beyond end of file");
+			return this->_data.sub(offset, static_cast<size_t>(e.compressedSize));
+		}
+
+		// Returns the content of a STORED entry with no copy; throws std::logic_error if it's compressed.
+		// The CRC is not checked.
+		file_mapped::view view(const entry& e) const {
+			if (e.method != static_cast<WORD>(method::STORED)) {
+				throw std::logic_error("Zip entry is compressed, it can't be viewed.");
+			}
+			_check_supported(e);
+			return this->raw_view(e);
+		}
+
+		// Decompresses the entry into the buffer, which must hold at least e.size bytes, and checks its CRC.
+		// Returns the number of bytes written.
+		size_t extract(const entry& e, BYTE* pDest, size_t destSz) const {
+			_check_supported(e);
+			if (e.size > destSz) {
+				throw std::invalid_argument("Buffer is too small for the zip entry.");
+			}
+
+			file_mapped::view raw = this->raw_view(e);
+			size_t written = 0;
+			if (e.method == static_cast<WORD>(method::STORED)) {
+				if (raw.size() != e.size) _fail("stored entry has inconsistent sizes");
+				if (raw.size()) memcpy(pDest, raw.data(), raw.size());
+				written = raw.size();
+			} else {
+				written = _wli::inflater::inflate(raw.data(), raw.size(), pDest, static_cast<size_t>(e.size));
+				if (written != e.size) _fail("entry is smaller than its declared size");
+			}
+
+			if (_wli::crc32::calc(pDest, written) != e.crc32) _fail("CRC mismatch");
+			return written;
+		}
+
+		// Decompresses the entry into the buffer, which is resized; its memory is reused.
+		const reader& extract(const entry& e, std::vector<BYTE>& buf) const {
+			if (e.size > SIZE_MAX) {
+				throw std::length_error("Zip entry is too large to be loaded into memory.");
+			}
+			buf.resize(static_cast<size_t>(e.size));
+			this->extract(e, buf.data(), buf.size());
+			return *this;
+		}
+
+		// Decompresses the entry into a new buffer.
+		std::vector<BYTE> extract(const entry& e) const {
+			std::vector<BYTE> buf;
+			this->extract(e, buf);
+			return buf;
+		}
+
+	private:
+		[[noreturn]] static void _fail(const char* what) {
+			throw std::runtime_error(std::string{"Invalid zip file: "}.append(what).append("."));
+		}
+
+		static void _check_supported(const entry& e) {
+			if (e.is_encrypted()) {
+				throw std::runtime_error("Encrypted zip entries are not supported.");
+			} else if (e.method != static_cast<WORD>(method::STORED) && e.method != static_cast<WORD>(method::DEFLATED)) {
+				throw std::runtime_error("Zip entry compression method is not supported.");
+			}
+		}
+
+		static WORD   _u16(const BYTE* p) noexcept { return static_cast<WORD>(p[0] | (p[1] << 8)); }
+		static DWORD  _u32(const BYTE* p) noexcept { return static_cast<DWORD>(_u16(p) | (static_cast<DWORD>(_u16(p + 2)) << 16)); }
+		static UINT64 _u64(const BYTE* p) noexcept { return _u32(p) | (static_cast<UINT64>(_u32(p + 4)) << 32); }
+
+		// The local header may have different extra fields than the central directory, so it's read each time.
+		size_t _data_offset(const entry& e) const {
+			if (e.localHeaderOffset > this->_data.size() || this->_data.size() - e.localHeaderOffset < 30) {
+				_fail("local header is beyond end of file");
+			}
+			const BYTE* p = this->_data.data() + e.localHeaderOffset;
+			if (_u32(p) != 0x04034B50) _fail("bad local header signature");
+
+			UINT64 offset = e.localHeaderOffset + 30 + _u16(p + 26) + _u16(p + 28); // name and extra field
+			if (offset > this->_data.size()) _fail("local header is beyond end of file");
+			return static_cast<size_t>(offset);
+		}
+
+		void _read_central_dir() {
+			const BYTE* pData = this->_data.data();
+			size_t sz = this->_data.size();
+			if (sz < 22) _fail("file is too small");
+
+			size_t eocd = sz - 22; // end of central directory record, searched backwards, since a comment may follow
+			size_t minEocd = sz - 22 > 0xFFFF ? sz - 22 - 0xFFFF : 0;
+			for (;;) {
+				if (_u32(pData + eocd) == 0x06054B50 && eocd + 22 + _u16(pData + eocd + 20) <= sz) break;
+				if (eocd == minEocd) _fail("end of central directory not found");
+				--eocd;
+			}
+
+			UINT64 numEntries = _u16(pData + eocd + 10);
+			UINT64 dirSize = _u32(pData + eocd + 12);
+			UINT64 dirOffset = _u32(pData + eocd + 16);
+
+			if (numEntries == 0xFFFF || dirSize == 0xFFFFFFFF || dirOffset == 0xFFFFFFFF) { // ZIP64
+				if (eocd < 20 || _u32(pData + eocd - 20) != 0x07064B50) _fail("ZIP64 locator not found");
+				UINT64 eocd64 = _u64(pData + eocd - 20 + 8);
+				if (sz < 56 || eocd64 > sz - 56 || eocd64 + 56 > eocd - 20 // must come before the locator
+					|| _u32(pData + eocd64) != 0x06064B50) _fail("bad ZIP64 end of central directory");
+				numEntries = _u64(pData + eocd64 + 32);
+				dirSize = _u64(pData + eocd64 + 40);
+				dirOffset = _u64(pData + eocd64 + 48);
+			}
+			if (dirOffset > sz || dirSize > sz - dirOffset) _fail("central directory is beyond end of file");
+			if (numEntries > dirSize / 46) _fail("too many entries for the central directory size");
+
+			this->_entries.reserve(static_cast<size_t>(numEntries));
+			const BYTE* p = pData + dirOffset;
+			const BYTE* pEnd = p + dirSize;
+
+			for (UINT64 i = 0; i < numEntries; ++i) {
+				if (pEnd - p < 46 || _u32(p) != 0x02014B50) _fail("bad central directory header");
+				WORD nameLen = _u16(p + 28), extraLen = _u16(p + 30), commentLen = _u16(p + 32);
+				if (static_cast<size_t>(pEnd - p) < 46u + nameLen + extraLen + commentLen) _fail("central directory header is truncated");
+
+				entry& e = this->_entries.emplace_back();
+				e.flags = _u16(p + 8);
+				e.method = _u16(p + 10);
+				e.dosDateTime = _u32(p + 12);
+				e.crc32 = _u32(p + 16);
+				e.compressedSize = _u32(p + 20);
+				e.size = _u32(p + 24);
+				e.localHeaderOffset = _u32(p + 42);
+
+				const BYTE* pName = p + 46;
+				_wli::str_priv::decode_into(e.name, pName, nameLen,
+					(e.flags & 0x0800) ? CP_UTF8 : _is_ascii(pName, nameLen) ? 0 : 437); // bit 11 is UTF-8, else DOS code page
+				_read_zip64_extra(e, pName + nameLen, extraLen);
+
+				p += 46 + nameLen + extraLen + commentLen;
+			}
+
+			this->_byName.reserve(this->_entries.size());
+			for (size_t i = 0; i < this->_entries.size(); ++i) {
+				this->_byName[this->_entries[i].name] = i; // if repeated, last one wins
+			}
+		}
+
+		// Values which don't fit 32 bits are in the ZIP64 extra field, in this order, only if needed.
+		static void _read_zip64_extra(entry& e, const BYTE* pExtra, WORD extraLen) {
+			bool needSize = e.size == 0xFFFFFFFF, needComp = e.compressedSize == 0xFFFFFFFF,
+				needOffset = e.localHeaderOffset == 0xFFFFFFFF;
+			if (!needSize && !needComp && !needOffset) return;
+
+			for (const BYTE* p = pExtra, *pEnd = pExtra + extraLen; pEnd - p >= 4; ) {
+				WORD id = _u16(p), len = _u16(p + 2);
+				p += 4;
+				if (len > pEnd - p) break;
+				if (id == 0x0001) {
+					const BYTE* pField = p;
+					auto next = [&](UINT64& val) -> void {
+						if (pField + 8 > p + len) _fail("ZIP64 extra field is truncated");
+						val = _u64(pField);
+						pField += 8;
+					};
+					if (needSize) next(e.size);
+					if (needComp) next(e.compressedSize);
+					if (needOffset) next(e.localHeaderOffset);
+					return;
+				}
+				p += len;
+			}
+			_fail("ZIP64 extra field not found");
+		}
+
+		static bool _is_ascii(const BYTE* p, size_t sz) noexcept {
+			for (size_t i = 0; i < sz; ++i) {
+				if (p[i] >= 0x80) return false;
+			}
+			return true;
+		}
+	};
+
+	// Creates a zip file. Entries are split in pieces, which are compressed in parallel, by default one
+	// thread per core, and written in the order they were added. Archives larger than 4 GB use ZIP64.
+	class writer final {
+	private:
+		static const size_t _PIECE_SIZE = 1024 * 1024;
+		static const size_t _BUF_SIZE = 1024 * 1024; // small writes are joined
+		static const UINT64 _ZIP64_SIZE = 0xFF000000; // compressed size may grow a bit beyond the original
+
+		struct _source final {
+			file_mapped::view view; // when reading from a file
+			std::vector<BYTE> owned; // when data was moved in
+			const BYTE*       pData = nullptr;
+			size_t            size = 0;
+		};
+
+		struct _open_entry final {
+			std::string                      nameUtf8;
+			UINT64                           size = 0; // uncompressed
+			std::shared_ptr<const _source>   src;
+			WORD                             method = 0;
+			WORD                             flags = 0;
+			DWORD                            dosDateTime = 0;
+			bool                             isDir = false;
+			bool                             isZip64 = false; // sizes in the ZIP64 extra field
+			DWORD                            crc32 = 0;
+			UINT64                           compressedSize = 0;
+			UINT64                           localHeaderOffset = 0;
+		};
+
+		struct _piece final {
+			_open_entry*       pEntry;
+			size_t             start, end; // in the source
+			std::vector<BYTE>  out; // compressed data
+			DWORD              crc32 = 0;
+			std::exception_ptr failure;
+			bool               done = false;
+		};
+
+		file                                _fout;
+		std::vector<BYTE>                   _buf; // not yet written to the file
+		UINT64                              _bufOffset = 0; // file offset of the buffer start
+		std::deque<_open_entry>             _openEntries; // not fully written yet; deque doesn't move them
+		std::vector<_open_entry>            _writtenEntries;
+		int                                 _level = 6;
+		bool                                _isFinished = false;
+
+		std::vector<std::thread>            _workers;
+		std::mutex                          _mtx; // guards all below
+		std::condition_variable             _workReady, _pieceDone;
+		std::deque<std::unique_ptr<_piece>> _queue; // pieces in output order
+		size_t                              _numTaken = 0; // queue pieces already taken by the workers
+		bool                                _isStopping = false;
+
+	public:
+		~writer() {
+			this->_stop_workers(); // if not finished, the file is left incomplete
+		}
+
+		// Creates the file, or truncates it if it exists. Level goes from 1 (fastest) to 9 (smallest).
+		explicit writer(const std::wstring& zipFile, size_t numThreads = 0, int level = 6) : _level{level} {
+			this->_fout.open_or_create(zipFile);
+			this->_fout.set_new_size(0);
+
+			if (!numThreads) numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+			try {
+				for (size_t i = 0; i < numThreads; ++i) {
+					this->_workers.emplace_back([this]() noexcept { this->_work(); });
+				}
+			} catch (...) {
+				this->_stop_workers();
+				throw;
+			}
+		}
+
+		writer(const writer&) = delete;
+		writer& operator=(const writer&) = delete;
+
+		// Adds an entry from memory, which must stay valid until finish() returns.
+		writer& add(std::wstring_view name, const BYTE* pData, size_t sz, method compression = method::DEFLATED) {
+			std::shared_ptr<_source> src = std::make_shared<_source>();
+			src->pData = pData;
+			src->size = sz;
+			return this->_add(name, std::move(src), compression, datetime{});
+		}
+
+		// Adds an entry from memory, which is kept until the entry is written.
+		writer& add(std::wstring_view name, std::vector<BYTE>&& data, method compression = method::DEFLATED) {
+			std::shared_ptr<_source> src = std::make_shared<_source>();
+			src->owned = std::move(data);
+			src->pData = src->owned.data();
+			src->size = src->owned.size();
+			return this->_add(name, std::move(src), compression, datetime{});
+		}
+
+		// Adds an entry with the content of a file, which is read straight from its mapped memory.
+		writer& add_file(std::wstring_view name, const std::wstring& filePath, method compression = method::DEFLATED) {
+			std::shared_ptr<_source> src = std::make_shared<_source>();
+			src->view = file_mapped::util::read_view(filePath);
+			src->pData = src->view.data();
+			src->size = src->view.size();
+			return this->_add(name, std::move(src), compression, file::util::get_dates(filePath).lastWrite);
+		}
+
+		// Adds an empty directory entry.
+		writer& add_dir(std::wstring_view name) {
+			std::wstring dirName{name};
+			if (dirName.empty() || (dirName.back() != L'/' && dirName.back() != L'\\')) dirName.append(L"/");
+			return this->_add(dirName, std::make_shared<_source>(), method::STORED, datetime{});
+		}
+
+		// Waits for all entries to be written, then writes the central directory and closes the file.
+		writer& finish() {
+			this->_check_not_finished();
+			this->_write_ready(0);
+			this->_stop_workers();
+
+			UINT64 dirOffset = this->_offset();
+			for (const _open_entry& e : this->_writtenEntries) {
+				this->_write_central_header(e);
+			}
+			this->_write_end_of_central_dir(dirOffset, this->_offset() - dirOffset);
+
+			this->_flush();
+			this->_fout.close();
+			this->_isFinished = true;
+			return *this;
+		}
+
+	private:
+		void _check_not_finished() const {
+			if (this->_isFinished) {
+				throw std::logic_error("Zip file has already been finished.");
+			}
+		}
+
+		writer& _add(std::wstring_view name, std::shared_ptr<const _source> src, method compression, const datetime& modified) {
+			this->_check_not_finished();
+			if (name.empty()) {
+				throw std::invalid_argument("Zip entry name can't be empty.");
+			}
+
+			_open_entry& e = this->_openEntries.emplace_back();
+			std::wstring slashed{name};
+			for (wchar_t& ch : slashed) {
+				if (ch == L'\\') ch = L'/';
+			}
+			e.nameUtf8.resize(slashed.length() * 3); // worst case
+			e.nameUtf8.resize(_wli::str_utf::utf16_to_utf8(slashed.data(), slashed.length(),
+				reinterpret_cast<BYTE*>(&e.nameUtf8[0])));
+			if (e.nameUtf8.length() > 0xFFFF) {
+				this->_openEntries.pop_back();
+				throw std::length_error("Zip entry name is too long.");
+			}
+			for (char ch : e.nameUtf8) {
+				if (ch & 0x80) e.flags |= 0x0800; // bit 11: name is UTF-8
+			}
+
+			e.src = std::move(src);
+			e.size = e.src->size;
+			e.method = static_cast<WORD>(compression);
+			e.isDir = slashed.back() == L'/';
+			e.isZip64 = e.size >= _ZIP64_SIZE;
+			const SYSTEMTIME& st = modified.systemtime();
+			e.dosDateTime = st.wYear < 1980 ? 0x00210000 // 1980-01-01, earliest possible
+				: (static_cast<DWORD>(st.wYear - 1980) << 25) | (st.wMonth << 21) | (st.wDay << 16)
+				| (st.wHour << 11) | (st.wMinute << 5) | (st.wSecond / 2);
+
+			size_t numPieces = std::max<size_t>(static_cast<size_t>((e.size + _PIECE_SIZE - 1) / _PIECE_SIZE), 1); // size came from a size_t
+			for (size_t i = 0; i < numPieces; ++i) {
+				this->_write_ready(this->_workers.size() * 4); // limits the memory used by pieces waiting
+				std::unique_ptr<_piece> piece = std::make_unique<_piece>();
+				piece->pEntry = &e;
+				piece->start = i * _PIECE_SIZE;
+				piece->end = static_cast<size_t>(std::min<UINT64>(piece->start + _PIECE_SIZE, e.size));
+				{
+					std::lock_guard<std::mutex> lock{this->_mtx};
+					this->_queue.emplace_back(std::move(piece));
+				}
+				this->_workReady.notify_one();
+			}
+			return *this;
+		}
+
+		void _work() noexcept {
+			_wli::deflater compressor; // buffers reused for all pieces of this thread
+			for (;;) {
+				_piece* pPiece = nullptr;
+				{
+					std::unique_lock<std::mutex> lock{this->_mtx};
+					this->_workReady.wait(lock, [this]() -> bool {
+						return this->_isStopping || this->_numTaken < this->_queue.size();
+					});
+					if (this->_isStopping) return;
+					pPiece = this->_queue[this->_numTaken++].get();
+				}
+
+				try {
+					const _open_entry& e = *pPiece->pEntry;
+					const BYTE* pData = e.src->pData;
+					pPiece->crc32 = _wli::crc32::calc(pData + pPiece->start, pPiece->end - pPiece->start);
+					if (e.method == static_cast<WORD>(method::DEFLATED)) {
+						size_t dictStart = pPiece->start > _PIECE_SIZE ? pPiece->start - _PIECE_SIZE : 0; // previous piece
+						compressor.compress(pData, dictStart, pPiece->start, pPiece->end,
+							pPiece->end == e.size, this->_level, pPiece->out);
+					}
+				} catch (...) {
+					pPiece->failure = std::current_exception();
+				}
+
+				{
+					std::lock_guard<std::mutex> lock{this->_mtx};
+					pPiece->done = true;
+				}
+				this->_pieceDone.notify_one();
+			}
+		}
+
+		void _stop_workers() noexcept {
+			{
+				std::lock_guard<std::mutex> lock{this->_mtx};
+				this->_isStopping = true;
+			}
+			this->_workReady.notify_all();
+			for (std::thread& t : this->_workers) t.join();
+			this->_workers.clear();
+		}
+
+		// Writes the compressed pieces in order, waiting until no more than maxWaiting are in the queue.
+		void _write_ready(size_t maxWaiting) {
+			std::unique_lock<std::mutex> lock{this->_mtx};
+			for (;;) {
+				if (this->_queue.empty()) return;
+				if (!this->_queue.front()->done) {
+					if (this->_queue.size() <= maxWaiting) return;
+					this->_pieceDone.wait(lock, [this]() -> bool { return this->_queue.front()->done; });
+				}
+				std::unique_ptr<_piece> piece = std::move(this->_queue.front());
+				this->_queue.pop_front();
+				--this->_numTaken;
+				lock.unlock();
+				this->_write_piece(*piece); // workers go on meanwhile
+				lock.lock();
+			}
+		}
+
+		void _write_piece(_piece& piece) {
+			if (piece.failure) std::rethrow_exception(piece.failure);
+			_open_entry& e = *piece.pEntry;
+			size_t pieceSz = piece.end - piece.start;
+
+			if (!piece.start) this->_write_local_header(e);
+			e.crc32 = _wli::crc32::combine(e.crc32, piece.crc32, pieceSz);
+			if (e.method == static_cast<WORD>(method::DEFLATED)) {
+				this->_write(piece.out.data(), piece.out.size());
+				e.compressedSize += piece.out.size();
+			} else {
+				this->_write(e.src->pData + piece.start, pieceSz); // stored data is written straight from the source
+				e.compressedSize += pieceSz;
+			}
+
+			if (piece.end == e.size) { // last piece, header is completed
+				std::vector<BYTE> fields;
+				_put32(fields, e.crc32);
+				if (!e.isZip64) {
+					_put32(fields, static_cast<DWORD>(e.compressedSize));
+					_put32(fields, static_cast<DWORD>(e.size));
+				}
+				this->_patch(e.localHeaderOffset + 14, fields);
+				if (e.isZip64) {
+					fields.clear();
+					_put64(fields, e.size);
+					_put64(fields, e.compressedSize);
+					this->_patch(e.localHeaderOffset + 30 + e.nameUtf8.length() + 4, fields);
+				}
+
+				e.src.reset(); // source memory is released as soon as possible
+				this->_writtenEntries.emplace_back(std::move(e));
+				this->_openEntries.pop_front(); // entries are finished in order
+			}
+		}
+
+		void _write_local_header(_open_entry& e) {
+			e.localHeaderOffset = this->_offset();
+			std::vector<BYTE> h;
+			_put32(h, 0x04034B50);
+			_put16(h, e.isZip64 ? 45 : 20); // version needed
+			_put16(h, e.flags);
+			_put16(h, e.method);
+			_put32(h, e.dosDateTime);
+			_put32(h, 0); // CRC, sizes: filled when the entry is done
+			_put32(h, e.isZip64 ? 0xFFFFFFFF : 0);
+			_put32(h, e.isZip64 ? 0xFFFFFFFF : 0);
+			_put16(h, static_cast<WORD>(e.nameUtf8.length()));
+			_put16(h, e.isZip64 ? 20 : 0);
+			h.insert(h.end(), e.nameUtf8.begin(), e.nameUtf8.end());
+			if (e.isZip64) {
+				_put16(h, 0x0001);
+				_put16(h, 16);
+				_put64(h, 0);
+				_put64(h, 0);
+			}
+			this->_write(h.data(), h.size());
+		}
+
+		void _write_central_header(const _open_entry& e) {
+			std::vector<BYTE> extra; // ZIP64 fields, only those which don't fit
+			bool bigOffset = e.localHeaderOffset >= 0xFFFFFFFF;
+			if (e.isZip64) {
+				_put64(extra, e.size);
+				_put64(extra, e.compressedSize);
+			}
+			if (bigOffset) _put64(extra, e.localHeaderOffset);
+
+			std::vector<BYTE> h;
+			_put32(h, 0x02014B50);
+			_put16(h, 45); // version made by: MS-DOS, 4.5
+			_put16(h, e.isZip64 || bigOffset ? 45 : 20); // version needed
+			_put16(h, e.flags);
+			_put16(h, e.method);
+			_put32(h, e.dosDateTime);
+			_put32(h, e.crc32);
+			_put32(h, e.isZip64 ? 0xFFFFFFFF : static_cast<DWORD>(e.compressedSize));
+			_put32(h, e.isZip64 ? 0xFFFFFFFF : static_cast<DWORD>(e.size));
+			_put16(h, static_cast<WORD>(e.nameUtf8.length()));
+			_put16(h, static_cast<WORD>(extra.empty() ? 0 : extra.size() + 4));
+			_put16(h, 0); // comment length
+			_put16(h, 0); // disk number
+			_put16(h, 0); // internal attributes
+			_put32(h, e.isDir ? FILE_ATTRIBUTE_DIRECTORY : 0);
+			_put32(h, bigOffset ? 0xFFFFFFFF : static_cast<DWORD>(e.localHeaderOffset));
+			h.insert(h.end(), e.nameUtf8.begin(), e.nameUtf8.end());
+			if (!extra.empty()) {
+				_put16(h, 0x0001);
+				_put16(h, static_cast<WORD>(extra.size()));
+				h.insert(h.end(), extra.begin(), extra.end());
+			}
+			this->_write(h.data(), h.size());
+		}
+
+		void _write_end_of_central_dir(UINT64 dirOffset, UINT64 dirSize) {
+			UINT64 numEntries = this->_writtenEntries.size();
+			std::vector<BYTE> h;
+
+			if (numEntries >= 0xFFFF || dirOffset >= 0xFFFFFFFF || dirSize >= 0xFFFFFFFF) {
+				UINT64 eocd64Offset = this->_offset();
+				_put32(h, 0x06064B50); // ZIP64 end of central directory record
+				_put64(h, 44); // size of the rest of the record
+				_put16(h, 45); // version made by
+				_put16(h, 45); // version needed
+				_put32(h, 0); // disk number
+				_put32(h, 0); // disk of the central directory
+				_put64(h, numEntries);
+				_put64(h, numEntries);
+				_put64(h, dirSize);
+				_put64(h, dirOffset);
+
+				_put32(h, 0x07064B50); // ZIP64 end of central directory locator
+				_put32(h, 0);
+				_put64(h, eocd64Offset);
+				_put32(h, 1); // total number of disks
+			}
+
+			_put32(h, 0x06054B50);
+			_put16(h, 0); // disk number
+			_put16(h, 0); // disk of the central directory
+			_put16(h, static_cast<WORD>(std::min<UINT64>(numEntries, 0xFFFF)));
+			_put16(h, static_cast<WORD>(std::min<UINT64>(numEntries, 0xFFFF)));
+			_put32(h, static_cast<DWORD>(std::min<UINT64>(dirSize, 0xFFFFFFFF)));
+			_put32(h, static_cast<DWORD>(std::min<UINT64>(dirOffset, 0xFFFFFFFF)));
+			_put16(h, 0); // comment length
+			this->_write(h.data(), h.size());
+		}
+
+		UINT64 _offset() const noexcept { return this->_bufOffset + this->_buf.size(); }
+
+		void _write(const BYTE* pData, size_t sz) {
+			if (this->_buf.size() + sz > _BUF_SIZE) {
+				this->_flush();
+				if (sz >= _BUF_SIZE) { // large blocks are written straight
+					this->_fout.write_at(this->_bufOffset, pData, sz);
+					this->_bufOffset += sz;
+					return;
+				}
+			}
+			this->_buf.insert(this->_buf.end(), pData, pData + sz);
+		}
+
+		// Overwrites bytes already written, which may still be in the buffer.
+		void _patch(UINT64 offset, const std::vector<BYTE>& data) {
+			if (offset >= this->_bufOffset) {
+				memcpy(&this->_buf[static_cast<size_t>(offset - this->_bufOffset)], data.data(), data.size());
+			} else {
+				this->_fout.write_at(offset, data.data(), data.size());
+			}
+		}
+
+		void _flush() {
+			if (!this->_buf.empty()) {
+				this->_fout.write_at(this->_bufOffset, this->_buf.data(), this->_buf.size());
+				this->_bufOffset += this->_buf.size();
+				this->_buf.clear(); // memory is reused
+			}
+		}
+
+		static void _put16(std::vector<BYTE>& v, WORD val) {
+			v.emplace_back(static_cast<BYTE>(val));
+			v.emplace_back(static_cast<BYTE>(val >> 8));
+		}
+
+		static void _put32(std::vector<BYTE>& v, DWORD val) {
+			_put16(v, static_cast<WORD>(val));
+			_put16(v, static_cast<WORD>(val >> 16));
+		}
+
+		static void _put64(std::vector<BYTE>& v, UINT64 val) {
+			_put32(v, static_cast<DWORD>(val));
+			_put32(v, static_cast<DWORD>(val >> 32));
+		}
+	};
+
+	// Progress of extract_all(), as reported to the callback.
+	struct extract_progress final {
+		size_t numFiles = 0;
+		size_t totalFiles = 0;
+		UINT64 numBytes = 0; // uncompressed
+		UINT64 totalBytes = 0;
+	};
+
+	// Extracts all files into the directory, creating the subdirectories; existing files are overwritten.
 	static void extract_all(const std::wstring& zipFile, const std::wstring& destFolder) {
+		extract_all(zipFile, destFolder, nullptr);
+	}
+
+	// Extracts all files into the directory, decompressing them in parallel, by default one thread per core.
+	// The callback is always invoked in the calling thread, while the workers run; returning false cancels
+	// the extraction: files being written are finished, the rest are skipped. Returns false if cancelled.
+	// An exception thrown in a worker stops all of them, and is rethrown in the calling thread.
+	static bool extract_all(const std::wstring& zipFile, const std::wstring& destFolder,
+		std::function<bool(const extract_progress&)> onProgress, size_t numThreads = 0)
+	{
 		if (!file::util::exists(zipFile)) {
 			throw std::invalid_argument("File doesn't exist.");
 		}
@@ -26,48 +734,189 @@ public:
 			throw std::invalid_argument("Output directory doesn't exist.");
 		}
 
-		// http://social.msdn.microsoft.com/Forums/vstudio/en-US/45668d18-2840-4887-87e1-4085201f4103/visual-c-to-unzip-a-zip-file-to-a-specific-directory
-		com::lib comLib{com::lib::init::NOW};
+		reader zin{zipFile};
+		_extract_job job{zin};
+		std::vector<std::wstring> dirs;
 
-		com::ptr<IShellDispatch> shellDispatch;
-		shellDispatch.co_create_instance(CLSID_Shell, IID_IShellDispatch);
-		
-		com::variant variZipFilePath;
-		variZipFilePath.set_str(zipFile);
+		for (const entry& e : zin.entries()) { // all paths are validated before anything is written
+			std::wstring destPath = _dest_path(destFolder, e.name);
+			if (e.is_dir()) {
+				dirs.emplace_back(std::move(destPath));
+				continue;
+			}
+			size_t idxSep = destPath.find_last_of(L'\\');
+			if (idxSep > destFolder.length()) dirs.emplace_back(destPath.substr(0, idxSep));
+			job.files.push_back({&e, std::move(destPath)});
+			job.prog.totalBytes += e.size;
+		}
+		_create_dirs(dirs, destFolder.length());
 
-		com::ptr<Folder> zippedFile;
-		com::check_hr(
-			shellDispatch->NameSpace(variZipFilePath, &zippedFile),
-			"IShellDispatch::NameSpace failed on zip file name");
-		
-		com::variant variOutFolderPath;
-		variOutFolderPath.set_str(destFolder);
+		std::sort(job.files.begin(), job.files.end(), [](const _extract_file& a, const _extract_file& b) -> bool {
+			return a.pEntry->size > b.pEntry->size; // largest first, so the workers end together
+		});
+		job.prog.totalFiles = job.files.size();
 
-		com::ptr<Folder> outFolder;
-		com::check_hr(
-			shellDispatch->NameSpace(variOutFolderPath, &outFolder),
-			"IShellDispatch::NameSpace failed on directory name");
+		if (!numThreads) numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+		numThreads = std::min(numThreads, job.files.size());
+		job.numRunning = numThreads;
 
-		com::ptr<FolderItems> filesInside;
-		com::check_hr(
-			zippedFile->Items(&filesInside),
-			"Folder::Items failed");
+		std::vector<std::thread> workers;
+		try {
+			for (size_t i = 0; i < numThreads; ++i) {
+				workers.emplace_back([&job]() noexcept { job.run(); });
+			}
+		} catch (...) {
+			job.stop = true; // couldn't create a thread, the ones already running are stopped
+			for (std::thread& t : workers) t.join();
+			throw;
+		}
+
+		bool cancelled = false;
+		std::unique_lock<std::mutex> lock{job.mtx};
+		while (!workers.empty()) {
+			job.changed.wait(lock, [&job]() -> bool { return job.hasNews; });
+			job.hasNews = false;
+			extract_progress snapshot = job.prog;
+			bool isLast = job.numRunning == 0;
+
+			if (onProgress && !cancelled && !job.failure) {
+				lock.unlock(); // workers go on while the callback runs
+				bool goOn = true;
+				std::exception_ptr callbackFailure;
+				try {
+					goOn = onProgress(snapshot);
+				} catch (...) {
+					callbackFailure = std::current_exception();
+				}
+				lock.lock();
+
+				if (callbackFailure && !job.failure) job.failure = callbackFailure;
+				if (!goOn || callbackFailure) {
+					cancelled = !goOn;
+					job.stop = true;
+				}
+			}
+			if (isLast) break;
+		}
+		lock.unlock();
+
+		for (std::thread& t : workers) t.join();
+		if (job.failure) std::rethrow_exception(job.failure);
+		return !cancelled;
+	}
+
+private:
+	struct _extract_file final {
+		const entry* pEntry;
+		std::wstring destPath;
+	};
 
-		long fileCount = 0;
-		com::check_hr(
-			filesInside->get_Count(&fileCount),
-			"Folder::get_Count failed");
+	// State shared by the extraction workers and the calling thread.
+	struct _extract_job final {
+		const reader&              zin;
+		std::vector<_extract_file> files;
+		std::atomic<size_t>        nextFile{0};
+		std::atomic<bool>          stop{false};
+		std::mutex                 mtx; // guards all below
+		std::condition_variable    changed;
+		extract_progress           prog;
+		std::exception_ptr         failure;
+		size_t                     numRunning = 0; // workers which have not finished yet
+		bool                       hasNews = false;
 
-		com::variant variItem;
-		variItem.set_idispatch(filesInside);
+		explicit _extract_job(const reader& zin) noexcept : zin{zin} { }
 
-		com::variant variOptions;
-		variOptions.set_int4(1024 | 512 | 16 | 4); // http://msdn.microsoft.com/en-us/library/bb787866(VS.85).aspx
+		void run() noexcept {
+			std::vector<BYTE> buf; // reused for all entries of this thread
 
-		com::check_hr(
-			outFolder->CopyHere(variItem, variOptions),
-			"Folder::CopyHere failed");
+			while (!this->stop) {
+				size_t idx = this->nextFile++;
+				if (idx >= this->files.size()) break;
+				const _extract_file& f = this->files[idx];
+
+				try {
+					_extract_one(this->zin, *f.pEntry, f.destPath, buf);
+				} catch (...) {
+					std::lock_guard<std::mutex> lock{this->mtx};
+					if (!this->failure) this->failure = std::current_exception();
+					this->stop = true;
+					break;
+				}
+
+				std::lock_guard<std::mutex> lock{this->mtx};
+				++this->prog.numFiles;
+				this->prog.numBytes += f.pEntry->size;
+				this->hasNews = true;
+				this->changed.notify_one();
+			}
+
+			std::lock_guard<std::mutex> lock{this->mtx};
+			--this->numRunning;
+			this->hasNews = true; // the calling thread must see the last worker leaving
+			this->changed.notify_one();
+		}
+	};
+
+	// File is created with its final size before it's written, so it's not fragmented.
+	static void _extract_one(const reader& zin, const entry& e, const std::wstring& destPath, std::vector<BYTE>& buf) {
+		if (e.method == static_cast<WORD>(method::STORED) && !e.is_encrypted()) {
+			file_mapped::view content = zin.view(e); // written straight from the mapped memory
+			if (content.size() != e.size || _wli::crc32::calc(content.data(), content.size()) != e.crc32) {
+				throw std::runtime_error("Invalid zip file: CRC mismatch.");
+			}
+			file::util::write(destPath, content.data(), content.size());
+		} else {
+			zin.extract(e, buf);
+			file::util::write(destPath, buf.data(), buf.size());
+		}
+	}
+
+	// Entry names are checked, so nothing can be written outside the destination directory.
+	static std::wstring _dest_path(const std::wstring& destFolder, const std::wstring& entryName) {
+		std::wstring ret = destFolder;
+		if (!ret.empty() && ret.back() != L'\\' && ret.back() != L'/') ret.append(L"\\");
+
+		if (entryName.empty() || entryName[0] == L'/' || entryName[0] == L'\\'
+			|| entryName.find(L':') != std::wstring::npos)
+		{
+			throw std::runtime_error("Zip entry has an absolute path.");
+		}
+
+		for (size_t pos = 0; pos < entryName.length(); ) {
+			size_t idxSep = std::min(entryName.find_first_of(L"/\\", pos), entryName.length());
+			if (entryName.compare(pos, idxSep - pos, L"..") == 0) {
+				throw std::runtime_error("Zip entry path goes outside the destination directory.");
+			}
+			pos = idxSep + 1;
+		}
+
+		size_t prevLen = ret.length();
+		ret.append(entryName);
+		for (size_t i = prevLen; i < ret.length(); ++i) {
+			if (ret[i] == L'/') ret[i] = L'\\';
+		}
+		if (ret.back() == L'\\') ret.pop_back();
+		return ret;
+	}
+
+	// Creates all missing directories at once, parents before children; the prefix must already exist.
+	static void _create_dirs(std::vector<std::wstring>& dirPaths, size_t prefixLen) {
+		std::sort(dirPaths.begin(), dirPaths.end());
+		dirPaths.erase(std::unique(dirPaths.begin(), dirPaths.end()), dirPaths.end());
+		std::wstring lastCreated;
+
+		for (const std::wstring& dirPath : dirPaths) {
+			for (size_t pos = prefixLen + 1; pos <= dirPath.length(); ++pos) {
+				if (pos != dirPath.length() && dirPath[pos] != L'\\') continue;
+				std::wstring_view partial{dirPath.data(), pos};
+				if (lastCreated.length() >= pos && std::wstring_view{lastCreated}.substr(0, pos) == partial
+					&& (lastCreated.length() == pos || lastCreated[pos] == L'\\')) continue; // parent of the previous one
+				std::wstring partialStr{partial};
+				if (!file::util::exists(partialStr)) file::util::create_dir(partialStr);
+			}
+			lastCreated = dirPath;
+		}
 	}
 };
 
-}//namespace wl
\ No newline at end of file
+}//namespace wl